@@ -32,13 +32,18 @@ settings_t defaults = {
 .indicate_hidden = true,     /* show count of hidden messages */
 .idle_threshold = 0,         /* don't timeout notifications when idle for x seconds */
 .show_age_threshold = -1,    /* show age of notification, when notification is older than x seconds */
+.frame_interval = 0,         /* minimum time between two redraws, 0 to redraw when idle */
+.presentation = PRESENTATION_AUTO, /* how to get the image to the X server [auto/shm/xlib] */
 .align = left,               /* text alignment [left/center/right] */
 .sticky_history = true,
 .history_length = 20,        /* max amount of notifications kept in history */
+.history_max_memory = 0,     /* max kilobytes of memory used by the history, 0 for no limit */
+.history_log_length = 0,     /* max amount of notifications kept in the history log on disk, 0 to disable */
 .show_indicators = true,
 .word_wrap = false,
 .ellipsize = middle,
 .ignore_newline = false,
+.max_body_length = 16384,    /* max bytes of a body received via DBus, 0 for no limit */
 .line_height = 0,            /* if line height < font height, it will be raised to font height */
 .notification_height = 0,    /* if notification height < font height and padding, it will be raised */
 .corner_radius = 0,
@@ -66,8 +71,25 @@ settings_t defaults = {
 
 .browser = "/usr/bin/firefox",
 
+/* maximum number of scripts running at once, 0 for no limit */
+.script_concurrency = 4,
+/* number of script runs waiting for a free slot */
+.script_queue_length = 32,
+/* what to do with further runs, when the queue is full [drop/coalesce] */
+.script_overflow = SCRIPT_OVERFLOW_DROP,
+
+/* notifications per second and client, 0 for no limit */
+.rate_limit = 0,
+/* number of notifications a client may send at once */
+.rate_limit_burst = 10,
+/* what to do with further notifications [drop/collapse/delay] */
+.rate_limit_action = RATE_LIMIT_COLLAPSE,
+
 .max_icon_size = 0,
 
+/* memory limit for the icon cache in kilobytes */
+.icon_cache_size = 4096,
+
 /* paths to default icons */
 .icon_path = "/usr/share/icons/gnome/16x16/status/:/usr/share/icons/gnome/16x16/devices/",
 
@@ -135,6 +157,7 @@ rule_t default_rules[] = {
                 .bg              = NULL,
                 .format          = NULL,
                 .script          = NULL,
+                .rate_limit      = -1,
         }
 };
 
@@ -12,11 +12,19 @@ PKG_CONFIG ?= pkg-config
 # or use "CFLAGS=-DSTATIC_CONFIG make" to build
 #STATIC= -DSTATIC_CONFIG # Warning: This is deprecated behavior
 
+# uncomment to compile in the static tracepoints (USDT probes) for bpftrace
+# or perf, see contrib/dunst_trace.bt. Needs sys/sdt.h from systemtap
+#TRACEPOINTS ?= 1
+
 # flags
 DEFAULT_CPPFLAGS = -D_DEFAULT_SOURCE -DVERSION=\"${VERSION}\"
 DEFAULT_CFLAGS   = -g --std=gnu99 -pedantic -Wall -Wno-overlength-strings -Os ${STATIC}
 DEFAULT_LDFLAGS  = -lm
 
+ifeq (1,${TRACEPOINTS})
+DEFAULT_CPPFLAGS += -DENABLE_TRACEPOINTS
+endif
+
 CPPFLAGS_DEBUG := -DDEBUG_BUILD
 CFLAGS_DEBUG   := -O0
 LDFLAGS_DEBUG  :=
@@ -22,6 +22,11 @@ static gboolean printid = false;
 static guint32 replace_id = 0;
 static guint32 close_id = 0;
 static gboolean block = false;
+static gint flood = 0;
+static gdouble flood_rate = 0;
+static gchar *flood_mix_str = NULL;
+static gint flood_body_size = 0;
+static gint flood_icon_size = 64;
 
 static GOptionEntry entries[] =
 {
@@ -41,6 +46,16 @@ static GOptionEntry entries[] =
     { NULL }
 };
 
+static GOptionEntry flood_entries[] =
+{
+    { "flood",        0, 0, G_OPTION_ARG_INT,            &flood,           "Send N notifications over a single connection and print statistics", "N"},
+    { "rate",         0, 0, G_OPTION_ARG_DOUBLE,         &flood_rate,      "Notifications per second to send, 0 sends all at once", "RATE"},
+    { "mix",          0, 0, G_OPTION_ARG_STRING,         &flood_mix_str,   "Percentages of the notifications to send differently, e.g. low:20,critical:5,icon:10,replace:30,close:10", "MIX"},
+    { "body-size",    0, 0, G_OPTION_ARG_INT,            &flood_body_size, "Pad the bodies to SIZE bytes", "SIZE"},
+    { "icon-size",    0, 0, G_OPTION_ARG_INT,            &flood_icon_size, "Size of the generated raw icons, unless --raw_icon is given", "SIZE"},
+    { NULL }
+};
+
 void die(int exit_value)
 {
     if (notify_is_initted())
@@ -83,6 +98,13 @@ void parse_commandline(int argc, char *argv[])
 
     context = g_option_context_new("- Dunstify");
     g_option_context_add_main_entries(context, entries, NULL);
+
+    GOptionGroup *group = g_option_group_new("flood",
+                                             "Load generator options:",
+                                             "Show load generator options",
+                                             NULL, NULL);
+    g_option_group_add_entries(group, flood_entries);
+    g_option_context_add_group(context, group);
     if (!g_option_context_parse(context, &argc, &argv, &error)){
         g_printerr("Invalid commandline: %s\n", error->message);
         exit(1);
@@ -100,9 +122,11 @@ void parse_commandline(int argc, char *argv[])
         die(0);
     }
 
-    if (argc < 2 && close_id < 1) {
+    if (argc < 2 && close_id < 1 && flood < 1) {
         g_printerr("I need at least a summary\n");
         die(1);
+    } else if (argc < 2 && flood > 0) {
+        summary = g_strdup("Flood");
     } else if (argc < 2) {
         summary = g_strdup("These are not the summaries you are looking for");
     } else {
@@ -251,6 +275,339 @@ void add_hint(NotifyNotification *n, char *str)
 
 }
 
+/*
+ * Load generator
+ *
+ * Sends the notifications directly via GDBus over a single connection,
+ * as libnotify waits for every reply and spawning a client per
+ * notification would cost more than the daemon itself.
+ */
+
+#define FDN_NAME "org.freedesktop.Notifications"
+#define FDN_PATH "/org/freedesktop/Notifications"
+
+enum flood_kind { FLOOD_LOW, FLOOD_CRITICAL, FLOOD_ICON, FLOOD_REPLACE, FLOOD_CLOSE, FLOOD_KINDS };
+
+static const char *flood_kind_names[FLOOD_KINDS] = { "low", "critical", "icon", "replace", "close" };
+
+static struct {
+    GDBusConnection *conn;
+    GMainLoop *loop;
+    int mix[FLOOD_KINDS];       /* percentage of each kind */
+    GVariant *image;            /* the image-data hint for FLOOD_ICON */
+    char *body;
+    gint64 start;
+    int sent;                   /* Notify and CloseNotification calls sent so far */
+    int pending;                /* calls without a reply yet */
+    int errors;
+    int closes;
+    int closed;                 /* NotificationClosed signals received */
+    GArray *latencies;          /* round trip of every Notify call in microseconds */
+    GArray *ids;                /* the ids returned by the daemon */
+} fl = { 0 };
+
+static bool flood_parse_mix(const char *str)
+{
+    if (!str)
+        return true;
+
+    gchar **parts = g_strsplit(str, ",", -1);
+    int total = 0;
+    bool ok = true;
+
+    for (int i = 0; parts[i] && ok; i++) {
+        char *value = strchr(parts[i], ':');
+        int kind;
+
+        ok = false;
+        if (!value)
+            break;
+        *value++ = '\0';
+
+        for (kind = 0; kind < FLOOD_KINDS; kind++)
+            if (strcmp(parts[i], flood_kind_names[kind]) == 0)
+                break;
+        if (kind == FLOOD_KINDS)
+            break;
+
+        fl.mix[kind] = atoi(value);
+        total += fl.mix[kind];
+        ok = fl.mix[kind] >= 0 && total <= 100;
+    }
+
+    g_strfreev(parts);
+    return ok;
+}
+
+static GVariant *flood_image_data(void)
+{
+    GdkPixbuf *pixbuf;
+
+    if (raw_icon_path) {
+        GError *err = NULL;
+        pixbuf = gdk_pixbuf_new_from_file(raw_icon_path, &err);
+        if (err) {
+            g_printerr("Unable to get raw icon: %s\n", err->message);
+            g_error_free(err);
+            return NULL;
+        }
+    } else {
+        pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, true, 8, flood_icon_size, flood_icon_size);
+        gdk_pixbuf_fill(pixbuf, 0x3366ccff);
+    }
+
+    const guchar *data = gdk_pixbuf_read_pixels(pixbuf);
+    gsize len = gdk_pixbuf_get_byte_length(pixbuf);
+
+    GVariant *image = g_variant_new("(iiibii@ay)",
+                                    gdk_pixbuf_get_width(pixbuf),
+                                    gdk_pixbuf_get_height(pixbuf),
+                                    gdk_pixbuf_get_rowstride(pixbuf),
+                                    gdk_pixbuf_get_has_alpha(pixbuf),
+                                    gdk_pixbuf_get_bits_per_sample(pixbuf),
+                                    gdk_pixbuf_get_n_channels(pixbuf),
+                                    g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, data, len, 1));
+
+    g_object_unref(pixbuf);
+    return g_variant_ref_sink(image);
+}
+
+static enum flood_kind flood_pick_kind(void)
+{
+    int dice = g_random_int_range(0, 100);
+
+    for (int kind = 0; kind < FLOOD_KINDS; kind++) {
+        if (dice < fl.mix[kind])
+            return kind;
+        dice -= fl.mix[kind];
+    }
+
+    return FLOOD_KINDS;
+}
+
+static guint32 flood_random_id(void)
+{
+    if (fl.ids->len == 0)
+        return 0;
+    return g_array_index(fl.ids, guint32, g_random_int_range(0, fl.ids->len));
+}
+
+static gboolean flood_quit(gpointer data)
+{
+    g_main_loop_quit(fl.loop);
+    return G_SOURCE_REMOVE;
+}
+
+static void flood_reply_done(void)
+{
+    fl.pending--;
+    if (fl.sent == flood && fl.pending == 0)
+        /* give the NotificationClosed signals a moment to arrive */
+        g_timeout_add(200, flood_quit, NULL);
+}
+
+static void flood_notify_done(GObject *source, GAsyncResult *res, gpointer data)
+{
+    gint64 *sent_at = data;
+    GError *err = NULL;
+    GVariant *reply = g_dbus_connection_call_finish(fl.conn, res, &err);
+
+    if (reply) {
+        guint32 id;
+        gint64 latency = g_get_monotonic_time() - *sent_at;
+
+        g_variant_get(reply, "(u)", &id);
+        g_array_append_val(fl.latencies, latency);
+        g_array_append_val(fl.ids, id);
+        g_variant_unref(reply);
+    } else {
+        fl.errors++;
+        g_error_free(err);
+    }
+
+    g_free(sent_at);
+    flood_reply_done();
+}
+
+static void flood_close_done(GObject *source, GAsyncResult *res, gpointer data)
+{
+    GError *err = NULL;
+    GVariant *reply = g_dbus_connection_call_finish(fl.conn, res, &err);
+
+    if (reply) {
+        g_variant_unref(reply);
+    } else {
+        fl.errors++;
+        g_error_free(err);
+    }
+
+    flood_reply_done();
+}
+
+static void flood_closed(GDBusConnection *connection,
+                         const gchar *sender,
+                         const gchar *path,
+                         const gchar *interface,
+                         const gchar *signal,
+                         GVariant *parameters,
+                         gpointer data)
+{
+    fl.closed++;
+}
+
+static void flood_send(void)
+{
+    enum flood_kind kind = flood_pick_kind();
+    guint32 replaces = 0;
+    guchar urg = urgency;
+
+    fl.sent++;
+    fl.pending++;
+
+    if (kind == FLOOD_CLOSE && fl.ids->len > 0) {
+        fl.closes++;
+        g_dbus_connection_call(fl.conn, FDN_NAME, FDN_PATH, FDN_NAME,
+                               "CloseNotification",
+                               g_variant_new("(u)", flood_random_id()),
+                               NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+                               flood_close_done, NULL);
+        return;
+    }
+
+    GVariantBuilder hints;
+    g_variant_builder_init(&hints, G_VARIANT_TYPE("a{sv}"));
+
+    if (kind == FLOOD_LOW)
+        urg = NOTIFY_URGENCY_LOW;
+    else if (kind == FLOOD_CRITICAL)
+        urg = NOTIFY_URGENCY_CRITICAL;
+    else if (kind == FLOOD_ICON)
+        g_variant_builder_add(&hints, "{sv}", "image-data", fl.image);
+    else if (kind == FLOOD_REPLACE)
+        replaces = flood_random_id();
+
+    g_variant_builder_add(&hints, "{sv}", "urgency", g_variant_new_byte(urg));
+
+    gchar *summary_n = g_strdup_printf("%s %d", summary, fl.sent);
+    GVariant *params = g_variant_new("(susss@asa{sv}i)",
+                                     appname,
+                                     replaces,
+                                     icon ? icon : "",
+                                     summary_n,
+                                     fl.body,
+                                     g_variant_new_strv(NULL, 0),
+                                     &hints,
+                                     timeout);
+    g_free(summary_n);
+
+    gint64 *sent_at = g_new(gint64, 1);
+    *sent_at = g_get_monotonic_time();
+
+    g_dbus_connection_call(fl.conn, FDN_NAME, FDN_PATH, FDN_NAME,
+                           "Notify", params, G_VARIANT_TYPE("(u)"),
+                           G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+                           flood_notify_done, sent_at);
+}
+
+static gboolean flood_tick(gpointer data)
+{
+    int due = flood;
+
+    if (flood_rate > 0) {
+        double elapsed = (g_get_monotonic_time() - fl.start) / (double) G_USEC_PER_SEC;
+        due = MIN(flood, (int) (elapsed * flood_rate) + 1);
+    }
+
+    while (fl.sent < due)
+        flood_send();
+
+    return fl.sent < flood ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+static gint compare_latency(gconstpointer a, gconstpointer b)
+{
+    gint64 x = *(const gint64 *) a, y = *(const gint64 *) b;
+    return (x > y) - (x < y);
+}
+
+static gint64 flood_percentile(double fraction)
+{
+    if (fl.latencies->len == 0)
+        return 0;
+
+    guint i = MIN(fl.latencies->len - 1, (guint) (fraction * fl.latencies->len));
+    return g_array_index(fl.latencies, gint64, i);
+}
+
+static void flood_report(void)
+{
+    gint64 duration = g_get_monotonic_time() - fl.start;
+
+    g_array_sort(fl.latencies, compare_latency);
+
+    g_print("sent:%d\n", fl.sent);
+    g_print("notify:%u\n", fl.latencies->len);
+    g_print("close:%d\n", fl.closes);
+    g_print("errors:%d\n", fl.errors);
+    g_print("closed_signals:%d\n", fl.closed);
+    g_print("duration_ms:%.1f\n", duration / 1000.0);
+    g_print("rate:%.1f\n", fl.sent / (duration / (double) G_USEC_PER_SEC));
+    g_print("latency_p50_us:%" G_GINT64_FORMAT "\n", flood_percentile(0.5));
+    g_print("latency_p90_us:%" G_GINT64_FORMAT "\n", flood_percentile(0.9));
+    g_print("latency_p99_us:%" G_GINT64_FORMAT "\n", flood_percentile(0.99));
+    g_print("latency_max_us:%" G_GINT64_FORMAT "\n", flood_percentile(1));
+}
+
+int flood_run(void)
+{
+    GError *err = NULL;
+
+    if (!flood_parse_mix(flood_mix_str)) {
+        g_printerr("Malformed mix. Expected \"kind:percent,...\" adding up to at most 100, got \"%s\"\n", flood_mix_str);
+        return 1;
+    }
+
+    fl.conn = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &err);
+    if (!fl.conn) {
+        g_printerr("Unable to connect to the session bus: %s\n", err->message);
+        g_error_free(err);
+        return 1;
+    }
+
+    if (fl.mix[FLOOD_ICON] > 0 && !(fl.image = flood_image_data()))
+        return 1;
+
+    GString *padded = g_string_new(body);
+    while (padded->len < (gsize) flood_body_size)
+        g_string_append_c(padded, 'x' + padded->len % 3);
+    fl.body = g_string_free(padded, false);
+
+    fl.latencies = g_array_sized_new(false, false, sizeof(gint64), flood);
+    fl.ids = g_array_new(false, false, sizeof(guint32));
+    fl.loop = g_main_loop_new(NULL, false);
+
+    g_dbus_connection_signal_subscribe(fl.conn, NULL, FDN_NAME, "NotificationClosed",
+                                       FDN_PATH, NULL, G_DBUS_SIGNAL_FLAGS_NONE,
+                                       flood_closed, NULL, NULL);
+
+    fl.start = g_get_monotonic_time();
+    if (flood_tick(NULL))
+        g_timeout_add(1, flood_tick, NULL);
+
+    g_main_loop_run(fl.loop);
+    flood_report();
+
+    g_main_loop_unref(fl.loop);
+    g_array_free(fl.latencies, true);
+    g_array_free(fl.ids, true);
+    g_free(fl.body);
+    if (fl.image)
+        g_variant_unref(fl.image);
+    g_object_unref(fl.conn);
+
+    return fl.errors > 0 ? 1 : 0;
+}
+
 int main(int argc, char *argv[])
 {
     setlocale(LC_ALL, "");
@@ -259,6 +616,9 @@ int main(int argc, char *argv[])
     #endif
     parse_commandline(argc, argv);
 
+    if (flood > 0)
+        die(flood_run());
+
     if (!notify_init(appname)) {
         g_printerr("Unable to initialize libnotify\n");
         die(1);
@@ -1,6 +1,7 @@
 /* copyright 2013 Sascha Kruse and contributors (see LICENSE for licensing information) */
 #include "dbus.h"
 
+#include <assert.h>
 #include <gio/gio.h>
 #include <glib.h>
 #include <stdio.h>
@@ -8,15 +9,20 @@
 
 #include "dunst.h"
 #include "log.h"
+#include "markup.h"
 #include "notification.h"
 #include "queues.h"
 #include "settings.h"
+#include "stats.h"
+#include "trace.h"
 #include "utils.h"
 
 #define FDN_PATH "/org/freedesktop/Notifications"
 #define FDN_IFAC "org.freedesktop.Notifications"
 #define FDN_NAME "org.freedesktop.Notifications"
 
+#define DUNST_IFAC "org.dunstproject.cmd0"
+
 GDBusConnection *dbus_conn;
 
 static GDBusNodeInfo *introspection_data = NULL;
@@ -63,6 +69,18 @@ static const char *introspection_xml =
     "            <arg name=\"action_key\" type=\"s\"/>"
     "        </signal>"
     "   </interface>"
+    "    <interface name=\""DUNST_IFAC"\">"
+
+    "        <method name=\"GetStatistics\">"
+    "            <arg direction=\"out\" name=\"counters\"        type=\"a{st}\"/>"
+    "            <arg direction=\"out\" name=\"latencies\"       type=\"a(stttat)\"/>"
+    "        </method>"
+
+    "        <method name=\"GetRateLimitCounters\">"
+    "            <arg direction=\"out\" name=\"totals\"          type=\"(uuuu)\"/>"
+    "            <arg direction=\"out\" name=\"clients\"         type=\"a(suuuu)\"/>"
+    "        </method>"
+    "   </interface>"
     "</node>";
 
 static void on_get_capabilities(GDBusConnection *connection,
@@ -81,6 +99,10 @@ static void on_get_server_information(GDBusConnection *connection,
                                       const gchar *sender,
                                       const GVariant *parameters,
                                       GDBusMethodInvocation *invocation);
+static void on_get_rate_limit_counters(GDBusConnection *connection,
+                                       const gchar *sender,
+                                       GVariant *parameters,
+                                       GDBusMethodInvocation *invocation);
 static RawImage *get_raw_image_from_data_hint(GVariant *icon_data);
 
 void handle_method_call(GDBusConnection *connection,
@@ -100,6 +122,11 @@ void handle_method_call(GDBusConnection *connection,
                 on_close_notification(connection, sender, parameters, invocation);
         } else if (g_strcmp0(method_name, "GetServerInformation") == 0) {
                 on_get_server_information(connection, sender, parameters, invocation);
+        } else if (g_strcmp0(method_name, "GetStatistics") == 0) {
+                g_dbus_method_invocation_return_value(invocation, stats_to_variant());
+                g_dbus_connection_flush(connection, NULL, NULL, NULL);
+        } else if (g_strcmp0(method_name, "GetRateLimitCounters") == 0) {
+                on_get_rate_limit_counters(connection, sender, parameters, invocation);
         } else {
                 LOG_M("Unknown method name: '%s' (sender: '%s').",
                       method_name,
@@ -136,7 +163,13 @@ static notification *dbus_message_to_notification(const gchar *sender, GVariant
         notification *n = notification_create();
 
         n->actions = g_malloc0(sizeof(Actions));
-        n->dbus_client = g_strdup(sender);
+
+        /* the values holding the strings, which get copied into the
+         * string arena of the notification at once */
+        GVariant *appname = NULL;
+        GVariant *summary = NULL;
+        GVariant *body = NULL;
+        GVariant *category = NULL;
 
         {
                 GVariantIter *iter = g_variant_iter_new(parameters);
@@ -148,7 +181,7 @@ static notification *dbus_message_to_notification(const gchar *sender, GVariant
                         switch (idx) {
                         case 0:
                                 if (g_variant_is_of_type(content, G_VARIANT_TYPE_STRING))
-                                        n->appname = g_variant_dup_string(content, NULL);
+                                        appname = g_variant_ref(content);
                                 break;
                         case 1:
                                 if (g_variant_is_of_type(content, G_VARIANT_TYPE_UINT32))
@@ -156,15 +189,15 @@ static notification *dbus_message_to_notification(const gchar *sender, GVariant
                                 break;
                         case 2:
                                 if (g_variant_is_of_type(content, G_VARIANT_TYPE_STRING))
-                                        n->icon = g_variant_dup_string(content, NULL);
+                                        n->icon = string_intern(g_variant_get_string(content, NULL));
                                 break;
                         case 3:
                                 if (g_variant_is_of_type(content, G_VARIANT_TYPE_STRING))
-                                        n->summary = g_variant_dup_string(content, NULL);
+                                        summary = g_variant_ref(content);
                                 break;
                         case 4:
                                 if (g_variant_is_of_type(content, G_VARIANT_TYPE_STRING))
-                                        n->body = g_variant_dup_string(content, NULL);
+                                        body = g_variant_ref(content);
                                 break;
                         case 5:
                                 if (g_variant_is_of_type(content, G_VARIANT_TYPE_STRING_ARRAY))
@@ -181,32 +214,27 @@ static notification *dbus_message_to_notification(const gchar *sender, GVariant
 
                                         dict_value = g_variant_lookup_value(content, "fgcolor", G_VARIANT_TYPE_STRING);
                                         if (dict_value) {
-                                                n->colors[ColFG] = g_variant_dup_string(dict_value, NULL);
+                                                string_intern_set(&n->origin.colors[ColFG], g_variant_get_string(dict_value, NULL));
                                                 g_variant_unref(dict_value);
                                         }
 
                                         dict_value = g_variant_lookup_value(content, "bgcolor", G_VARIANT_TYPE_STRING);
                                         if (dict_value) {
-                                                n->colors[ColBG] = g_variant_dup_string(dict_value, NULL);
+                                                string_intern_set(&n->origin.colors[ColBG], g_variant_get_string(dict_value, NULL));
                                                 g_variant_unref(dict_value);
                                         }
 
                                         dict_value = g_variant_lookup_value(content, "frcolor", G_VARIANT_TYPE_STRING);
                                         if (dict_value) {
-                                                n->colors[ColFrame] = g_variant_dup_string(dict_value, NULL);
+                                                string_intern_set(&n->origin.colors[ColFrame], g_variant_get_string(dict_value, NULL));
                                                 g_variant_unref(dict_value);
                                         }
 
-                                        dict_value = g_variant_lookup_value(content, "category", G_VARIANT_TYPE_STRING);
-                                        if (dict_value) {
-                                                n->category = g_variant_dup_string(dict_value, NULL);
-                                                g_variant_unref(dict_value);
-                                        }
+                                        category = g_variant_lookup_value(content, "category", G_VARIANT_TYPE_STRING);
 
                                         dict_value = g_variant_lookup_value(content, "image-path", G_VARIANT_TYPE_STRING);
                                         if (dict_value) {
-                                                g_free(n->icon);
-                                                n->icon = g_variant_dup_string(dict_value, NULL);
+                                                string_intern_set(&n->icon, g_variant_get_string(dict_value, NULL));
                                                 g_variant_unref(dict_value);
                                         }
 
@@ -258,34 +286,575 @@ static notification *dbus_message_to_notification(const gchar *sender, GVariant
                 g_variant_iter_free(iter);
         }
 
+        /* cut off huge bodies, before they get copied and formatted */
+        const char *body_str = NULL;
+        char *body_cut = NULL;
+        if (body) {
+                gsize len;
+                body_str = g_variant_get_string(body, &len);
+
+                if (settings.max_body_length > 0 && len > (gsize) settings.max_body_length) {
+                        size_t keep = markup_truncate_len(body_str, settings.max_body_length);
+                        LOG_D("Cutting off the body of a notification from %s after %zu of %zu bytes",
+                              sender, keep, (size_t) len);
+                        body_str = body_cut = g_strndup(body_str, keep);
+                }
+        }
+
+        notification_set_strings(n,
+                                 sender,
+                                 appname ? g_variant_get_string(appname, NULL) : NULL,
+                                 summary ? g_variant_get_string(summary, NULL) : NULL,
+                                 body_str,
+                                 category ? g_variant_get_string(category, NULL) : NULL);
+        g_free(body_cut);
+
+        if (appname)
+                g_variant_unref(appname);
+        if (summary)
+                g_variant_unref(summary);
+        if (body)
+                g_variant_unref(body);
+        if (category)
+                g_variant_unref(category);
+
         fflush(stdout);
 
         if (n->actions->count < 1)
                 g_clear_pointer(&n->actions, actions_free);
 
-        notification_init(n);
         return n;
 }
 
-static void on_notify(GDBusConnection *connection,
-                      const gchar *sender,
-                      GVariant *parameters,
-                      GDBusMethodInvocation *invocation)
+/**
+ * Reply to a Notify call with the id of the notification.
+ *
+ * @param invocation the Notify call
+ * @param n the notification created from the call
+ * @param id the id assigned by queues_notification_insert(). If it's 0,
+ *           the notification got discarded and \p n is freed.
+ */
+static void notify_reply(GDBusMethodInvocation *invocation, notification *n, int id)
 {
-        notification *n = dbus_message_to_notification(sender, parameters);
-        int id = queues_notification_insert(n);
-
         GVariant *reply = g_variant_new("(u)", id);
         g_dbus_method_invocation_return_value(invocation, reply);
-        g_dbus_connection_flush(connection, NULL, NULL, NULL);
+        if (dbus_conn)
+                g_dbus_connection_flush(dbus_conn, NULL, NULL, NULL);
 
         // The message got discarded
         if (id == 0) {
                 signal_notification_closed(n, 2);
                 notification_free(n);
         }
+}
+
+/** The number of notifications, which went through the rate limiter */
+struct rate_counters {
+        guint passed;
+        guint dropped;
+        guint collapsed;
+        guint delayed;
+};
+
+/** A Notify call held back by the rate limiter */
+struct rate_delayed {
+        notification *n;
+        GDBusMethodInvocation *invocation;
+};
+
+/**
+ * The token bucket of a single DBus client. Every notification takes a
+ * token, the tokens refill with the rate_limit of the last notification.
+ */
+struct rate_bucket {
+        double tokens;
+        gint64 updated;           /**< the time the tokens got refilled the last time */
+        int rate;
+        enum rate_limit_action action; /**< the rate_limit_action of the last notification */
+        char *appname;            /**< the appname of the last collapsed notification */
+        guint collapsed;          /**< the notifications collapsed into the summary */
+        bool summary_outdated;    /**< the summary doesn't show #collapsed yet */
+        int summary_id;           /**< the id of the summary notification or 0 */
+        GQueue delayed;           /**< the held back Notify calls, see struct rate_delayed */
+        struct rate_counters counters;
+};
+
+enum rate_verdict {
+        RATE_PASS,                /**< insert the notification */
+        RATE_REJECT,              /**< discard the notification */
+        RATE_HOLD,                /**< the limiter took over the notification and its call */
+};
+
+/** maps the DBus client names to their struct rate_bucket */
+static GHashTable *rate_buckets = NULL;
+/** protects #rate_buckets, which rate_limit_early() uses in the Notify worker */
+static GMutex rate_mutex;
+/** the counters of all clients since the start */
+static struct rate_counters rate_totals = { 0 };
+/** the source id of rate_limit_tick() */
+static guint rate_timer = 0;
+
+static void rate_bucket_free(gpointer data)
+{
+        struct rate_bucket *b = data;
+        struct rate_delayed *d;
+
+        while ((d = g_queue_pop_head(&b->delayed))) {
+                g_dbus_method_invocation_return_error(d->invocation,
+                                                      G_DBUS_ERROR,
+                                                      G_DBUS_ERROR_FAILED,
+                                                      "The notification got discarded");
+                notification_free(d->n);
+                g_free(d);
+        }
+
+        g_free(b->appname);
+        g_free(b);
+}
+
+static int rate_limit_burst(void)
+{
+        return MAX(1, settings.rate_limit_burst);
+}
+
+static void rate_bucket_refill(struct rate_bucket *b, gint64 now)
+{
+        b->tokens += (double) (now - b->updated) * b->rate / G_USEC_PER_SEC;
+        b->tokens = MIN(b->tokens, rate_limit_burst());
+        b->updated = now;
+}
+
+/**
+ * Show the number of collapsed notifications of the client in its
+ * summary notification.
+ */
+static void rate_bucket_summarize(struct rate_bucket *b)
+{
+        notification *n = notification_create();
+        char *summary = g_strdup_printf("%u more from %s", b->collapsed, b->appname);
+
+        /* dunst sends the summary, the client never got its id and
+         * mustn't get a NotificationClosed for it */
+        const char *sender = dbus_conn ? g_dbus_connection_get_unique_name(dbus_conn) : NULL;
+        notification_set_strings(n, sender, b->appname, summary, NULL, NULL);
+        g_free(summary);
+
+        n->id = b->summary_id;
+        n->urgency = URG_LOW;
+        notification_init(n);
+
+        b->summary_id = queues_notification_insert(n);
+        if (b->summary_id == 0)
+                notification_free(n);
+
+        b->summary_outdated = false;
+}
+
+/**
+ * Release the held back notifications, update the summaries and forget
+ * the clients, which stayed below their limit for long enough.
+ */
+static gboolean rate_limit_tick(gpointer data)
+{
+        GHashTableIter iter;
+        gpointer key, value;
+        gint64 now = time_monotonic_now();
+        bool changed = false;
+
+        g_mutex_lock(&rate_mutex);
+
+        g_hash_table_iter_init(&iter, rate_buckets);
+        while (g_hash_table_iter_next(&iter, &key, &value)) {
+                struct rate_bucket *b = value;
+                struct rate_delayed *d;
+
+                rate_bucket_refill(b, now);
+
+                while (b->tokens >= 1 && (d = g_queue_pop_head(&b->delayed))) {
+                        b->tokens -= 1;
+                        int id = queues_notification_insert(d->n);
+                        if (id != 0)
+                                stats_stage_done(d->n, STATS_STAGE_INSERT);
+                        notify_reply(d->invocation, d->n, id);
+                        g_free(d);
+                        changed = true;
+                }
+
+                if (b->summary_outdated) {
+                        rate_bucket_summarize(b);
+                        changed = true;
+                }
+
+                if (b->tokens >= rate_limit_burst() && g_queue_is_empty(&b->delayed)) {
+                        LOG_D("Rate limit: '%s' passed %u, dropped %u, collapsed %u, delayed %u",
+                              (char *) key,
+                              b->counters.passed, b->counters.dropped,
+                              b->counters.collapsed, b->counters.delayed);
+                        g_hash_table_iter_remove(&iter);
+                }
+        }
+
+        bool active = g_hash_table_size(rate_buckets) > 0;
+        if (!active)
+                rate_timer = 0;
+
+        g_mutex_unlock(&rate_mutex);
+
+        if (changed)
+                wake_up();
+
+        return active ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+/**
+ * Count a notification of the client of \p b, which got dropped or
+ * collapsed.
+ */
+static void rate_bucket_reject(struct rate_bucket *b, const char *appname)
+{
+        if (b->action == RATE_LIMIT_COLLAPSE) {
+                g_free(b->appname);
+                b->appname = g_strdup(appname);
+                b->collapsed++;
+                b->summary_outdated = true;
+
+                b->counters.collapsed++;
+                rate_totals.collapsed++;
+        } else {
+                b->counters.dropped++;
+                rate_totals.dropped++;
+        }
+}
+
+/**
+ * Reject \p n before notification_init(), if its client is limited
+ * already and \p n would get dropped or collapsed anyway. This keeps a
+ * flood from costing a full notification_init() per message.
+ *
+ * The rules haven't been applied to \p n yet, so the rate_limit and the
+ * rate_limit_action of the previous notification of the client apply.
+ * Runs in the Notify worker.
+ *
+ * @return true, if \p n got rejected
+ */
+static bool rate_limit_early(const notification *n)
+{
+        if (n->id != 0 || !n->dbus_client)
+                return false;
+
+        bool rejected = false;
+
+        g_mutex_lock(&rate_mutex);
+
+        struct rate_bucket *b = rate_buckets ? g_hash_table_lookup(rate_buckets, n->dbus_client) : NULL;
+
+        if (b && b->rate > 0) {
+                rate_bucket_refill(b, time_monotonic_now());
+
+                bool limited = b->tokens < 1 || !g_queue_is_empty(&b->delayed);
+                bool delayable = b->action == RATE_LIMIT_DELAY
+                              && b->delayed.length < (guint) rate_limit_burst();
+
+                if (limited && !delayable) {
+                        rate_bucket_reject(b, n->appname ? n->appname : "unknown");
+                        rejected = true;
+                }
+        }
+
+        g_mutex_unlock(&rate_mutex);
+
+        return rejected;
+}
+
+/**
+ * Take a token from the bucket of the sender of \p n and decide according
+ * to its rate_limit_action what to do, if none is left.
+ *
+ * Notifications replacing another one aren't limited, as they don't add
+ * a new notification.
+ *
+ * @param n the initialized notification
+ * @param invocation the Notify call of \p n
+ */
+static enum rate_verdict rate_limit(notification *n, GDBusMethodInvocation *invocation)
+{
+        if (n->rate_limit <= 0 || n->id != 0 || !n->dbus_client)
+                return RATE_PASS;
+
+        enum rate_verdict verdict = RATE_REJECT;
+
+        g_mutex_lock(&rate_mutex);
+
+        if (!rate_buckets)
+                rate_buckets = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                     g_free, rate_bucket_free);
+
+        gint64 now = time_monotonic_now();
+        struct rate_bucket *b = g_hash_table_lookup(rate_buckets, n->dbus_client);
+
+        if (!b) {
+                b = g_malloc0(sizeof(struct rate_bucket));
+                b->tokens = rate_limit_burst();
+                b->updated = now;
+                g_queue_init(&b->delayed);
+                g_hash_table_insert(rate_buckets, g_strdup(n->dbus_client), b);
+        }
+
+        if (!rate_timer)
+                rate_timer = g_timeout_add_seconds(1, rate_limit_tick, NULL);
+
+        b->rate = n->rate_limit;
+        b->action = n->rate_limit_action;
+        rate_bucket_refill(b, now);
+
+        if (b->tokens >= 1 && g_queue_is_empty(&b->delayed)) {
+                b->tokens -= 1;
+                b->counters.passed++;
+                rate_totals.passed++;
+                verdict = RATE_PASS;
+        } else {
+                if (b->counters.dropped + b->counters.collapsed + b->counters.delayed == 0)
+                        LOG_I("Rate limiting the notifications of '%s' (%s)",
+                              n->appname, n->dbus_client);
+
+                if (b->action == RATE_LIMIT_DELAY && b->delayed.length < (guint) rate_limit_burst()) {
+                        struct rate_delayed *d = g_malloc(sizeof(struct rate_delayed));
+                        d->n = n;
+                        d->invocation = invocation;
+                        g_queue_push_tail(&b->delayed, d);
+
+                        b->counters.delayed++;
+                        rate_totals.delayed++;
+                        verdict = RATE_HOLD;
+                } else {
+                        /* a full queue of delayed notifications drops it as well */
+                        rate_bucket_reject(b, n->appname);
+                }
+        }
+
+        g_mutex_unlock(&rate_mutex);
+        return verdict;
+}
+
+static void on_get_rate_limit_counters(GDBusConnection *connection,
+                                       const gchar *sender,
+                                       GVariant *parameters,
+                                       GDBusMethodInvocation *invocation)
+{
+        GVariantBuilder clients;
+        g_variant_builder_init(&clients, G_VARIANT_TYPE("a(suuuu)"));
+
+        g_mutex_lock(&rate_mutex);
+        if (rate_buckets) {
+                GHashTableIter iter;
+                gpointer key, value;
+
+                g_hash_table_iter_init(&iter, rate_buckets);
+                while (g_hash_table_iter_next(&iter, &key, &value)) {
+                        struct rate_bucket *b = value;
+                        g_variant_builder_add(&clients, "(suuuu)",
+                                              (char *) key,
+                                              b->counters.passed,
+                                              b->counters.dropped,
+                                              b->counters.collapsed,
+                                              b->counters.delayed);
+                }
+        }
+
+        GVariant *value = g_variant_new("((uuuu)a(suuuu))",
+                                        rate_totals.passed,
+                                        rate_totals.dropped,
+                                        rate_totals.collapsed,
+                                        rate_totals.delayed,
+                                        &clients);
+        g_mutex_unlock(&rate_mutex);
+        g_dbus_method_invocation_return_value(invocation, value);
+        g_dbus_connection_flush(connection, NULL, NULL, NULL);
+}
+
+/**
+ * A Notify call on its way through #notify_worker(), or another call,
+ * which has to be handled in order with the Notify calls before it.
+ */
+struct notify_call {
+        GDBusMethodInvocation *invocation;
+        void (*handle)(struct notify_call *call); /**< finishes the call in the main loop */
+        notification *n;                          /**< the decoded and initialized notification of a Notify call */
+        bool rejected;                            /**< rate_limit_early() rejected #n before initializing it */
+};
+
+/** the calls for #notify_worker() */
+static GAsyncQueue *notify_in = NULL;
+/** the calls processed by #notify_worker(), which the main loop has to finish */
+static GAsyncQueue *notify_out = NULL;
+static GThread *notify_thread = NULL;
+/** the calls in #notify_in and #notify_out */
+static guint notify_pending = 0;
+/** notify_calls_drain() is scheduled already */
+static gint notify_drain_scheduled = 0;
+/** tells #notify_worker() to stop */
+static struct notify_call notify_stop;
+
+/** the maximum number of calls finished in a single main loop iteration */
+#define NOTIFY_DRAIN_BATCH 64
+
+static void notify_call_free(struct notify_call *call)
+{
+        notification_free(call->n);
+        g_free(call);
+}
+
+static void notify_handle(struct notify_call *call)
+{
+        notification *n = call->n;
+        int id;
+
+        /* the rate limiter or the queues take over the notification */
+        call->n = NULL;
+
+        stats_start(n);
+
+        /* Floods may be rejected by rate_limit_early() already.
+         * Progress bars update their notification with the same content
+         * over and over again, only update the existing one in place and
+         * skip the script. The initialized update gets thrown away. */
+        if (call->rejected) {
+                id = 0;
+        } else if (n->id != 0 && queues_notification_update(n)) {
+                id = n->id;
+                notification_free(n);
+                n = NULL;
+        } else {
+                stats_stage_done(n, STATS_STAGE_INIT);
+
+                switch (rate_limit(n, call->invocation)) {
+                case RATE_PASS:
+                        id = queues_notification_insert(n);
+                        if (id != 0)
+                                stats_stage_done(n, STATS_STAGE_INSERT);
+                        break;
+                case RATE_REJECT:
+                        id = 0;
+                        break;
+                case RATE_HOLD:
+                default:
+                        return;
+                }
+        }
+
+        TRACE1(notify_reply, id);
+        notify_reply(call->invocation, n, id);
+}
+
+static void close_notification_handle(struct notify_call *call)
+{
+        guint32 id;
+        g_variant_get(g_dbus_method_invocation_get_parameters(call->invocation), "(u)", &id);
+        queues_notification_close_id(id, REASON_SIG);
+        g_dbus_method_invocation_return_value(call->invocation, NULL);
+        if (dbus_conn)
+                g_dbus_connection_flush(dbus_conn, NULL, NULL, NULL);
+}
+
+/**
+ * Finish the calls processed by #notify_worker() in batches. Runs in the
+ * main loop.
+ */
+static gboolean notify_calls_drain(gpointer data)
+{
+        int handled = 0;
+
+        while (handled < NOTIFY_DRAIN_BATCH) {
+                struct notify_call *call = g_async_queue_try_pop(notify_out);
+
+                if (!call) {
+                        g_atomic_int_set(&notify_drain_scheduled, 0);
+
+                        /* the worker may have pushed a call, while the
+                         * flag was still set */
+                        if (g_async_queue_length(notify_out) > 0
+                            && g_atomic_int_compare_and_exchange(&notify_drain_scheduled, 0, 1))
+                                continue;
+                        break;
+                }
+
+                call->handle(call);
+                notify_call_free(call);
+                notify_pending--;
+                handled++;
+        }
 
         wake_up();
+
+        return handled == NOTIFY_DRAIN_BATCH ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+/**
+ * Decode the Notify calls and prepare their notifications, so the main
+ * loop only has to insert them.
+ *
+ * A single thread keeps the calls in order.
+ */
+static gpointer notify_worker(gpointer data)
+{
+        struct notify_call *call;
+
+        while ((call = g_async_queue_pop(notify_in)) != &notify_stop) {
+                if (call->handle == notify_handle) {
+                        GDBusMethodInvocation *invocation = call->invocation;
+
+                        notification_lock();
+                        call->n = dbus_message_to_notification(
+                                        g_dbus_method_invocation_get_sender(invocation),
+                                        g_dbus_method_invocation_get_parameters(invocation));
+                        notification_unlock();
+
+                        /* Outside of notification_lock(), as rate_limit_tick()
+                         * takes both locks the other way around. */
+                        call->rejected = rate_limit_early(call->n);
+
+                        /* Updates of an existing notification get initialized
+                         * as well, although the main loop may only need the
+                         * new progress. Whether it's such an update depends
+                         * on the queues, that's decided in the main loop. */
+                        if (!call->rejected)
+                                notification_init(call->n);
+                }
+
+                g_async_queue_push(notify_out, call);
+
+                if (g_atomic_int_compare_and_exchange(&notify_drain_scheduled, 0, 1))
+                        g_idle_add(notify_calls_drain, notify_out);
+        }
+
+        return NULL;
+}
+
+static void notify_call_push(GDBusMethodInvocation *invocation,
+                             void (*handle)(struct notify_call *call))
+{
+        if (!notify_thread) {
+                notify_in = g_async_queue_new();
+                notify_out = g_async_queue_new();
+                notify_thread = g_thread_new("notify", notify_worker, NULL);
+        }
+
+        struct notify_call *call = g_malloc0(sizeof(struct notify_call));
+        call->invocation = invocation;
+        call->handle = handle;
+
+        notify_pending++;
+        g_async_queue_push(notify_in, call);
+}
+
+static void on_notify(GDBusConnection *connection,
+                      const gchar *sender,
+                      GVariant *parameters,
+                      GDBusMethodInvocation *invocation)
+{
+        TRACE1(notify_begin, sender);
+        notify_call_push(invocation, notify_handle);
+        TRACE(notify_end);
 }
 
 static void on_close_notification(GDBusConnection *connection,
@@ -293,12 +862,44 @@ static void on_close_notification(GDBusConnection *connection,
                                   GVariant *parameters,
                                   GDBusMethodInvocation *invocation)
 {
-        guint32 id;
-        g_variant_get(parameters, "(u)", &id);
-        queues_notification_close_id(id, REASON_SIG);
+        /* don't overtake a Notify call replacing the same notification */
+        if (notify_pending > 0) {
+                notify_call_push(invocation, close_notification_handle);
+                return;
+        }
+
+        struct notify_call call = { .invocation = invocation };
+        close_notification_handle(&call);
         wake_up();
-        g_dbus_method_invocation_return_value(invocation, NULL);
-        g_dbus_connection_flush(connection, NULL, NULL, NULL);
+}
+
+/**
+ * Stop #notify_worker() and drop the calls still in progress.
+ */
+static void notify_worker_stop(void)
+{
+        if (!notify_thread)
+                return;
+
+        g_async_queue_push(notify_in, &notify_stop);
+        g_thread_join(notify_thread);
+        notify_thread = NULL;
+
+        g_idle_remove_by_data(notify_out);
+
+        struct notify_call *call;
+        while ((call = g_async_queue_try_pop(notify_in))) {
+                g_object_unref(call->invocation);
+                notify_call_free(call);
+        }
+        while ((call = g_async_queue_try_pop(notify_out))) {
+                g_object_unref(call->invocation);
+                notify_call_free(call);
+        }
+        notify_pending = 0;
+
+        g_clear_pointer(&notify_in, g_async_queue_unref);
+        g_clear_pointer(&notify_out, g_async_queue_unref);
 }
 
 static void on_get_server_information(GDBusConnection *connection,
@@ -314,23 +915,31 @@ static void on_get_server_information(GDBusConnection *connection,
         g_dbus_connection_flush(connection, NULL, NULL, NULL);
 }
 
-void signal_notification_closed(notification *n, enum reason reason)
-{
-        if (reason < REASON_MIN || REASON_MAX < reason) {
-                LOG_W("Closing notification with reason '%d' not supported. "
-                      "Closing it with reason '%d'.", reason, REASON_UNDEF);
-                reason = REASON_UNDEF;
-        }
+/** a NotificationClosed signal held back until the end of the batch */
+struct closed_signal {
+        guint32 id;
+        enum reason reason;
+        char *dbus_client;
+};
 
+/** the signals collected in the current batch */
+static GArray *closed_signals = NULL;
+/** the nesting level of signal_batch_begin() calls */
+static int closed_batch_depth = 0;
+/** the idle source flushing the connection after a batch */
+static guint closed_flush_id = 0;
+
+static void signal_notification_closed_emit(guint32 id, enum reason reason, const char *dbus_client)
+{
         if (!dbus_conn) {
                 LOG_E("Unable to close notification: No DBus connection.");
         }
 
-        GVariant *body = g_variant_new("(uu)", n->id, reason);
+        GVariant *body = g_variant_new("(uu)", id, reason);
         GError *err = NULL;
 
         g_dbus_connection_emit_signal(dbus_conn,
-                                      n->dbus_client,
+                                      dbus_client,
                                       FDN_PATH,
                                       FDN_IFAC,
                                       "NotificationClosed",
@@ -341,7 +950,65 @@ void signal_notification_closed(notification *n, enum reason reason)
                 LOG_W("Unable to close notification: %s", err->message);
                 g_error_free(err);
         }
+}
 
+/* see dbus.h */
+void signal_notification_closed(notification *n, enum reason reason)
+{
+        if (reason < REASON_MIN || REASON_MAX < reason) {
+                LOG_W("Closing notification with reason '%d' not supported. "
+                      "Closing it with reason '%d'.", reason, REASON_UNDEF);
+                reason = REASON_UNDEF;
+        }
+
+        if (closed_batch_depth > 0) {
+                struct closed_signal sig = { n->id, reason, g_strdup(n->dbus_client) };
+                g_array_append_val(closed_signals, sig);
+                return;
+        }
+
+        signal_notification_closed_emit(n->id, reason, n->dbus_client);
+}
+
+/* see dbus.h */
+void signal_batch_begin(void)
+{
+        if (!closed_signals)
+                closed_signals = g_array_new(false, false, sizeof(struct closed_signal));
+
+        closed_batch_depth++;
+}
+
+static gboolean signal_batch_flush(gpointer data)
+{
+        closed_flush_id = 0;
+
+        if (dbus_conn)
+                g_dbus_connection_flush(dbus_conn, NULL, NULL, NULL);
+
+        return G_SOURCE_REMOVE;
+}
+
+/* see dbus.h */
+void signal_batch_end(void)
+{
+        assert(closed_batch_depth > 0);
+
+        if (--closed_batch_depth > 0 || closed_signals->len == 0)
+                return;
+
+        for (guint i = 0; i < closed_signals->len; i++) {
+                struct closed_signal *sig = &g_array_index(closed_signals, struct closed_signal, i);
+                signal_notification_closed_emit(sig->id, sig->reason, sig->dbus_client);
+                g_free(sig->dbus_client);
+        }
+
+        LOG_D("Emitted %u batched NotificationClosed signals", closed_signals->len);
+        g_array_set_size(closed_signals, 0);
+
+        /* batches ending in the same main loop iteration share the flush */
+        if (!closed_flush_id)
+                closed_flush_id = g_idle_add(signal_batch_flush, NULL);
 }
 
 void signal_action_invoked(notification *n, const char *identifier)
@@ -386,6 +1053,18 @@ static void on_bus_acquired(GDBusConnection *connection,
         if (registration_id == 0) {
                 DIE("Unable to register dbus connection: %s", err->message);
         }
+
+        registration_id = g_dbus_connection_register_object(connection,
+                                                            FDN_PATH,
+                                                            introspection_data->interfaces[1],
+                                                            &interface_vtable,
+                                                            NULL,
+                                                            NULL,
+                                                            &err);
+
+        if (registration_id == 0) {
+                DIE("Unable to register dbus connection: %s", err->message);
+        }
 }
 
 static void on_name_acquired(GDBusConnection *connection,
@@ -549,9 +1228,10 @@ static RawImage *get_raw_image_from_data_hint(GVariant *icon_data)
                 return NULL;
         }
 
-        image->data = (guchar *) g_memdup(g_variant_get_data(data_variant),
-                                          g_variant_get_size(data_variant));
-        g_variant_unref(data_variant);
+        /* keep the variant instead of copying its (possibly huge) data */
+        image->data_variant = data_variant;
+        image->data = g_variant_get_data(data_variant);
+        image->surface = NULL;
 
         return image;
 }
@@ -579,9 +1259,34 @@ int initdbus(void)
         return owner_id;
 }
 
+/* see dbus.h */
+void dbus_wait_for_name(void)
+{
+        /* on_name_lost() exits */
+        while (!dbus_conn)
+                g_main_context_iteration(NULL, true);
+}
+
 void dbus_tear_down(int owner_id)
 {
+        notify_worker_stop();
+
         g_clear_pointer(&introspection_data, g_dbus_node_info_unref);
+        if (closed_flush_id) {
+                g_source_remove(closed_flush_id);
+                closed_flush_id = 0;
+        }
+        if (closed_signals) {
+                for (guint i = 0; i < closed_signals->len; i++)
+                        g_free(g_array_index(closed_signals, struct closed_signal, i).dbus_client);
+                g_array_free(closed_signals, true);
+                closed_signals = NULL;
+        }
+        if (rate_timer) {
+                g_source_remove(rate_timer);
+                rate_timer = 0;
+        }
+        g_clear_pointer(&rate_buckets, g_hash_table_destroy);
 
         g_bus_unown_name(owner_id);
 }
@@ -16,9 +16,39 @@ enum reason {
 };
 
 int initdbus(void);
+
+/**
+ * Iterate the main context until the name requested by initdbus() is
+ * owned. Incoming method calls already get dispatched meanwhile.
+ *
+ * Exits if the name can't be acquired.
+ */
+void dbus_wait_for_name(void);
+
 void dbus_tear_down(int id);
 /* void dbus_poll(int timeout); */
+
+/**
+ * Emit the NotificationClosed signal for \p n.
+ *
+ * Between signal_batch_begin() and signal_batch_end(), the signal
+ * gets held back and emitted together with the rest of the batch.
+ */
 void signal_notification_closed(notification *n, enum reason reason);
+
+/**
+ * Start collecting NotificationClosed signals instead of emitting them
+ * one by one. Batches can be nested.
+ */
+void signal_batch_begin(void);
+
+/**
+ * Emit all signals collected since the matching signal_batch_begin().
+ * The connection gets flushed once from an idle callback afterwards,
+ * so the caller doesn't wait for the bus.
+ */
+void signal_batch_end(void);
+
 void signal_action_invoked(notification *n, const char *identifier);
 
 #endif
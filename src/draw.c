@@ -9,6 +9,7 @@
 #include <pango/pango-types.h>
 #include <pango/pangocairo.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "dunst.h"
 #include "icon.h"
@@ -16,6 +17,8 @@
 #include "notification.h"
 #include "log.h"
 #include "queues.h"
+#include "stats.h"
+#include "trace.h"
 #include "x11/x.h"
 
 typedef struct {
@@ -26,19 +29,115 @@ typedef struct {
         char *text;
         PangoAttrList *attr;
         cairo_surface_t *icon;
+        bool icon_pending;       /**< the icon is still getting loaded in the background */
         notification *n;
+        guint generation;        /**< the generation of #n, the layout got created for */
+        char *markup;            /**< the text_to_render, the layout got created from */
+        size_t head_len;         /**< length of #markup without the plain text tail */
+        size_t text_head_len;    /**< length of #text without the plain text tail */
+        double dpi;              /**< the resolution of the layout */
+        unsigned int last_used;  /**< the number of the last draw() call using the layout */
+        unsigned int serial;     /**< unique number identifying the layout */
 } colored_layout;
 
+/**
+ * Everything, which went into rendering a single notification into the back
+ * buffer. If it doesn't change between two frames, the row isn't rendered
+ * again.
+ */
+struct row_state {
+        unsigned int serial;
+        int layout_width;
+        int y;
+        int height;
+        bool first;
+        bool last;
+        color_t fg;
+        color_t bg;
+        color_t frame;
+        color_t sep;
+};
+
 window_x11 *win;
 
 PangoFontDescription *pango_fdesc;
 
+/** maps the ids of the displayed notifications to their #colored_layout */
+static GHashTable *layout_cache = NULL;
+/** the number of the current draw() call */
+static unsigned int draw_count = 0;
+/** the serial number of the last created #colored_layout */
+static unsigned int layout_serial = 0;
+
+/** the layouts of the current frame in display order, reused between frames */
+static GPtrArray *frame_layouts = NULL;
+/** the "(N more)" layout, kept as long as the count and the last
+ * displayed notification don't change */
+static colored_layout *xmore_layout = NULL;
+/** the count, #xmore_layout got created for */
+static int xmore_count = 0;
+/** the serial of the layout, #xmore_layout got derived from */
+static unsigned int xmore_source = 0;
+
+/** the surface all notifications get rendered into, kept between frames */
+static cairo_surface_t *back_buffer = NULL;
+/** the context drawing into #back_buffer */
+static cairo_t *back_buffer_cr = NULL;
+/** the area of the window changed by the current frame, reused between frames */
+static cairo_region_t *damage = NULL;
+/** the dimensions #back_buffer got rendered with */
+static struct dimensions back_buffer_dim;
+/** the #row_state of every row currently in #back_buffer */
+static GArray *back_buffer_rows = NULL;
+
+/**
+ * A PangoContext shared by the layouts on the same screen and DPI, so
+ * the caches of the font map and the fontsets stay warm between frames.
+ */
+struct layout_context {
+        int screen;
+        double dpi;
+        PangoContext *context;
+};
+
+/** the #layout_context of every combination of screen and DPI seen so far */
+static GSList *layout_contexts = NULL;
+
+/** the state shared by all layouts of the current frame, see frame_setup() */
+static struct {
+        screen_info *screen;
+        double dpi;
+        PangoContext *context;
+        int width;              /**< the window width, before calculate_dimensions() shrinks it */
+} frame;
+
+/** the context to create the PangoContexts from, when drawing offscreen */
+static cairo_t *offscreen_cr = NULL;
+
+static void free_colored_layout(void *data);
+static void layout_contexts_free(void);
+
+/* see draw.h */
+void draw_setup_offscreen(void)
+{
+        cairo_surface_t *srf = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 1, 1);
+        offscreen_cr = cairo_create(srf);
+        cairo_surface_destroy(srf);
+
+        pango_fdesc = pango_font_description_from_string(settings.font);
+        layout_cache = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                             NULL, free_colored_layout);
+        back_buffer_rows = g_array_new(false, false, sizeof(struct row_state));
+        frame_layouts = g_ptr_array_new();
+        damage = cairo_region_create();
+}
+
 void draw_setup(void)
 {
         x_setup();
 
         win = x_win_create();
-        pango_fdesc = pango_font_description_from_string(settings.font);
+        draw_setup_offscreen();
 }
 
 static color_t color_hex_to_double(int hexValue)
@@ -140,6 +239,7 @@ static void free_colored_layout(void *data)
         g_object_unref(cl->l);
         pango_attr_list_unref(cl->attr);
         g_free(cl->text);
+        g_free(cl->markup);
         if (cl->icon) cairo_surface_destroy(cl->icon);
         g_free(cl);
 }
@@ -149,34 +249,44 @@ static bool have_dynamic_width(void)
         return (settings.geometry.width_set && settings.geometry.w == 0);
 }
 
-static struct dimensions calculate_dimensions(GSList *layouts)
+/**
+ * The width of the window on the screen of the frame, before it's shrunk
+ * to the layouts. 0 for a dynamic width.
+ */
+static int frame_base_width(void)
 {
-        struct dimensions dim = { 0 };
+        screen_info *scr = frame.screen;
 
-        screen_info *scr = get_active_screen();
         if (have_dynamic_width()) {
                 /* dynamic width */
-                dim.w = 0;
+                return 0;
         } else if (settings.geometry.width_set) {
                 /* fixed width */
-                if (settings.geometry.negative_width) {
-                        dim.w = scr->w - settings.geometry.w;
-                } else {
-                        dim.w = settings.geometry.w;
-                }
+                if (settings.geometry.negative_width)
+                        return scr->w - settings.geometry.w;
+                else
+                        return settings.geometry.w;
         } else {
                 /* across the screen */
-                dim.w = scr->w;
+                return scr->w;
         }
+}
+
+static struct dimensions calculate_dimensions(GPtrArray *layouts)
+{
+        struct dimensions dim = { 0 };
+
+        screen_info *scr = frame.screen;
+        dim.w = frame_base_width();
 
         dim.h += 2 * settings.frame_width;
-        dim.h += (g_slist_length(layouts) - 1) * settings.separator_height;
+        dim.h += ((int) layouts->len - 1) * settings.separator_height;
 
         dim.corner_radius = settings.corner_radius;
 
         int text_width = 0, total_width = 0;
-        for (GSList *iter = layouts; iter; iter = iter->next) {
-                colored_layout *cl = iter->data;
+        for (guint i = 0; i < layouts->len; i++) {
+                colored_layout *cl = layouts->pdata[i];
                 int w=0,h=0;
                 pango_layout_get_pixel_size(cl->l, &w, &h);
                 if (cl->icon) {
@@ -231,24 +341,98 @@ static struct dimensions calculate_dimensions(GSList *layouts)
         return dim;
 }
 
-static PangoLayout *layout_create(cairo_t *c)
+/**
+ * Look up the PangoContext for the screen and DPI, creating it on first use.
+ */
+static PangoContext *layout_context_get(cairo_t *c, screen_info *screen, double dpi)
 {
-        screen_info *screen = get_active_screen();
+        for (GSList *iter = layout_contexts; iter; iter = iter->next) {
+                struct layout_context *lc = iter->data;
+                if (lc->screen == screen->id && lc->dpi == dpi)
+                        return lc->context;
+        }
 
-        PangoContext *context = pango_cairo_create_context(c);
-        pango_cairo_context_set_resolution(context, get_dpi_for_screen(screen));
+        struct layout_context *lc = g_malloc(sizeof(struct layout_context));
+        lc->screen = screen->id;
+        lc->dpi = dpi;
+        lc->context = pango_cairo_create_context(c);
+        pango_cairo_context_set_resolution(lc->context, dpi);
 
-        PangoLayout *layout = pango_layout_new(context);
+        layout_contexts = g_slist_prepend(layout_contexts, lc);
+        LOG_D("Created PangoContext for screen %d with %.1f DPI", lc->screen, lc->dpi);
+
+        return lc->context;
+}
 
-        g_object_unref(context);
+static void layout_contexts_free(void)
+{
+        for (GSList *iter = layout_contexts; iter; iter = iter->next) {
+                struct layout_context *lc = iter->data;
+                g_object_unref(lc->context);
+                g_free(lc);
+        }
+        g_slist_free(layout_contexts);
+        layout_contexts = NULL;
+}
 
-        return layout;
+/**
+ * Look up the screen, its DPI and the resulting width once for all
+ * layouts of the frame.
+ */
+static void frame_setup(cairo_t *c, screen_info *screen)
+{
+        frame.screen = screen;
+        frame.dpi = get_dpi_for_screen(frame.screen);
+        frame.context = layout_context_get(c, frame.screen, frame.dpi);
+        frame.width = frame_base_width();
+        if (frame.width <= 0)
+                frame.width = 2 * settings.h_padding + 2 * settings.frame_width;
+}
+
+static PangoLayout *layout_create(void)
+{
+        return pango_layout_new(frame.context);
 }
 
-static colored_layout *layout_init_shared(cairo_t *c, notification *n)
+/**
+ * Set the width of the layout according to the current screen, like it
+ * has to be before calculate_dimensions() shrinks it.
+ */
+static void layout_setup_width(colored_layout *cl)
+{
+        int width = frame.width;
+
+        if (have_dynamic_width()) {
+                layout_setup_pango(cl->l, -1);
+        } else {
+                width -= 2 * settings.h_padding;
+                width -= 2 * settings.frame_width;
+                if (cl->icon) width -= cairo_image_surface_get_width(cl->icon) + settings.h_padding;
+                layout_setup_pango(cl->l, width);
+        }
+}
+
+/**
+ * Calculate the height of the notification belonging to the layout
+ * and save it in the notification's displayed_height.
+ */
+static void layout_update_displayed_height(colored_layout *cl)
+{
+        notification *n = cl->n;
+
+        pango_layout_get_pixel_size(cl->l, NULL, &(n->displayed_height));
+        if (cl->icon) n->displayed_height = MAX(cairo_image_surface_get_height(cl->icon), n->displayed_height);
+        n->displayed_height = MAX(settings.notification_height, n->displayed_height + settings.padding * 2);
+}
+
+static colored_layout *layout_init_shared(notification *n)
 {
         colored_layout *cl = g_malloc(sizeof(colored_layout));
-        cl->l = layout_create(c);
+        cl->l = layout_create();
+        cl->dpi = pango_cairo_context_get_resolution(pango_layout_get_context(cl->l));
+        cl->markup = NULL;
+        cl->last_used = draw_count;
+        cl->serial = ++layout_serial;
 
         if (!settings.word_wrap) {
                 PangoEllipsizeMode ellipsize;
@@ -279,41 +463,34 @@ static colored_layout *layout_init_shared(cairo_t *c, notification *n)
                 cairo_surface_destroy(cl->icon);
                 cl->icon = NULL;
         }
+        cl->icon_pending = !cl->icon && icon_is_pending(n);
 
         cl->fg = string_to_color(n->colors[ColFG]);
         cl->bg = string_to_color(n->colors[ColBG]);
         cl->frame = string_to_color(n->colors[ColFrame]);
 
         cl->n = n;
+        cl->generation = n->generation;
 
-        struct dimensions dim = calculate_dimensions(NULL);
-        int width = dim.w;
-
-        if (have_dynamic_width()) {
-                layout_setup_pango(cl->l, -1);
-        } else {
-                width -= 2 * settings.h_padding;
-                width -= 2 * settings.frame_width;
-                if (cl->icon) width -= cairo_image_surface_get_width(cl->icon) + settings.h_padding;
-                layout_setup_pango(cl->l, width);
-        }
+        layout_setup_width(cl);
 
         return cl;
 }
 
-static colored_layout *layout_derive_xmore(cairo_t *c, notification *n, int qlen)
+static colored_layout *layout_derive_xmore(notification *n, int qlen)
 {
-        colored_layout *cl = layout_init_shared(c, n);
+        colored_layout *cl = layout_init_shared(n);
         cl->text = g_strdup_printf("(%d more)", qlen);
         cl->attr = NULL;
         pango_layout_set_text(cl->l, cl->text, -1);
         return cl;
 }
 
-static colored_layout *layout_from_notification(cairo_t *c, notification *n)
+static colored_layout *layout_from_notification(notification *n)
 {
 
-        colored_layout *cl = layout_init_shared(c, n);
+        colored_layout *cl = layout_init_shared(n);
+        cl->markup = g_strdup(n->text_to_render);
 
         /* markup */
         GError *err = NULL;
@@ -322,30 +499,127 @@ static colored_layout *layout_from_notification(cairo_t *c, notification *n)
         if (!err) {
                 pango_layout_set_text(cl->l, cl->text, -1);
                 pango_layout_set_attributes(cl->l, cl->attr);
+
+                /* remember where the plain text tail starts, so
+                 * layout_update_tail() can replace it later on */
+                size_t markup_len = strlen(cl->markup);
+                size_t text_len = strlen(cl->text);
+                size_t tail_len = markup_len - MIN(n->text_head_len, markup_len);
+
+                if (strpbrk(cl->markup + markup_len - tail_len, "<&"))
+                        tail_len = 0;
+
+                cl->head_len = markup_len - tail_len;
+                cl->text_head_len = text_len - MIN(tail_len, text_len);
         } else {
-                /* remove markup and display plain message instead */
-                n->text_to_render = markup_strip(n->text_to_render);
+                /* remove markup and display plain message instead,
+                 * text_to_render stays as is for the next frame */
+                char *plain = markup_strip(g_strdup(n->text_to_render));
                 cl->text = NULL;
                 cl->attr = NULL;
-                pango_layout_set_text(cl->l, n->text_to_render, -1);
+                pango_layout_set_text(cl->l, plain, -1);
+                g_free(plain);
                 if (n->first_render) {
                         LOG_W("Unable to parse markup: %s", err->message);
                 }
                 g_error_free(err);
         }
 
-
-        pango_layout_get_pixel_size(cl->l, NULL, &(n->displayed_height));
-        if (cl->icon) n->displayed_height = MAX(cairo_image_surface_get_height(cl->icon), n->displayed_height);
-        n->displayed_height = MAX(settings.notification_height, n->displayed_height + settings.padding * 2);
+        layout_update_displayed_height(cl);
 
         n->first_render = false;
         return cl;
 }
 
-static GSList *create_layouts(cairo_t *c)
+/**
+ * Replace the plain text tail of a layout (e.g. the age of the
+ * notification) without parsing the markup of the message again.
+ *
+ * @return true, if the layout has been updated. False, if the message
+ *         itself differs from the one the layout got created from.
+ */
+static bool layout_update_tail(colored_layout *cl, notification *n)
+{
+        if (!cl->text || cl->head_len != n->text_head_len
+            || strncmp(cl->markup, n->text_to_render, cl->head_len) != 0)
+                return false;
+
+        /* The tail is inserted verbatim into the text, so it mustn't
+         * contain markup */
+        const char *tail = n->text_to_render + cl->head_len;
+        if (strpbrk(tail, "<&"))
+                return false;
+
+        size_t tail_len = strlen(tail);
+
+        cl->markup = g_realloc(cl->markup, cl->head_len + tail_len + 1);
+        memcpy(cl->markup + cl->head_len, tail, tail_len + 1);
+        cl->text = g_realloc(cl->text, cl->text_head_len + tail_len + 1);
+        memcpy(cl->text + cl->text_head_len, tail, tail_len + 1);
+
+        /* The attributes only cover the message and stay valid */
+        pango_layout_set_text(cl->l, cl->text, -1);
+        cl->serial = ++layout_serial;
+        return true;
+}
+
+/**
+ * Get the layout for the notification from #layout_cache and only
+ * create a new one, if the cached layout is outdated.
+ */
+static colored_layout *layout_get_for_notification(notification *n)
+{
+        colored_layout *cl = g_hash_table_lookup(layout_cache, GINT_TO_POINTER(n->id));
+        double dpi = frame.dpi;
+
+        /* a new notification may get the address of a freed one, the
+         * generation tells them apart */
+        if (cl && cl->n == n && cl->generation == n->generation && cl->dpi == dpi
+            && (g_strcmp0(cl->markup, n->text_to_render) == 0
+                || layout_update_tail(cl, n))) {
+                layout_setup_width(cl);
+                layout_update_displayed_height(cl);
+        } else {
+                cl = layout_from_notification(n);
+                g_hash_table_replace(layout_cache, GINT_TO_POINTER(n->id), cl);
+        }
+
+        cl->last_used = draw_count;
+        return cl;
+}
+
+/**
+ * Get the "(N more)" layout shown below \p last. It's only created again,
+ * if the count changes or the layout of \p last got replaced.
+ */
+static colored_layout *layout_get_xmore(notification *last, int qlen)
 {
-        GSList *layouts = NULL;
+        colored_layout *source = g_hash_table_lookup(layout_cache, GINT_TO_POINTER(last->id));
+
+        if (xmore_layout && source
+            && xmore_count == qlen
+            && xmore_source == source->serial) {
+                layout_setup_width(xmore_layout);
+                xmore_layout->last_used = draw_count;
+                return xmore_layout;
+        }
+
+        if (xmore_layout)
+                free_colored_layout(xmore_layout);
+
+        xmore_layout = layout_derive_xmore(last, qlen);
+        xmore_count = qlen;
+        xmore_source = source ? source->serial : 0;
+
+        return xmore_layout;
+}
+
+/**
+ * Collect the layouts of the current frame into #frame_layouts.
+ */
+static GPtrArray *create_layouts(void)
+{
+        g_ptr_array_set_size(frame_layouts, 0);
 
         int qlen = queues_length_waiting();
         bool xmore_is_needed = qlen > 0 && settings.indicate_hidden;
@@ -360,26 +634,30 @@ static GSList *create_layouts(cairo_t *c)
                 notification_update_text_to_render(n);
 
                 if (!iter->next && xmore_is_needed && settings.geometry.h == 1) {
-                        char *new_ttr = g_strdup_printf("%s (%d more)", n->text_to_render, qlen);
-                        g_free(n->text_to_render);
-                        n->text_to_render = new_ttr;
+                        char more[32];
+                        int more_len = snprintf(more, sizeof(more), " (%d more)", qlen);
+                        size_t len = strlen(n->text_to_render);
+
+                        n->text_to_render = g_realloc(n->text_to_render, len + more_len + 1);
+                        memcpy(n->text_to_render + len, more, more_len + 1);
                 }
-                layouts = g_slist_append(layouts,
-                                layout_from_notification(c, n));
+                g_ptr_array_add(frame_layouts, layout_get_for_notification(n));
         }
 
         if (xmore_is_needed && settings.geometry.h != 1) {
                 /* append xmore message as new message */
-                layouts = g_slist_append(layouts,
-                        layout_derive_xmore(c, last, qlen));
+                g_ptr_array_add(frame_layouts, layout_get_xmore(last, qlen));
+        } else if (xmore_layout) {
+                g_clear_pointer(&xmore_layout, free_colored_layout);
         }
 
-        return layouts;
+        return frame_layouts;
 }
 
-static void free_layouts(GSList *layouts)
+static gboolean layout_is_unused(gpointer key, gpointer value, gpointer user_data)
 {
-        g_slist_free_full(layouts, free_colored_layout);
+        colored_layout *cl = value;
+        return cl->last_used != draw_count;
 }
 
 static int layout_get_height(colored_layout *cl)
@@ -447,21 +725,23 @@ static void draw_rounded_rect(cairo_t *c, int x, int y, int width, int height, i
         cairo_close_path(c);
 }
 
-static cairo_surface_t *render_background(cairo_surface_t *srf,
-                                          colored_layout *cl,
-                                          colored_layout *cl_next,
-                                          int y,
-                                          int width,
-                                          int height,
-                                          int corner_radius,
-                                          bool first,
-                                          bool last,
-                                          int *ret_width)
+/**
+ * Draw the frame, the background and the separator of a notification.
+ *
+ * @return the area inside the frame, the content gets drawn into
+ */
+static cairo_rectangle_int_t render_background(cairo_t *c,
+                                               colored_layout *cl,
+                                               colored_layout *cl_next,
+                                               int y,
+                                               int width,
+                                               int height,
+                                               int corner_radius,
+                                               bool first,
+                                               bool last)
 {
         int x = 0;
 
-        cairo_t *c = cairo_create(srf);
-
         if (first)
                 height += settings.frame_width;
         if (last)
@@ -502,12 +782,7 @@ static cairo_surface_t *render_background(cairo_surface_t *srf,
                 cairo_fill(c);
         }
 
-        cairo_destroy(c);
-
-        if (ret_width)
-                *ret_width = width;
-
-        return cairo_surface_create_for_rectangle(srf, x, y, width, height);
+        return (cairo_rectangle_int_t) { x, y, width, height };
 }
 
 static void render_content(cairo_t *c, colored_layout *cl, int width)
@@ -551,7 +826,7 @@ static void render_content(cairo_t *c, colored_layout *cl, int width)
 
 }
 
-static struct dimensions layout_render(cairo_surface_t *srf,
+static struct dimensions layout_render(cairo_t *c,
                                        colored_layout *cl,
                                        colored_layout *cl_next,
                                        struct dimensions dim,
@@ -563,13 +838,16 @@ static struct dimensions layout_render(cairo_surface_t *srf,
         int h_text = 0;
         pango_layout_get_pixel_size(cl->l, NULL, &h_text);
 
-        int bg_width = 0;
         int bg_height = MAX(settings.notification_height, (2 * settings.padding) + cl_h);
 
-        cairo_surface_t *content = render_background(srf, cl, cl_next, dim.y, dim.w, bg_height, dim.corner_radius, first, last, &bg_width);
-        cairo_t *c = cairo_create(content);
+        cairo_rectangle_int_t content = render_background(c, cl, cl_next, dim.y, dim.w, bg_height, dim.corner_radius, first, last);
 
-        render_content(c, cl, bg_width);
+        cairo_save(c);
+        cairo_rectangle(c, content.x, content.y, content.width, content.height);
+        cairo_clip(c);
+        cairo_translate(c, content.x, content.y);
+        render_content(c, cl, content.width);
+        cairo_restore(c);
 
         /* adding frame */
         if (first)
@@ -584,8 +862,6 @@ static struct dimensions layout_render(cairo_surface_t *srf,
         else
                 dim.y += settings.notification_height;
 
-        cairo_destroy(c);
-        cairo_surface_destroy(content);
         return dim;
 }
 
@@ -595,7 +871,7 @@ static struct dimensions layout_render(cairo_surface_t *srf,
  */
 static void calc_window_pos(int width, int height, int *ret_x, int *ret_y)
 {
-        screen_info *scr = get_active_screen();
+        screen_info *scr = frame.screen;
 
         if (ret_x) {
                 if (settings.geometry.negative_x) {
@@ -614,36 +890,283 @@ static void calc_window_pos(int width, int height, int *ret_x, int *ret_y)
         }
 }
 
-void draw(void)
+/**
+ * Get the height of the row \p cl occupies in the window, including the
+ * frame and the separator.
+ */
+static int layout_get_row_height(colored_layout *cl, bool first, bool last)
+{
+        int height = MAX(settings.notification_height,
+                         (2 * settings.padding) + layout_get_height(cl));
+
+        if (first)
+                height += settings.frame_width;
+        if (last)
+                height += settings.frame_width;
+        else
+                height += settings.separator_height;
+
+        return height;
+}
+
+static struct row_state layout_get_row_state(colored_layout *cl,
+                                             colored_layout *cl_next,
+                                             int y,
+                                             bool first,
+                                             bool last)
+{
+        struct row_state state = { 0 };
+
+        state.serial = cl->serial;
+        state.layout_width = pango_layout_get_width(cl->l);
+        state.y = y;
+        state.height = layout_get_row_height(cl, first, last);
+        state.first = first;
+        state.last = last;
+        state.fg = cl->fg;
+        state.bg = cl->bg;
+        state.frame = cl->frame;
+        if (cl_next)
+                state.sep = layout_get_sepcolor(cl, cl_next);
+
+        return state;
+}
+
+static bool color_equal(color_t a, color_t b)
+{
+        return a.r == b.r && a.g == b.g && a.b == b.b;
+}
+
+static bool row_state_equal(const struct row_state *a, const struct row_state *b)
+{
+        return a->serial == b->serial
+            && a->layout_width == b->layout_width
+            && a->y == b->y
+            && a->height == b->height
+            && a->first == b->first
+            && a->last == b->last
+            && color_equal(a->fg, b->fg)
+            && color_equal(a->bg, b->bg)
+            && color_equal(a->frame, b->frame)
+            && color_equal(a->sep, b->sep);
+}
+
+static void back_buffer_free(void)
+{
+        g_clear_pointer(&back_buffer_cr, cairo_destroy);
+        g_clear_pointer(&back_buffer, cairo_surface_destroy);
+}
+
+/**
+ * Make sure #back_buffer fits the given dimensions.
+ *
+ * @return true, if the back buffer got (re)created and has to get rendered
+ *         completely
+ */
+static bool back_buffer_prepare(const struct dimensions *dim)
+{
+        if (back_buffer
+            && back_buffer_dim.w == dim->w
+            && back_buffer_dim.h == dim->h
+            && back_buffer_dim.corner_radius == dim->corner_radius)
+                return false;
+
+        back_buffer_free();
+
+        back_buffer = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, dim->w, dim->h);
+        back_buffer_cr = cairo_create(back_buffer);
+        back_buffer_dim = *dim;
+        g_array_set_size(back_buffer_rows, 0);
+
+        return true;
+}
+
+/**
+ * Reset the area of a row in #back_buffer to transparency, just like a
+ * freshly created surface.
+ */
+static void back_buffer_clear_row(const struct row_state *row)
+{
+        cairo_t *c = back_buffer_cr;
+
+        cairo_save(c);
+        cairo_set_operator(c, CAIRO_OPERATOR_CLEAR);
+        cairo_rectangle(c, 0, row->y, back_buffer_dim.w, row->height);
+        cairo_fill(c);
+        cairo_restore(c);
+}
+
+/**
+ * Update the layouts and render the changed rows into #back_buffer.
+ *
+ * @param dim return location for the dimensions of the window
+ *
+ * @return true, if the whole back buffer got rendered again. Otherwise
+ *         #damage holds the changed area.
+ */
+static bool draw_render(cairo_t *c, screen_info *screen, struct dimensions *ret_dim)
 {
+        draw_count++;
+
+        frame_setup(c, screen);
+        GPtrArray *layouts = create_layouts();
 
-        GSList *layouts = create_layouts(x_win_get_context(win));
+        for (const GList *iter = queues_get_displayed(); iter; iter = iter->next)
+                stats_stage_done(iter->data, STATS_STAGE_LAYOUT);
 
         struct dimensions dim = calculate_dimensions(layouts);
 
-        cairo_surface_t *image_surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, dim.w, dim.h);
+        bool full = back_buffer_prepare(&dim);
+        cairo_region_intersect_rectangle(damage, &(cairo_rectangle_int_t) { 0 });
 
         bool first = true;
-        for (GSList *iter = layouts; iter; iter = iter->next) {
+        guint row = 0;
+        for (; row < layouts->len; row++) {
 
-                colored_layout *cl_this = iter->data;
-                colored_layout *cl_next = iter->next ? iter->next->data : NULL;
+                colored_layout *cl_this = layouts->pdata[row];
+                colored_layout *cl_next = row + 1 < layouts->len ? layouts->pdata[row + 1] : NULL;
 
-                dim = layout_render(image_surface, cl_this, cl_next, dim, first, !cl_next);
+                struct row_state state = layout_get_row_state(cl_this, cl_next, dim.y, first, !cl_next);
+
+                if (row < back_buffer_rows->len) {
+                        struct row_state *old = &g_array_index(back_buffer_rows, struct row_state, row);
+
+                        if (!full && row_state_equal(old, &state)) {
+                                /* the row is already in the back buffer */
+                                dim.y += state.height - (state.last ? settings.frame_width : 0);
+                                first = false;
+                                continue;
+                        }
+
+                        *old = state;
+                } else {
+                        g_array_append_val(back_buffer_rows, state);
+                }
+
+                if (!full) {
+                        cairo_rectangle_int_t rect = { 0, state.y, dim.w, state.height };
+                        cairo_region_union_rectangle(damage, &rect);
+                        back_buffer_clear_row(&state);
+                }
+
+                dim = layout_render(back_buffer_cr, cl_this, cl_next, dim, first, !cl_next);
 
                 first = false;
         }
+        g_array_set_size(back_buffer_rows, row);
+        cairo_surface_flush(back_buffer);
+
+        *ret_dim = dim;
+        return full;
+}
+
+/**
+ * Finish the frame after #back_buffer got presented.
+ */
+static void draw_done(void)
+{
+        stats_count(STATS_FRAMES, 1);
+        for (const GList *iter = queues_get_displayed(); iter; iter = iter->next)
+                stats_drawn(iter->data);
+
+        /* drop the layouts of notifications, which aren't displayed anymore */
+        g_hash_table_foreach_remove(layout_cache, layout_is_unused, NULL);
+}
+
+void draw(void)
+{
+        struct dimensions dim;
+
+        TRACE(draw_begin);
+
+        screen_frame_start();
+        bool full = draw_render(x_win_get_context(win), get_active_screen(), &dim);
 
         calc_window_pos(dim.w, dim.h, &dim.x, &dim.y);
-        x_display_surface(image_surface, win, &dim);
+        x_display_surface(back_buffer, win, &dim, full ? NULL : damage);
+
+        draw_done();
+
+        TRACE2(draw_end, dim.w, dim.h);
+}
+
+/* see draw.h */
+cairo_surface_t *draw_offscreen(screen_info *screen)
+{
+        struct dimensions dim;
+
+        draw_render(offscreen_cr, screen, &dim);
+        draw_done();
+
+        return back_buffer;
+}
+
+/* see draw.h */
+void draw_forget_notification(int id)
+{
+        if (layout_cache)
+                g_hash_table_remove(layout_cache, GINT_TO_POINTER(id));
+}
+
+/* see draw.h */
+void draw_icons_loaded(void)
+{
+        bool changed = false;
+
+        if (!layout_cache)
+                return;
+
+        for (const GList *iter = queues_get_displayed(); iter; iter = iter->next) {
+                notification *n = iter->data;
+                colored_layout *cl = g_hash_table_lookup(layout_cache, GINT_TO_POINTER(n->id));
+
+                /* the new layout gets a new serial, so only its row gets
+                 * rendered again */
+                if (cl && cl->icon_pending && !icon_is_pending(n)) {
+                        g_hash_table_remove(layout_cache, GINT_TO_POINTER(n->id));
+                        changed = true;
+                }
+        }
 
-        cairo_surface_destroy(image_surface);
-        free_layouts(layouts);
+        if (changed)
+                schedule_redraw();
+}
+
+/* see draw.h */
+void draw_invalidate(void)
+{
+        pango_font_description_free(pango_fdesc);
+        pango_fdesc = pango_font_description_from_string(settings.font);
+
+        g_hash_table_remove_all(layout_cache);
+        g_clear_pointer(&xmore_layout, free_colored_layout);
+        layout_contexts_free();
+        back_buffer_free();
+        g_array_set_size(back_buffer_rows, 0);
 }
 
 void draw_deinit(void)
 {
-        x_win_destroy(win);
-        x_free();
+        g_clear_pointer(&layout_cache, g_hash_table_destroy);
+        g_clear_pointer(&xmore_layout, free_colored_layout);
+        layout_contexts_free();
+        back_buffer_free();
+        g_clear_pointer(&damage, cairo_region_destroy);
+        if (frame_layouts) {
+                g_ptr_array_free(frame_layouts, true);
+                frame_layouts = NULL;
+        }
+        if (back_buffer_rows) {
+                g_array_free(back_buffer_rows, true);
+                back_buffer_rows = NULL;
+        }
+        icon_cache_clear();
+        g_clear_pointer(&offscreen_cr, cairo_destroy);
+
+        if (win) {
+                x_win_destroy(win);
+                win = NULL;
+                x_free();
+        }
 }
 /* vim: set tabstop=8 shiftwidth=8 expandtab textwidth=0: */
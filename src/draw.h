@@ -8,6 +8,41 @@ void draw_setup(void);
 
 void draw(void);
 
+/**
+ * Set up drawing into an offscreen surface without connecting to X. Use
+ * this instead of draw_setup().
+ */
+void draw_setup_offscreen(void);
+
+/**
+ * Render the displayed notifications like draw() does, but don't display
+ * them.
+ *
+ * @param screen the screen to lay out the notifications for
+ *
+ * @return the surface holding the notifications, owned by draw.c and
+ *         valid until the next frame
+ */
+cairo_surface_t *draw_offscreen(screen_info *screen);
+
+/**
+ * Drop all cached layouts and the back buffer and load the font again, so
+ * the next call of draw() renders everything with the current settings.
+ */
+void draw_invalidate(void);
+
+/**
+ * Drop the cached layout of the notification with the given id, as it
+ * got replaced.
+ */
+void draw_forget_notification(int id);
+
+/**
+ * Drop the layouts of the displayed notifications, whose icon finished
+ * loading in the background, and redraw only their rows.
+ */
+void draw_icons_loaded(void);
+
 void draw_deinit(void);
 
 #endif
@@ -9,15 +9,20 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "dbus.h"
 #include "draw.h"
+#include "history_log.h"
+#include "icon.h"
 #include "log.h"
 #include "menu.h"
 #include "notification.h"
 #include "option_parser.h"
 #include "queues.h"
+#include "rules.h"
 #include "settings.h"
+#include "stats.h"
 #include "utils.h"
 #include "x11/screen.h"
 #include "x11/x.h"
@@ -34,22 +39,103 @@ GSList *rules = NULL;
 
 /* misc functions */
 static gboolean run(void *data);
+static gboolean render_frame(gpointer data);
+
+/** the configuration file given on the command line or NULL */
+static char *cmdline_config_path = NULL;
+
+/** the source id of the pending frame, or 0 */
+static guint frame_id = 0;
+/** the time the last frame got rendered */
+static gint64 last_frame = 0;
+
+/** the source id of the pending timeout, which calls run(), or 0 */
+static guint next_timeout_id = 0;
+/** the time, the pending timeout is armed for */
+static gint64 next_timeout = 0;
+
+/** the window is set up and the queues may get processed */
+static bool started = false;
+/** the source id of startup_finish(), or 0 */
+static guint startup_id = 0;
+/** SIGHUP arrived before the startup finished */
+static bool reload_pending = false;
+
+/** print the duration of each startup phase, see startup_phase_done() */
+static bool startup_profile = false;
+/** the time the current startup phase began */
+static gint64 startup_phase_start = 0;
+/** the first frame after startup is still pending */
+static bool startup_first_frame = false;
+
+/**
+ * Print the duration of the startup phase, which just ended, if
+ * `-startup-profile` is given.
+ */
+static void startup_phase_done(const char *phase)
+{
+        if (!startup_profile)
+                return;
+
+        gint64 now = time_monotonic_now();
+        printf("startup: %-12s %8.2fms\n", phase, (now - startup_phase_start) / 1000.0);
+        fflush(stdout);
+        startup_phase_start = now;
+}
 
 void wake_up(void)
 {
+        /* notifications received before the window got set up stay
+         * queued until the main loop runs */
+        if (!started)
+                return;
+
         run(NULL);
 }
 
+/* see dunst.h */
+void schedule_redraw(void)
+{
+        /* startup_finish() draws the first frame */
+        if (frame_id || !started)
+                return;
+
+        /* only wait for the rest of the interval since the last frame */
+        gint64 wait = settings.frame_interval - (time_monotonic_now() - last_frame);
+
+        if (settings.frame_interval > 0 && wait > 0)
+                frame_id = g_timeout_add((wait + 999) / 1000, render_frame, NULL);
+        else
+                frame_id = g_idle_add(render_frame, NULL);
+}
+
 static gboolean run(void *data)
 {
         LOG_D("RUN");
 
+        /* If the execution got triggered by our timeout, it gets removed
+         * after returning, as it's actually a recurring interval. */
+        if (data == &next_timeout_id)
+                next_timeout_id = 0;
+
         bool fullscreen = have_fullscreen_window();
 
         queues_check_timeouts(x_is_idle(), fullscreen);
         queues_update(fullscreen);
 
-        static gint64 next_timeout = 0;
+        schedule_redraw();
+
+        return G_SOURCE_REMOVE;
+}
+
+/**
+ * Bring the window in sync with the queues and arm the timeout
+ * for the next change. Gets called via schedule_redraw().
+ */
+static gboolean render_frame(gpointer data)
+{
+        frame_id = 0;
+        last_frame = time_monotonic_now();
 
         if (!x_win_visible(win) && queues_length_displayed() > 0) {
                 draw();
@@ -64,24 +150,27 @@ static gboolean run(void *data)
                 draw();
         }
 
-        if (x_win_visible(win)) {
-                gint64 now = time_monotonic_now();
-                gint64 sleep = queues_get_next_datachange(now);
-                gint64 timeout_at = now + sleep;
-
-                if (sleep >= 0) {
-                        if (next_timeout < now || timeout_at < next_timeout) {
-                                g_timeout_add(sleep/1000, run, NULL);
-                                next_timeout = timeout_at;
-                        }
-                }
+        if (startup_first_frame) {
+                startup_first_frame = false;
+                startup_phase_done("first frame");
+        }
+
+        gint64 now = time_monotonic_now();
+        gint64 sleep = x_win_visible(win) ? queues_get_next_datachange(now) : -1;
+        gint64 timeout_at = now + sleep;
+
+        /* arm exactly one timeout for the next deadline */
+        if (next_timeout_id && (sleep < 0 || timeout_at != next_timeout)) {
+                g_source_remove(next_timeout_id);
+                next_timeout_id = 0;
+        }
+
+        if (sleep >= 0 && !next_timeout_id) {
+                /* round up, to not wake up before the deadline */
+                next_timeout_id = g_timeout_add((sleep + 999) / 1000, run, &next_timeout_id);
+                next_timeout = timeout_at;
         }
 
-        /* If the execution got triggered by g_timeout_add,
-         * we have to remove the timeout (which is actually a
-         * recurring interval), as we have set a new one
-         * by ourselves.
-         */
         return G_SOURCE_REMOVE;
 }
 
@@ -101,6 +190,88 @@ gboolean unpause_signal(gpointer data)
         return G_SOURCE_CONTINUE;
 }
 
+/**
+ * Check if any of the settings changed, which notification_init() takes
+ * the defaults of a notification from.
+ *
+ * @param old the settings before the reload
+ * @param old_colors the contents of xctx.colors before the reload
+ */
+static bool notification_defaults_changed(const settings_t *old, const char *old_colors[3][3])
+{
+        if (old->markup != settings.markup
+            || old->icon_position != settings.icon_position
+            || g_strcmp0(old->format, settings.format) != 0)
+                return true;
+
+        for (int urg = URG_MIN; urg <= URG_MAX; urg++) {
+                if (old->timeouts[urg] != settings.timeouts[urg]
+                    || g_strcmp0(old->icons[urg], settings.icons[urg]) != 0)
+                        return true;
+
+                /* the colors are interned */
+                for (int col = 0; col < ColLast; col++)
+                        if (old_colors[col][urg] != xctx.colors[col][urg])
+                                return true;
+        }
+
+        return false;
+}
+
+/**
+ * Read the configuration again and apply the changes.
+ *
+ * The rules only get applied again to the waiting and displayed
+ * notifications, which are matched by a changed rule. All other changes
+ * only invalidate the caches of the renderer.
+ */
+static void reload(void)
+{
+        settings_t old;
+        GSList *old_rules;
+        const char *old_colors[3][3];
+
+        LOG_M("Reloading the configuration");
+
+        notification_lock();
+
+        if (!reload_settings(cmdline_config_path, &old, &old_rules)) {
+                notification_unlock();
+                return;
+        }
+
+        memcpy(old_colors, xctx.colors, sizeof(old_colors));
+        x_reload(win, &old);
+
+        GSList *changed = rules_diff(old_rules, rules);
+        queues_reapply_rules(changed, notification_defaults_changed(&old, old_colors));
+        g_slist_free(changed);
+
+        icon_cache_clear();
+        notification_format_cache_clear();
+        draw_invalidate();
+
+        settings_free(&old);
+        rules_free(old_rules);
+
+        notification_unlock();
+
+        wake_up();
+}
+
+gboolean reload_signal(gpointer data)
+{
+        /* the window isn't set up yet, reload once it is */
+        if (!started) {
+                reload_pending = true;
+                return G_SOURCE_CONTINUE;
+        }
+
+        reload();
+
+        return G_SOURCE_CONTINUE;
+}
+
 gboolean quit_signal(gpointer data)
 {
         g_main_loop_quit(mainloop);
@@ -110,15 +281,79 @@ gboolean quit_signal(gpointer data)
 
 static void teardown(void)
 {
-        regex_teardown();
-
         teardown_queues();
+        notification_scripts_teardown();
+        history_log_teardown();
+        icon_loader_teardown();
+        icon_index_free();
+        notification_format_cache_clear();
 
         draw_deinit();
 }
 
+/**
+ * Build the icon index once the main loop is idle, instead of delaying
+ * the startup. icon_find_files() builds it on demand before.
+ */
+static gboolean icon_index_build(gpointer data)
+{
+        icon_index_update();
+
+        return G_SOURCE_REMOVE;
+}
+
+/**
+ * Set up the window and everything else not needed to answer the
+ * DBus calls, once the main loop runs. The idle priority is low, so the
+ * Notify calls waiting for the name get their reply first.
+ */
+static gboolean startup_finish(gpointer data)
+{
+        startup_id = 0;
+        startup_phase_done("main loop");
+
+        draw_setup();
+        startup_phase_done("x11");
+
+        history_log_init();
+        startup_phase_done("history");
+
+        g_idle_add_full(G_PRIORITY_LOW, icon_index_build, NULL, NULL);
+
+        if (settings.startup_notification) {
+                notification *n = notification_create();
+                n->id = 0;
+                n->appname = string_intern("dunst");
+                n->summary = g_strdup("startup");
+                n->body = g_strdup("dunst is up and running");
+                n->progress = -1;
+                n->timeout = 10 * G_USEC_PER_SEC;
+                n->markup = MARKUP_NO;
+                n->urgency = URG_LOW;
+                notification_init(n);
+                queues_notification_insert(n);
+        }
+
+        started = true;
+        startup_first_frame = startup_profile;
+
+        if (reload_pending) {
+                reload_pending = false;
+                reload();
+        }
+
+        run(NULL);
+
+        return G_SOURCE_REMOVE;
+}
+
 int dunst_main(int argc, char *argv[])
 {
+        startup_phase_start = time_monotonic_now();
+
+        /* a reader closing its pipe early (e.g. dmenu) shouldn't kill
+         * dunst, the write fails with EPIPE instead */
+        signal(SIGPIPE, SIG_IGN);
 
         queues_init();
 
@@ -135,56 +370,62 @@ int dunst_main(int argc, char *argv[])
         log_set_level_from_string(verbosity);
         g_free(verbosity);
 
-        char *cmdline_config_path;
         cmdline_config_path =
             cmdline_get_string("-conf/-config", NULL,
                                "Path to configuration file");
         load_settings(cmdline_config_path);
 
+        startup_profile = cmdline_get_bool("-startup-profile", false,
+                                           "Print the duration of each startup phase");
+
         if (cmdline_get_bool("-h/-help", false, "Print help")
             || cmdline_get_bool("--help", false, "Print help")) {
                 usage(EXIT_SUCCESS);
         }
 
+        startup_phase_done("settings");
+
+        /* Own the name before the expensive parts, so a client activating
+         * dunst doesn't have to wait for them. The Notify calls received
+         * meanwhile get replied to and queued, but the queues only get
+         * processed once startup_finish() set up the window. */
+        x_colors_init();
         int owner_id = initdbus();
+        dbus_wait_for_name();
+        startup_phase_done("dbus");
 
         mainloop = g_main_loop_new(NULL, FALSE);
 
-        draw_setup();
+        startup_id = g_idle_add_full(G_PRIORITY_LOW, startup_finish, NULL, NULL);
 
         guint pause_src = g_unix_signal_add(SIGUSR1, pause_signal, NULL);
         guint unpause_src = g_unix_signal_add(SIGUSR2, unpause_signal, NULL);
+        guint reload_src = g_unix_signal_add(SIGHUP, reload_signal, NULL);
 
         /* register SIGINT/SIGTERM handler for
          * graceful termination */
         guint term_src = g_unix_signal_add(SIGTERM, quit_signal, NULL);
         guint int_src = g_unix_signal_add(SIGINT, quit_signal, NULL);
 
-        if (settings.startup_notification) {
-                notification *n = notification_create();
-                n->id = 0;
-                n->appname = g_strdup("dunst");
-                n->summary = g_strdup("startup");
-                n->body = g_strdup("dunst is up and running");
-                n->progress = -1;
-                n->timeout = 10 * G_USEC_PER_SEC;
-                n->markup = MARKUP_NO;
-                n->urgency = URG_LOW;
-                notification_init(n);
-                queues_notification_insert(n);
-                // we do not call wakeup now, wake_up does not work here yet
-        }
-
-        run(NULL);
         g_main_loop_run(mainloop);
         g_clear_pointer(&mainloop, g_main_loop_unref);
 
+        if (startup_id)
+                g_source_remove(startup_id);
+        if (frame_id)
+                g_source_remove(frame_id);
+        if (next_timeout_id)
+                g_source_remove(next_timeout_id);
+
         /* remove signal handler watches */
         g_source_remove(pause_src);
         g_source_remove(unpause_src);
+        g_source_remove(reload_src);
         g_source_remove(term_src);
         g_source_remove(int_src);
 
+        stats_dump();
+
         dbus_tear_down(owner_id);
 
         teardown();
@@ -19,6 +19,14 @@ extern const char *colors[3][3];
 
 void wake_up(void);
 
+/**
+ * Schedule a redraw of the window. All requests until the redraw happens
+ * get coalesced into a single frame, which gets drawn as soon as the main
+ * loop is idle. If settings.frame_interval is set, frames are at least
+ * that far apart, so the redraw may get delayed until the interval passed.
+ */
+void schedule_redraw(void);
+
 int dunst_main(int argc, char *argv[]);
 
 void usage(int exit_status);
@@ -0,0 +1,483 @@
+/* copyright 2013 Sascha Kruse and contributors (see LICENSE for licensing information) */
+
+#include "history_log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "notification.h"
+#include "settings.h"
+#include "utils.h"
+
+/** the GVariant type of the payload of a RECORD_PUSH */
+#define HISTORY_LOG_FORMAT "(sssssyxxi)"
+/** the log doesn't get compacted below this size (in bytes) */
+#define HISTORY_LOG_COMPACT_MIN (64 * 1024)
+/** buffered records get written after this time (in seconds) */
+#define HISTORY_LOG_FLUSH_DELAY 1
+
+enum record_type {
+        RECORD_PUSH = 1, /**< a notification got pushed to history */
+        RECORD_POP = 2,  /**< the newest notification got removed from history */
+};
+
+/**
+ * The header preceding every record in the log. The payload follows
+ * directly and is padded to a multiple of 8 bytes.
+ */
+struct record_header {
+        guint32 len;  /**< the length of the payload without padding */
+        guint32 type; /**< the enum record_type */
+};
+
+/** the position of a RECORD_PUSH, which didn't get popped yet */
+struct log_entry {
+        guint64 offset;
+        guint64 size;  /**< the size of the record including header and padding */
+};
+
+static char *log_path = NULL;
+static int log_fd = -1;
+/** the size of the file on disk */
+static guint64 log_size = 0;
+static const unsigned char *log_map = NULL;
+static size_t log_map_size = 0;
+/** the struct log_entry of all live entries, oldest first */
+static GArray *log_entries = NULL;
+/** the sum of the sizes of #log_entries */
+static guint64 log_live_size = 0;
+/** records not written to disk yet */
+static GByteArray *log_pending = NULL;
+static guint log_flush_id = 0;
+
+static void history_log_flush(void);
+
+static guint64 record_size(guint32 len)
+{
+        return sizeof(struct record_header) + ((len + 7) & ~7u);
+}
+
+static bool write_all(int fd, const void *data, size_t len)
+{
+        const char *buf = data;
+
+        while (len > 0) {
+                ssize_t written = write(fd, buf, len);
+                if (written < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        return false;
+                }
+                buf += written;
+                len -= written;
+        }
+
+        return true;
+}
+
+/**
+ * Stop using the history log after an error
+ */
+static void history_log_close(void)
+{
+        if (log_map)
+                munmap((void *) log_map, log_map_size);
+        log_map = NULL;
+        log_map_size = 0;
+
+        if (log_fd >= 0)
+                close(log_fd);
+        log_fd = -1;
+
+        if (log_flush_id)
+                g_source_remove(log_flush_id);
+        log_flush_id = 0;
+
+        g_clear_pointer(&log_path, g_free);
+        if (log_entries)
+                g_array_free(log_entries, true);
+        log_entries = NULL;
+        if (log_pending)
+                g_byte_array_free(log_pending, true);
+        log_pending = NULL;
+        log_live_size = 0;
+        log_size = 0;
+}
+
+/**
+ * Map the whole file into memory, if it grew since the last time.
+ */
+static bool history_log_map(void)
+{
+        if (log_map && log_map_size == log_size)
+                return true;
+
+        if (log_map)
+                munmap((void *) log_map, log_map_size);
+        log_map = NULL;
+        log_map_size = 0;
+
+        if (log_size == 0)
+                return true;
+
+        void *map = mmap(NULL, log_size, PROT_READ, MAP_SHARED, log_fd, 0);
+        if (map == MAP_FAILED) {
+                LOG_W("Cannot map history log '%s': %s", log_path, strerror(errno));
+                return false;
+        }
+
+        log_map = map;
+        log_map_size = log_size;
+        return true;
+}
+
+/**
+ * Rebuild #log_entries by replaying all records of the file.
+ * A truncated record at the end, e.g. after a crash, gets cut off.
+ */
+static void history_log_replay(void)
+{
+        guint64 offset = 0;
+
+        while (offset + sizeof(struct record_header) <= log_size) {
+                struct record_header header;
+                memcpy(&header, log_map + offset, sizeof(header));
+
+                guint64 size = record_size(header.len);
+                if (offset + size > log_size)
+                        break;
+
+                if (header.type == RECORD_PUSH) {
+                        struct log_entry entry = { offset, size };
+                        g_array_append_val(log_entries, entry);
+                        log_live_size += size;
+                } else if (header.type == RECORD_POP && log_entries->len > 0) {
+                        log_live_size -= g_array_index(log_entries, struct log_entry, log_entries->len - 1).size;
+                        g_array_set_size(log_entries, log_entries->len - 1);
+                }
+
+                offset += size;
+        }
+
+        if (offset < log_size) {
+                LOG_W("Discarding %" G_GUINT64_FORMAT " bytes of a truncated record in history log",
+                      log_size - offset);
+                if (ftruncate(log_fd, offset) == 0) {
+                        log_size = offset;
+                        history_log_map();
+                }
+        }
+}
+
+/**
+ * Rewrite the log with only the live entries, limited to the newest
+ * settings.history_log_length ones.
+ */
+static void history_log_compact(void)
+{
+        guint first = 0;
+        if (log_entries->len > (guint) settings.history_log_length)
+                first = log_entries->len - settings.history_log_length;
+
+        char *tmp_path = g_strconcat(log_path, ".tmp", NULL);
+        int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        if (fd < 0) {
+                LOG_W("Cannot compact history log: %s", strerror(errno));
+                g_free(tmp_path);
+                return;
+        }
+
+        GArray *entries = g_array_new(false, false, sizeof(struct log_entry));
+        guint64 offset = 0;
+        bool ok = true;
+
+        for (guint i = first; ok && i < log_entries->len; i++) {
+                struct log_entry *old = &g_array_index(log_entries, struct log_entry, i);
+                struct log_entry entry = { offset, old->size };
+
+                ok = write_all(fd, log_map + old->offset, old->size);
+                g_array_append_val(entries, entry);
+                offset += old->size;
+        }
+
+        if (close(fd) != 0 || !ok || rename(tmp_path, log_path) != 0) {
+                LOG_W("Cannot compact history log: %s", strerror(errno));
+                g_unlink(tmp_path);
+                g_array_free(entries, true);
+                g_free(tmp_path);
+                return;
+        }
+        g_free(tmp_path);
+
+        LOG_D("Compacted history log from %" G_GUINT64_FORMAT " to %" G_GUINT64_FORMAT " bytes",
+              log_size, offset);
+
+        close(log_fd);
+        log_fd = open(log_path, O_RDWR | O_APPEND);
+
+        g_array_free(log_entries, true);
+        log_entries = entries;
+        log_live_size = offset;
+        log_size = offset;
+
+        if (log_fd < 0) {
+                LOG_W("Cannot reopen history log '%s': %s", log_path, strerror(errno));
+                history_log_close();
+                return;
+        }
+
+        /* the old mapping still shows the replaced file */
+        if (log_map)
+                munmap((void *) log_map, log_map_size);
+        log_map = NULL;
+        log_map_size = 0;
+
+        if (!history_log_map())
+                history_log_close();
+}
+
+static bool history_log_needs_compaction(void)
+{
+        return log_entries->len > 2 * (guint) settings.history_log_length
+            || (log_size > HISTORY_LOG_COMPACT_MIN && log_size > 2 * log_live_size);
+}
+
+static gboolean history_log_flush_cb(gpointer data)
+{
+        log_flush_id = 0;
+        history_log_flush();
+        return G_SOURCE_REMOVE;
+}
+
+/**
+ * Write the buffered records to disk and compact the log, if enough
+ * of it got stale.
+ */
+static void history_log_flush(void)
+{
+        if (log_flush_id) {
+                g_source_remove(log_flush_id);
+                log_flush_id = 0;
+        }
+
+        if (log_fd < 0 || log_pending->len == 0)
+                return;
+
+        if (!write_all(log_fd, log_pending->data, log_pending->len)) {
+                LOG_W("Cannot write history log '%s': %s", log_path, strerror(errno));
+                history_log_close();
+                return;
+        }
+
+        log_size += log_pending->len;
+        g_byte_array_set_size(log_pending, 0);
+
+        if (!history_log_map()) {
+                history_log_close();
+                return;
+        }
+
+        if (history_log_needs_compaction())
+                history_log_compact();
+}
+
+static void history_log_append(enum record_type type, const void *payload, guint32 len)
+{
+        static const guint8 padding[8] = { 0 };
+        struct record_header header = { len, type };
+        guint64 size = record_size(len);
+
+        if (type == RECORD_PUSH) {
+                struct log_entry entry = { log_size + log_pending->len, size };
+                g_array_append_val(log_entries, entry);
+                log_live_size += size;
+        }
+
+        g_byte_array_append(log_pending, (const guint8 *) &header, sizeof(header));
+        if (len > 0)
+                g_byte_array_append(log_pending, payload, len);
+        g_byte_array_append(log_pending, padding, size - sizeof(header) - len);
+
+        if (!log_flush_id)
+                log_flush_id = g_timeout_add_seconds(HISTORY_LOG_FLUSH_DELAY, history_log_flush_cb, NULL);
+}
+
+static char *history_log_get_path(void)
+{
+        const char *state_home = g_getenv("XDG_STATE_HOME");
+
+        if (state_home && *state_home)
+                return g_build_filename(state_home, "dunst", "history", NULL);
+        else
+                return g_build_filename(g_get_home_dir(), ".local", "state", "dunst", "history", NULL);
+}
+
+/* see history_log.h */
+void history_log_init(void)
+{
+        if (settings.history_log_length <= 0 || log_fd >= 0)
+                return;
+
+        log_path = history_log_get_path();
+
+        char *dir = g_path_get_dirname(log_path);
+        if (g_mkdir_with_parents(dir, 0700) != 0) {
+                LOG_W("Cannot create directory '%s': %s", dir, strerror(errno));
+                g_free(dir);
+                history_log_close();
+                return;
+        }
+        g_free(dir);
+
+        log_fd = open(log_path, O_RDWR | O_CREAT | O_APPEND, 0600);
+        if (log_fd < 0) {
+                LOG_W("Cannot open history log '%s': %s", log_path, strerror(errno));
+                history_log_close();
+                return;
+        }
+
+        struct stat st;
+        if (fstat(log_fd, &st) != 0) {
+                LOG_W("Cannot stat history log '%s': %s", log_path, strerror(errno));
+                history_log_close();
+                return;
+        }
+
+        log_size = st.st_size;
+        log_entries = g_array_new(false, false, sizeof(struct log_entry));
+        log_pending = g_byte_array_new();
+
+        if (!history_log_map()) {
+                history_log_close();
+                return;
+        }
+
+        history_log_replay();
+        if (history_log_needs_compaction())
+                history_log_compact();
+
+        if (log_entries)
+                LOG_I("Loaded %u notifications from history log '%s'", log_entries->len, log_path);
+}
+
+/* see history_log.h */
+void history_log_push(const notification *n)
+{
+        if (log_fd < 0)
+                return;
+
+        /* the timestamp is monotonic, store it as wall clock time */
+        gint64 timestamp = g_get_real_time() - (time_monotonic_now() - n->timestamp);
+
+        GVariant *record = g_variant_new(HISTORY_LOG_FORMAT,
+                                         n->appname ? n->appname : "",
+                                         n->summary ? n->summary : "",
+                                         n->body ? n->body : "",
+                                         n->category ? n->category : "",
+                                         n->icon ? n->icon : "",
+                                         (guint8) n->urgency,
+                                         timestamp,
+                                         n->timeout,
+                                         n->progress);
+        g_variant_ref_sink(record);
+
+        history_log_append(RECORD_PUSH, g_variant_get_data(record), g_variant_get_size(record));
+
+        g_variant_unref(record);
+}
+
+/**
+ * Create a notification from the record of \p entry.
+ */
+static notification *history_log_load(const struct log_entry *entry)
+{
+        if (!history_log_map() || entry->offset + entry->size > log_map_size)
+                return NULL;
+
+        struct record_header header;
+        memcpy(&header, log_map + entry->offset, sizeof(header));
+
+        GVariant *record = g_variant_new_from_data(G_VARIANT_TYPE(HISTORY_LOG_FORMAT),
+                                                   log_map + entry->offset + sizeof(header),
+                                                   header.len,
+                                                   false,
+                                                   NULL,
+                                                   NULL);
+        g_variant_ref_sink(record);
+
+        notification *n = notification_create();
+        const char *appname, *summary, *body, *category, *icon;
+        guint8 urgency;
+        gint64 timestamp;
+
+        g_variant_get(record, "(&s&s&s&s&syxxi)",
+                      &appname,
+                      &summary,
+                      &body,
+                      &category,
+                      &icon,
+                      &urgency,
+                      &timestamp,
+                      &n->timeout,
+                      &n->progress);
+        notification_set_strings(n, NULL, appname, summary, body, category);
+        n->icon = string_intern(icon);
+        g_variant_unref(record);
+
+        n->urgency = urgency;
+        n->timestamp = time_monotonic_now() - (g_get_real_time() - timestamp);
+
+        notification_init(n);
+        return n;
+}
+
+/* see history_log.h */
+notification *history_log_pop(bool load)
+{
+        if (log_fd < 0 || log_entries->len == 0)
+                return NULL;
+
+        notification *n = NULL;
+        struct log_entry entry = g_array_index(log_entries, struct log_entry, log_entries->len - 1);
+
+        if (load) {
+                /* the entry may still be buffered */
+                if (entry.offset + entry.size > log_size) {
+                        history_log_flush();
+
+                        /* flushing may have compacted or closed the log */
+                        if (log_fd < 0 || log_entries->len == 0)
+                                return NULL;
+                        entry = g_array_index(log_entries, struct log_entry, log_entries->len - 1);
+                }
+
+                n = history_log_load(&entry);
+        }
+
+        g_array_set_size(log_entries, log_entries->len - 1);
+        log_live_size -= entry.size;
+        history_log_append(RECORD_POP, NULL, 0);
+
+        return n;
+}
+
+/* see history_log.h */
+void history_log_teardown(void)
+{
+        if (log_fd < 0)
+                return;
+
+        history_log_flush();
+        history_log_close();
+}
+
+/* vim: set tabstop=8 shiftwidth=8 expandtab textwidth=0: */
@@ -0,0 +1,41 @@
+/* copyright 2013 Sascha Kruse and contributors (see LICENSE for licensing information) */
+#ifndef DUNST_HISTORY_LOG_H
+#define DUNST_HISTORY_LOG_H
+
+#include <stdbool.h>
+
+#include "notification.h"
+
+/**
+ * Open the history log at `$XDG_STATE_HOME/dunst/history` and load the
+ * index of its entries.
+ *
+ * Does nothing, if settings.history_log_length is 0.
+ */
+void history_log_init(void);
+
+/**
+ * Append \p n to the history log.
+ *
+ * The record gets buffered and written to disk in a batch together with
+ * the other records arriving within a second.
+ */
+void history_log_push(const notification *n);
+
+/**
+ * Remove the newest entry from the history log.
+ *
+ * @param load if true, the entry gets read back from the log
+ *
+ * @return a new, initialized notification created from the newest entry,
+ *         if \p load is true and an entry exists. NULL otherwise.
+ */
+notification *history_log_pop(bool load);
+
+/**
+ * Write all buffered records and close the history log.
+ */
+void history_log_teardown(void);
+
+#endif
+/* vim: set tabstop=8 shiftwidth=8 expandtab textwidth=0: */
@@ -2,14 +2,54 @@
 
 #include <cairo.h>
 #include <gdk-pixbuf/gdk-pixbuf.h>
+#include <gio/gio.h>
 #include <stdbool.h>
 #include <string.h>
 
+#include "draw.h"
+#include "dunst.h"
 #include "log.h"
 #include "notification.h"
 #include "settings.h"
+#include "stats.h"
+#include "trace.h"
 #include "utils.h"
 
+/** negative cache entries expire after this time (in microseconds) */
+#define ICON_CACHE_NEGATIVE_TTL (30 * G_USEC_PER_SEC)
+/** the number of threads loading icons in the background */
+#define ICON_THREADS 2
+
+/**
+ * An entry of the icon cache, holding a ready to use surface
+ */
+struct icon_cache_entry {
+        char *key;
+        cairo_surface_t *surface; /**< NULL, if the icon could not be loaded */
+        gint64 expires;           /**< time, when a negative entry gets invalid */
+        gsize size;               /**< amount of memory accounted for this entry */
+        GList *link;              /**< the position of the entry in #icon_lru */
+};
+
+/** maps the cache keys to their #icon_cache_entry */
+static GHashTable *icon_cache = NULL;
+/** the cache entries, most recently used first */
+static GQueue *icon_lru = NULL;
+/** the amount of memory used by all cache entries */
+static gsize icon_cache_used = 0;
+
+/** the suffixes of the icons in the icon_path, in order of preference */
+static const char *icon_suffixes[] = { ".svg", ".png", ".xpm", NULL };
+
+/** maps the icon names to a GPtrArray of their files in the icon_path, best first */
+static GHashTable *icon_index = NULL;
+/** the icon_path #icon_index got built for */
+static char *icon_index_path = NULL;
+/** a directory of the icon_path changed since building #icon_index */
+static bool icon_index_dirty = false;
+/** the GFileMonitors watching the directories of the icon_path */
+static GSList *icon_index_monitors = NULL;
+
 static bool is_readable_file(const char *filename)
 {
         return (access(filename, R_OK) != -1);
@@ -22,42 +62,89 @@ const char *get_filename_ext(const char *filename)
         return dot + 1;
 }
 
-static cairo_status_t read_from_buf(void *closure, unsigned char *data, unsigned int size)
+/**
+ * Premultiply the 8 bit color channel with the alpha value
+ *
+ * This is an exact and branchless version of (color * alpha) / 255
+ * with rounding, so the compiler is able to vectorize the loops using it.
+ */
+static inline guint32 premultiply(guint32 color, guint32 alpha)
 {
-        GByteArray *buf = (GByteArray *)closure;
+        guint32 t = color * alpha + 128;
+        return (t + (t >> 8)) >> 8;
+}
 
-        unsigned int cpy = MIN(size, buf->len);
-        memcpy(data, buf->data, cpy);
-        g_byte_array_remove_range(buf, 0, cpy);
+/**
+ * Convert 8 bit RGB(A) pixel data into a cairo image surface
+ *
+ * Cairo wants its pixels as native endian 32 bit words with
+ * premultiplied alpha, while GdkPixbuf stores them as plain bytes
+ * in RGB(A) order without any premultiplication.
+ */
+static cairo_surface_t *icon_surface_from_pixels(const guchar *pixels,
+                                                 int width,
+                                                 int height,
+                                                 int rowstride,
+                                                 int n_channels,
+                                                 bool has_alpha)
+{
+        cairo_format_t format = has_alpha ? CAIRO_FORMAT_ARGB32 : CAIRO_FORMAT_RGB24;
+        cairo_surface_t *icon_surface = cairo_image_surface_create(format, width, height);
 
-        return CAIRO_STATUS_SUCCESS;
-}
+        if (cairo_surface_status(icon_surface) != CAIRO_STATUS_SUCCESS)
+                return icon_surface;
 
+        cairo_surface_flush(icon_surface);
 
-cairo_surface_t *gdk_pixbuf_to_cairo_surface(GdkPixbuf *pixbuf)
-{
-        /*
-         * Export the gdk pixbuf into buffer as a png and import the png buffer
-         * via cairo again as a cairo_surface_t.
-         * It looks counterintuitive, as there is gdk_cairo_set_source_pixbuf,
-         * which does the job faster. But this would require gtk3 as a dependency
-         * for a single function call. See discussion in #334 and #376.
-         */
-        cairo_surface_t *icon_surface = NULL;
-        GByteArray *buffer;
-        char *bufstr;
-        gsize buflen;
+        unsigned char *data = cairo_image_surface_get_data(icon_surface);
+        int stride = cairo_image_surface_get_stride(icon_surface);
 
-        gdk_pixbuf_save_to_buffer(pixbuf, &bufstr, &buflen, "png", NULL, NULL);
+        for (int y = 0; y < height; y++) {
+                const guchar *restrict src = pixels + (gsize)y * rowstride;
+                guint32 *restrict dst = (guint32 *)(data + (gsize)y * stride);
 
-        buffer = g_byte_array_new_take((guint8*)bufstr, buflen);
-        icon_surface = cairo_image_surface_create_from_png_stream(read_from_buf, buffer);
+                if (has_alpha) {
+                        for (int x = 0; x < width; x++) {
+                                const guchar *p = src + x * n_channels;
+                                guint32 a = p[3];
 
-        g_byte_array_free(buffer, TRUE);
+                                dst[x] = a << 24
+                                       | premultiply(p[0], a) << 16
+                                       | premultiply(p[1], a) << 8
+                                       | premultiply(p[2], a);
+                        }
+                } else {
+                        for (int x = 0; x < width; x++) {
+                                const guchar *p = src + x * n_channels;
+
+                                dst[x] = 0xffu << 24
+                                       | (guint32)p[0] << 16
+                                       | (guint32)p[1] << 8
+                                       | (guint32)p[2];
+                        }
+                }
+        }
+
+        cairo_surface_mark_dirty(icon_surface);
 
         return icon_surface;
 }
 
+cairo_surface_t *gdk_pixbuf_to_cairo_surface(GdkPixbuf *pixbuf)
+{
+        /*
+         * gdk_cairo_set_source_pixbuf would do the job, but this would
+         * require gtk3 as a dependency for a single function call.
+         * See discussion in #334 and #376.
+         */
+        return icon_surface_from_pixels(gdk_pixbuf_get_pixels(pixbuf),
+                                        gdk_pixbuf_get_width(pixbuf),
+                                        gdk_pixbuf_get_height(pixbuf),
+                                        gdk_pixbuf_get_rowstride(pixbuf),
+                                        gdk_pixbuf_get_n_channels(pixbuf),
+                                        gdk_pixbuf_get_has_alpha(pixbuf));
+}
+
 GdkPixbuf *get_pixbuf_from_file(const char *filename)
 {
         char *path = string_to_path(g_strdup(filename));
@@ -74,13 +161,125 @@ GdkPixbuf *get_pixbuf_from_file(const char *filename)
         return pixbuf;
 }
 
-GdkPixbuf *get_pixbuf_from_icon(const char *iconname)
+static void icon_index_changed(GFileMonitor *monitor,
+                               GFile *file,
+                               GFile *other_file,
+                               GFileMonitorEvent event_type,
+                               gpointer user_data)
 {
-        if (!iconname || iconname[0] == '\0')
-                return NULL;
+        icon_index_dirty = true;
+}
 
-        const char *suffixes[] = { ".svg", ".png", ".xpm", NULL };
-        GdkPixbuf *pixbuf = NULL;
+/**
+ * Add the icons of the directory to the index and watch it for changes.
+ */
+static guint icon_index_add_folder(const char *folder)
+{
+        GDir *dir = g_dir_open(folder, 0, NULL);
+        if (!dir)
+                return 0;
+
+        GPtrArray *names = g_ptr_array_new();
+        const char *name;
+        while ((name = g_dir_read_name(dir)))
+                g_ptr_array_add(names, (char *) name);
+
+        guint count = 0;
+        for (const char **suf = icon_suffixes; *suf; suf++) {
+                for (guint i = 0; i < names->len; i++) {
+                        name = g_ptr_array_index(names, i);
+                        if (!g_str_has_suffix(name, *suf))
+                                continue;
+
+                        char *key = g_strndup(name, strlen(name) - strlen(*suf));
+                        GPtrArray *files = g_hash_table_lookup(icon_index, key);
+
+                        if (!files) {
+                                files = g_ptr_array_new_with_free_func(g_free);
+                                g_hash_table_insert(icon_index, key, files);
+                        } else {
+                                g_free(key);
+                        }
+
+                        g_ptr_array_add(files, g_strconcat(folder, "/", name, NULL));
+                        count++;
+                }
+        }
+
+        g_ptr_array_free(names, true);
+        g_dir_close(dir);
+
+        GFile *file = g_file_new_for_path(folder);
+        GFileMonitor *monitor = g_file_monitor_directory(file, G_FILE_MONITOR_NONE, NULL, NULL);
+        g_object_unref(file);
+
+        if (monitor) {
+                g_signal_connect(monitor, "changed", G_CALLBACK(icon_index_changed), NULL);
+                icon_index_monitors = g_slist_prepend(icon_index_monitors, monitor);
+        }
+
+        return count;
+}
+
+/* see icon.h */
+void icon_index_free(void)
+{
+        for (GSList *iter = icon_index_monitors; iter; iter = iter->next) {
+                g_file_monitor_cancel(iter->data);
+                g_object_unref(iter->data);
+        }
+        g_slist_free(icon_index_monitors);
+        icon_index_monitors = NULL;
+
+        g_clear_pointer(&icon_index, g_hash_table_destroy);
+        g_clear_pointer(&icon_index_path, g_free);
+}
+
+/* see icon.h */
+void icon_index_update(void)
+{
+        if (icon_index && !icon_index_dirty
+            && g_strcmp0(icon_index_path, settings.icon_path) == 0)
+                return;
+
+        gint64 start = time_monotonic_now();
+
+        icon_index_free();
+        icon_index = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                           g_free, (GDestroyNotify) g_ptr_array_unref);
+        icon_index_path = g_strdup(settings.icon_path);
+        icon_index_dirty = false;
+
+        if (!settings.icon_path)
+                return;
+
+        char **folders = g_strsplit(settings.icon_path, ":", -1);
+        guint count = 0;
+        for (char **folder = folders; *folder; folder++)
+                count += icon_index_add_folder(*folder);
+
+        LOG_D("Indexed %u icons in %u directories in %.2fms",
+              count, g_strv_length(folders),
+              (time_monotonic_now() - start) / 1000.0);
+
+        g_strfreev(folders);
+}
+
+/**
+ * Collect the files, which may hold the icon, best first.
+ *
+ * The index only holds the files directly within the directories,
+ * names with a subdirectory get combined with every directory.
+ *
+ * @param iconname see get_pixbuf_from_icon()
+ * @param search return location, set to true if the files are candidates
+ *               from the icon_path and may not exist
+ *
+ * @return a NULL terminated array of paths, free it with g_strfreev()
+ */
+static char **icon_find_files(const char *iconname, bool *search)
+{
+        GPtrArray *files = g_ptr_array_new();
         gchar *uri_path = NULL;
 
         if (g_str_has_prefix(iconname, "file://")) {
@@ -91,38 +290,59 @@ GdkPixbuf *get_pixbuf_from_icon(const char *iconname)
 
         /* absolute path? */
         if (iconname[0] == '/' || iconname[0] == '~') {
-                pixbuf = get_pixbuf_from_file(iconname);
+                *search = false;
+                g_ptr_array_add(files, g_strdup(iconname));
+        } else if (!strchr(iconname, '/')) {
+                *search = true;
+                icon_index_update();
+
+                GPtrArray *indexed = g_hash_table_lookup(icon_index, iconname);
+                for (guint i = 0; indexed && i < indexed->len; i++)
+                        g_ptr_array_add(files, g_strdup(g_ptr_array_index(indexed, i)));
         } else {
-        /* search in icon_path */
-                char *start = settings.icon_path,
-                     *end, *current_folder, *maybe_icon_path;
-                do {
-                        end = strchr(start, ':');
-                        if (!end) end = strchr(settings.icon_path, '\0'); /* end = end of string */
-
-                        current_folder = g_strndup(start, end - start);
-
-                        for (const char **suf = suffixes; *suf; suf++) {
-                                maybe_icon_path = g_strconcat(current_folder, "/", iconname, *suf, NULL);
-                                if (is_readable_file(maybe_icon_path))
-                                        pixbuf = get_pixbuf_from_file(maybe_icon_path);
-                                g_free(maybe_icon_path);
-
-                                if (pixbuf)
-                                        break;
-                        }
+                *search = true;
 
-                        g_free(current_folder);
-                        if (pixbuf)
-                                break;
-
-                        start = end + 1;
-                } while (*(end) != '\0');
-                if (!pixbuf)
-                        LOG_W("No icon found in path: '%s'", iconname);
+                char **folders = g_strsplit(settings.icon_path ? settings.icon_path : "", ":", -1);
+                for (char **folder = folders; *folder; folder++)
+                        for (const char **suf = icon_suffixes; *suf; suf++)
+                                g_ptr_array_add(files, g_strconcat(*folder, "/", iconname, *suf, NULL));
+                g_strfreev(folders);
         }
 
+        g_ptr_array_add(files, NULL);
         g_free(uri_path);
+        return (char **) g_ptr_array_free(files, false);
+}
+
+/**
+ * Load the first of the files found by icon_find_files(), which holds a
+ * valid image. This doesn't touch the global state and can be called from
+ * any thread.
+ */
+static GdkPixbuf *icon_load_files(char **files, bool search, const char *iconname)
+{
+        GdkPixbuf *pixbuf = NULL;
+
+        for (char **file = files; *file && !pixbuf; file++)
+                if (!search || is_readable_file(*file))
+                        pixbuf = get_pixbuf_from_file(*file);
+
+        if (!pixbuf && search)
+                LOG_W("No icon found in path: '%s'", iconname);
+
+        return pixbuf;
+}
+
+GdkPixbuf *get_pixbuf_from_icon(const char *iconname)
+{
+        if (!iconname || iconname[0] == '\0')
+                return NULL;
+
+        bool search;
+        char **files = icon_find_files(iconname, &search);
+        GdkPixbuf *pixbuf = icon_load_files(files, search, iconname);
+
+        g_strfreev(files);
         return pixbuf;
 }
 
@@ -143,43 +363,423 @@ GdkPixbuf *get_pixbuf_from_raw_image(const RawImage *raw_image)
         return pixbuf;
 }
 
-cairo_surface_t *icon_get_for_notification(const notification *n)
+/**
+ * Scale the pixbuf down to \p max_size, if it's larger
+ *
+ * @param pixbuf The pixbuf to scale. This reference gets consumed.
+ * @param max_size the maximum width and height, 0 for no limit
+ *
+ * @return a reference to the scaled pixbuf
+ */
+static GdkPixbuf *icon_pixbuf_scale(GdkPixbuf *pixbuf, int max_size)
 {
-        GdkPixbuf *pixbuf;
-
-        if (n->raw_icon)
-                pixbuf = get_pixbuf_from_raw_image(n->raw_icon);
-        else if (n->icon)
-                pixbuf = get_pixbuf_from_icon(n->icon);
-        else
-                return NULL;
-
-        if (!pixbuf)
-                return NULL;
-
         int w = gdk_pixbuf_get_width(pixbuf);
         int h = gdk_pixbuf_get_height(pixbuf);
         int larger = w > h ? w : h;
-        if (settings.max_icon_size && larger > settings.max_icon_size) {
+        if (max_size && larger > max_size) {
                 GdkPixbuf *scaled;
                 if (w >= h) {
                         scaled = gdk_pixbuf_scale_simple(pixbuf,
-                                        settings.max_icon_size,
-                                        (settings.max_icon_size * h) / w,
+                                        max_size,
+                                        (max_size * h) / w,
                                         GDK_INTERP_BILINEAR);
                 } else {
                         scaled = gdk_pixbuf_scale_simple(pixbuf,
-                                        (settings.max_icon_size * w) / h,
-                                        settings.max_icon_size,
+                                        (max_size * w) / h,
+                                        max_size,
                                         GDK_INTERP_BILINEAR);
                 }
                 g_object_unref(pixbuf);
                 pixbuf = scaled;
         }
 
-        cairo_surface_t *ret = gdk_pixbuf_to_cairo_surface(pixbuf);
+        return pixbuf;
+}
+
+/**
+ * Scale the pixbuf and convert it into a surface
+ *
+ * @param pixbuf The pixbuf to convert or NULL. This reference gets consumed.
+ * @param max_size see icon_pixbuf_scale()
+ *
+ * @return the surface or NULL, if the conversion failed
+ */
+static cairo_surface_t *icon_surface_from_pixbuf(GdkPixbuf *pixbuf, int max_size)
+{
+        if (!pixbuf)
+                return NULL;
+
+        pixbuf = icon_pixbuf_scale(pixbuf, max_size);
+
+        cairo_surface_t *surface = gdk_pixbuf_to_cairo_surface(pixbuf);
         g_object_unref(pixbuf);
-        return ret;
+
+        if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+                cairo_surface_destroy(surface);
+                surface = NULL;
+        }
+
+        return surface;
+}
+
+/**
+ * Load the named icon of the notification and convert it into a surface,
+ * without consulting the cache
+ */
+static cairo_surface_t *icon_load_for_notification(const notification *n)
+{
+        return icon_surface_from_pixbuf(get_pixbuf_from_icon(n->icon), settings.max_icon_size);
+}
+
+/* see icon.h */
+void icon_prepare_raw_image(RawImage *raw_image)
+{
+        if (!raw_image->data_variant)
+                return;
+
+        int larger = MAX(raw_image->width, raw_image->height);
+        bool fits = !settings.max_icon_size || larger <= settings.max_icon_size;
+        bool is_rgb = raw_image->bits_per_sample == 8
+                   && raw_image->n_channels == (raw_image->has_alpha ? 4 : 3);
+        cairo_surface_t *surface = NULL;
+
+        if (fits && is_rgb) {
+                /* no need to scale, so read the pixels directly from the DBus message */
+                surface = icon_surface_from_pixels(raw_image->data,
+                                                   raw_image->width,
+                                                   raw_image->height,
+                                                   raw_image->rowstride,
+                                                   raw_image->n_channels,
+                                                   raw_image->has_alpha);
+        } else {
+                GdkPixbuf *pixbuf = get_pixbuf_from_raw_image(raw_image);
+
+                if (pixbuf) {
+                        pixbuf = icon_pixbuf_scale(pixbuf, settings.max_icon_size);
+                        surface = gdk_pixbuf_to_cairo_surface(pixbuf);
+                        g_object_unref(pixbuf);
+                }
+        }
+
+        if (surface && cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+                cairo_surface_destroy(surface);
+                surface = NULL;
+        }
+
+        raw_image->surface = surface;
+
+        /* the pixel data isn't necessary anymore */
+        g_clear_pointer(&raw_image->data_variant, g_variant_unref);
+        raw_image->data = NULL;
+}
+
+static void icon_cache_entry_free(gpointer data)
+{
+        struct icon_cache_entry *entry = data;
+
+        icon_cache_used -= entry->size;
+        g_queue_delete_link(icon_lru, entry->link);
+
+        if (entry->surface)
+                cairo_surface_destroy(entry->surface);
+        g_free(entry->key);
+        g_free(entry);
+}
+
+/**
+ * Look up the key in the cache and mark the entry as recently used
+ *
+ * @return the cache entry or NULL, if there is none
+ */
+static struct icon_cache_entry *icon_cache_lookup(const char *key)
+{
+        struct icon_cache_entry *entry = icon_cache ? g_hash_table_lookup(icon_cache, key) : NULL;
+
+        if (entry && !entry->surface && entry->expires < time_monotonic_now()) {
+                g_hash_table_remove(icon_cache, key);
+                entry = NULL;
+        }
+
+        if (!entry) {
+                stats_count(STATS_ICON_CACHE_MISSES, 1);
+                return NULL;
+        }
+
+        stats_count(STATS_ICON_CACHE_HITS, 1);
+
+        g_queue_unlink(icon_lru, entry->link);
+        g_queue_push_head_link(icon_lru, entry->link);
+
+        return entry;
+}
+
+/**
+ * Put the surface into the cache and drop the least recently used
+ * entries until the cache fits into settings.icon_cache_size again.
+ *
+ * @param key The cache key. The cache takes ownership of it.
+ * @param surface The surface to cache or NULL to remember
+ *                that the icon could not be loaded.
+ */
+static void icon_cache_insert(char *key, cairo_surface_t *surface)
+{
+        gsize limit = (gsize)settings.icon_cache_size * 1024;
+        struct icon_cache_entry *entry = g_malloc(sizeof(struct icon_cache_entry));
+
+        entry->key = key;
+        entry->surface = surface ? cairo_surface_reference(surface) : NULL;
+        entry->expires = time_monotonic_now() + ICON_CACHE_NEGATIVE_TTL;
+        entry->size = sizeof(struct icon_cache_entry) + strlen(key);
+        if (surface)
+                entry->size += cairo_image_surface_get_stride(surface)
+                             * cairo_image_surface_get_height(surface);
+
+        if (entry->size > limit) {
+                if (entry->surface)
+                        cairo_surface_destroy(entry->surface);
+                g_free(entry->key);
+                g_free(entry);
+                return;
+        }
+
+        if (!icon_cache) {
+                icon_cache = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                   NULL, icon_cache_entry_free);
+                icon_lru = g_queue_new();
+        }
+
+        while (icon_cache_used + entry->size > limit) {
+                struct icon_cache_entry *lru = g_queue_peek_tail(icon_lru);
+                g_hash_table_remove(icon_cache, lru->key);
+        }
+
+        g_queue_push_head(icon_lru, entry);
+        entry->link = g_queue_peek_head_link(icon_lru);
+        icon_cache_used += entry->size;
+
+        g_hash_table_replace(icon_cache, entry->key, entry);
+}
+
+/* see icon.h */
+void icon_cache_clear(void)
+{
+        g_clear_pointer(&icon_cache, g_hash_table_destroy);
+        g_clear_pointer(&icon_lru, g_queue_free);
+}
+
+static char *icon_cache_key(const notification *n)
+{
+        return g_strdup_printf("%d:%s", settings.max_icon_size, n->icon);
+}
+
+/**
+ * An icon getting loaded and scaled by #icon_pool
+ */
+struct icon_job {
+        char *key;                /**< the key of the icon in the cache */
+        char *name;               /**< the icon of the notification */
+        char **files;             /**< the files to try, see icon_find_files() */
+        bool search;
+        int max_size;
+        cairo_surface_t *surface; /**< the result, set by the worker */
+};
+
+/** the threads loading the icons */
+static GThreadPool *icon_pool = NULL;
+/** maps the cache keys of the icons getting loaded to their #icon_job */
+static GHashTable *icon_jobs = NULL;
+/** the jobs loaded by #icon_pool, which the main loop has to finish */
+static GAsyncQueue *icon_done = NULL;
+/** icon_jobs_drain() is scheduled already */
+static gint icon_drain_scheduled = 0;
+
+static void icon_job_free(gpointer data)
+{
+        struct icon_job *job = data;
+
+        if (job->surface)
+                cairo_surface_destroy(job->surface);
+        g_free(job->key);
+        g_free(job->name);
+        g_strfreev(job->files);
+        g_free(job);
+}
+
+/**
+ * Put the loaded icon into the cache.
+ */
+static void icon_job_finish(struct icon_job *job)
+{
+        g_hash_table_steal(icon_jobs, job->key);
+
+        /* the cache takes over the key */
+        icon_cache_insert(job->key, job->surface);
+        job->key = NULL;
+        icon_job_free(job);
+}
+
+/**
+ * Finish all jobs in #icon_done and redraw the notifications waiting for
+ * them. Runs in the main loop.
+ */
+static gboolean icon_jobs_drain(gpointer data)
+{
+        bool finished = false;
+
+        while (true) {
+                struct icon_job *job = g_async_queue_try_pop(icon_done);
+
+                if (!job) {
+                        g_atomic_int_set(&icon_drain_scheduled, 0);
+
+                        /* a worker may have pushed a job, while the flag
+                         * was still set */
+                        if (g_async_queue_length(icon_done) > 0
+                            && g_atomic_int_compare_and_exchange(&icon_drain_scheduled, 0, 1))
+                                continue;
+                        break;
+                }
+
+                icon_job_finish(job);
+                finished = true;
+        }
+
+        if (finished)
+                draw_icons_loaded();
+
+        return G_SOURCE_REMOVE;
+}
+
+/**
+ * Load the icon of the job. Runs in a thread of #icon_pool.
+ *
+ * The main loop owns the job again as soon as it's in #icon_done, so it
+ * mustn't be touched afterwards.
+ */
+static void icon_job_run(gpointer data, gpointer user_data)
+{
+        struct icon_job *job = data;
+
+        GdkPixbuf *pixbuf = icon_load_files(job->files, job->search, job->name);
+        job->surface = icon_surface_from_pixbuf(pixbuf, job->max_size);
+
+        g_async_queue_push(icon_done, job);
+
+        if (g_atomic_int_compare_and_exchange(&icon_drain_scheduled, 0, 1))
+                g_idle_add(icon_jobs_drain, icon_done);
+}
+
+/* see icon.h */
+void icon_request_for_notification(const notification *n)
+{
+        if (!n->icon || n->raw_icon
+            || settings.icon_position == icons_off
+            || settings.icon_cache_size <= 0)
+                return;
+
+        char *key = icon_cache_key(n);
+
+        if ((icon_cache && g_hash_table_contains(icon_cache, key))
+            || (icon_jobs && g_hash_table_contains(icon_jobs, key))) {
+                g_free(key);
+                return;
+        }
+
+        if (!icon_pool) {
+                icon_pool = g_thread_pool_new(icon_job_run, NULL, ICON_THREADS, false, NULL);
+                icon_jobs = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, icon_job_free);
+                icon_done = g_async_queue_new();
+        }
+
+        struct icon_job *job = g_malloc0(sizeof(struct icon_job));
+        job->key = key;
+        job->name = g_strdup(n->icon);
+        job->files = icon_find_files(n->icon, &job->search);
+        job->max_size = settings.max_icon_size;
+
+        g_hash_table_insert(icon_jobs, job->key, job);
+        g_thread_pool_push(icon_pool, job, NULL);
+}
+
+/* see icon.h */
+bool icon_is_pending(const notification *n)
+{
+        if (!icon_jobs || !n->icon || n->raw_icon)
+                return false;
+
+        char *key = icon_cache_key(n);
+        bool pending = g_hash_table_contains(icon_jobs, key);
+        g_free(key);
+
+        return pending;
+}
+
+/* see icon.h */
+void icon_loader_teardown(void)
+{
+        if (!icon_pool)
+                return;
+
+        /* let the running and queued jobs finish, there's no way to
+         * cancel gdk_pixbuf_new_from_file() */
+        g_thread_pool_free(icon_pool, false, true);
+        icon_pool = NULL;
+
+        /* the finished jobs are still in #icon_jobs, which frees them */
+        g_idle_remove_by_data(icon_done);
+        while (g_async_queue_try_pop(icon_done))
+                ;
+        g_atomic_int_set(&icon_drain_scheduled, 0);
+
+        g_clear_pointer(&icon_done, g_async_queue_unref);
+        g_clear_pointer(&icon_jobs, g_hash_table_destroy);
+}
+
+/**
+ * The body of icon_get_for_notification(), so the tracepoints cover all
+ * its returns
+ */
+static cairo_surface_t *icon_lookup_for_notification(const notification *n)
+{
+        if (n->raw_icon) {
+                icon_prepare_raw_image(n->raw_icon);
+                return n->raw_icon->surface ? cairo_surface_reference(n->raw_icon->surface) : NULL;
+        }
+
+        if (!n->icon)
+                return NULL;
+
+        if (settings.icon_cache_size <= 0)
+                return icon_load_for_notification(n);
+
+        char *key = icon_cache_key(n);
+
+        struct icon_cache_entry *entry = icon_cache_lookup(key);
+        if (entry) {
+                g_free(key);
+                return entry->surface ? cairo_surface_reference(entry->surface) : NULL;
+        }
+
+        /* don't block on an icon, which is already getting loaded */
+        if (icon_jobs && g_hash_table_contains(icon_jobs, key)) {
+                g_free(key);
+                return NULL;
+        }
+
+        cairo_surface_t *surface = icon_load_for_notification(n);
+
+        icon_cache_insert(key, surface);
+        return surface;
+}
+
+/* see icon.h */
+cairo_surface_t *icon_get_for_notification(const notification *n)
+{
+        TRACE1(icon_begin, n);
+        cairo_surface_t *surface = icon_lookup_for_notification(n);
+        TRACE2(icon_end, n, surface);
+
+        return surface;
 }
 
 /* vim: set tabstop=8 shiftwidth=8 expandtab textwidth=0: */
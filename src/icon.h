@@ -6,6 +6,12 @@
 
 #include "notification.h"
 
+/** Convert a `GdkPixbuf` with 8 bits per sample into a cairo image surface
+ *
+ * @param pixbuf The pixbuf to convert
+ *
+ * @return a new cairo_surface_t, check its status for allocation errors
+ */
 cairo_surface_t *gdk_pixbuf_to_cairo_surface(GdkPixbuf *pixbuf);
 
 /** Retrieve an icon by its full filepath.
@@ -34,9 +40,56 @@ GdkPixbuf *get_pixbuf_from_raw_image(const RawImage *raw_image);
  * Get a cairo surface with the appropriate icon for the notification, scaled
  * according to the current settings
  *
+ * The surfaces get cached (see settings.icon_cache_size), so the returned
+ * surface may be shared. Release it with cairo_surface_destroy().
+ *
  * @return a cairo_surface_t pointer or NULL if no icon could be retrieved.
  */
 cairo_surface_t *icon_get_for_notification(const notification *n);
 
+/**
+ * Start loading the icon of the notification in the background, unless
+ * it's in the cache already. Once the icon is in the cache, the
+ * notifications get redrawn.
+ *
+ * Does nothing, if the icon cache is disabled.
+ */
+void icon_request_for_notification(const notification *n);
+
+/**
+ * @return true, if the icon of the notification is still getting loaded in
+ *         the background. icon_get_for_notification() returns NULL then.
+ */
+bool icon_is_pending(const notification *n);
+
+/**
+ * Wait for the icons getting loaded in the background and drop them.
+ */
+void icon_loader_teardown(void);
+
+/**
+ * Create the scaled surface of the raw image and release its pixel data
+ * afterwards. Does nothing if this already happened.
+ *
+ * @param raw_image The raw image to prepare
+ */
+void icon_prepare_raw_image(RawImage *raw_image);
+
+/**
+ * Drop all entries of the icon cache
+ */
+void icon_cache_clear(void);
+
+/**
+ * Index the icons in the directories of settings.icon_path, unless the
+ * index is still up to date. The directories are watched for changes.
+ */
+void icon_index_update(void);
+
+/**
+ * Free the icon index and stop watching the directories
+ */
+void icon_index_free(void);
+
 #endif
 /* vim: set tabstop=8 shiftwidth=8 expandtab textwidth=0: */
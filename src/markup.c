@@ -3,6 +3,7 @@
 #include "markup.h"
 
 #include <assert.h>
+#include <glib.h>
 #include <stdbool.h>
 #include <string.h>
 #include <stdio.h>
@@ -11,39 +12,108 @@
 #include "settings.h"
 #include "utils.h"
 
+/** The entities known to markup_quote() and markup_unquote() */
+static const struct {
+        const char *entity;
+        size_t len;
+        char c;
+} markup_entities[] = {
+        { "&quot;", 6, '"'  },
+        { "&apos;", 6, '\'' },
+        { "&lt;",   4, '<'  },
+        { "&gt;",   4, '>'  },
+        { "&amp;",  5, '&'  },
+};
+
+/**
+ * Quote the characters, which have a special meaning in pango markup.
+ *
+ * The quoted string gets built in a single pass. If there's nothing to
+ * quote, \p str gets returned as it is.
+ */
 static char *markup_quote(char *str)
 {
         assert(str);
 
-        str = string_replace_all("&", "&amp;", str);
-        str = string_replace_all("\"", "&quot;", str);
-        str = string_replace_all("'", "&apos;", str);
-        str = string_replace_all("<", "&lt;", str);
-        str = string_replace_all(">", "&gt;", str);
+        if (!strpbrk(str, "&\"'<>"))
+                return str;
 
-        return str;
+        GString *out = g_string_sized_new(strlen(str) + 32);
+
+        for (const char *p = str; *p; p++) {
+                int i;
+                for (i = 0; i < G_N_ELEMENTS(markup_entities); i++)
+                        if (*p == markup_entities[i].c)
+                                break;
+
+                if (i < G_N_ELEMENTS(markup_entities))
+                        g_string_append_len(out, markup_entities[i].entity, markup_entities[i].len);
+                else
+                        g_string_append_c(out, *p);
+        }
+
+        g_free(str);
+        return g_string_free(out, false);
 }
 
+/**
+ * Replace the entities known from markup_quote() by their characters.
+ * Works in place, as the string can only shrink.
+ */
 static char *markup_unquote(char *str)
 {
         assert(str);
 
-        str = string_replace_all("&quot;", "\"", str);
-        str = string_replace_all("&apos;", "'", str);
-        str = string_replace_all("&lt;", "<", str);
-        str = string_replace_all("&gt;", ">", str);
-        str = string_replace_all("&amp;", "&", str);
+        char *dst = str;
+        const char *src = str;
+
+        while (*src) {
+                int i = G_N_ELEMENTS(markup_entities);
+                if (*src == '&')
+                        for (i = 0; i < G_N_ELEMENTS(markup_entities); i++)
+                                if (strncmp(src, markup_entities[i].entity, markup_entities[i].len) == 0)
+                                        break;
+
+                if (i < G_N_ELEMENTS(markup_entities)) {
+                        *dst++ = markup_entities[i].c;
+                        src += markup_entities[i].len;
+                } else {
+                        *dst++ = *src++;
+                }
+        }
+        *dst = '\0';
 
         return str;
 }
 
+/**
+ * Replace the variants of the br tag by newlines. Works in place, as
+ * the string can only shrink.
+ */
 static char *markup_br2nl(char *str)
 {
         assert(str);
 
-        str = string_replace_all("<br>", "\n", str);
-        str = string_replace_all("<br/>", "\n", str);
-        str = string_replace_all("<br />", "\n", str);
+        static const char *const tags[] = { "<br>", "<br/>", "<br />" };
+        char *dst = str;
+        const char *src = str;
+
+        while (*src) {
+                size_t len = 0;
+                if (*src == '<')
+                        for (int i = 0; i < G_N_ELEMENTS(tags) && !len; i++)
+                                if (strncmp(src, tags[i], strlen(tags[i])) == 0)
+                                        len = strlen(tags[i]);
+
+                if (len) {
+                        *dst++ = '\n';
+                        src += len;
+                } else {
+                        *dst++ = *src++;
+                }
+        }
+        *dst = '\0';
+
         return str;
 }
 
@@ -245,6 +315,9 @@ char *markup_strip(char *str)
 /*
  * Transform the string in accordance with `markup_mode` and
  * `settings.ignore_newline`
+ *
+ * All steps besides quoting work in place, so the string gets copied
+ * at most once.
  */
 char *markup_transform(char *str, enum markup_mode markup_mode)
 {
@@ -266,16 +339,80 @@ char *markup_transform(char *str, enum markup_mode markup_mode)
                 break;
         case MARKUP_FULL:
                 str = markup_br2nl(str);
-                markup_strip_a(&str, NULL);
-                markup_strip_img(&str, NULL);
+                if (strstr(str, "<a"))
+                        markup_strip_a(&str, NULL);
+                if (strstr(str, "<img"))
+                        markup_strip_img(&str, NULL);
                 break;
         }
 
         if (settings.ignore_newline) {
-                str = string_replace_all("\n", " ", str);
+                str = string_replace_char('\n', ' ', str);
         }
 
         return str;
 }
 
+/** tags longer than this are assumed to be a plain '<' */
+#define MARKUP_MAX_TAG_LEN 256
+
+/**
+ * @return true, if the tag starting at \p tag never gets closed
+ */
+static bool markup_is_void_tag(const char *tag)
+{
+        const char *name = tag + 1;
+        size_t len = strspn(name, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ");
+
+        return (len == 2 && g_ascii_strncasecmp(name, "br", 2) == 0)
+            || (len == 3 && g_ascii_strncasecmp(name, "img", 3) == 0);
+}
+
+/* see markup.h */
+size_t markup_truncate_len(const char *str, size_t max)
+{
+        size_t safe = 0;     /* the last cut outside of tags, entities and characters */
+        size_t balanced = 0; /* the last safe cut without any open tags */
+        size_t tag = 0;      /* the start of the current tag */
+        bool in_tag = false;
+        bool in_entity = false;
+        int depth = 0;
+
+        for (size_t i = 0; ; i++) {
+                char c = str[i];
+
+                if (!in_tag && !in_entity && (c & 0xC0) != 0x80) {
+                        safe = i;
+                        if (depth == 0)
+                                balanced = i;
+                }
+
+                if (i == max || c == '\0')
+                        break;
+
+                if (in_tag) {
+                        if (c == '>') {
+                                in_tag = false;
+                                if (str[tag + 1] == '/')
+                                        depth = MAX(0, depth - 1);
+                                else if (str[i - 1] != '/' && !markup_is_void_tag(str + tag))
+                                        depth++;
+                        } else if (i - tag > MARKUP_MAX_TAG_LEN) {
+                                in_tag = false;
+                        }
+                } else if (in_entity) {
+                        if (!g_ascii_isalnum(c) && c != '#')
+                                in_entity = false;
+                } else if (c == '<') {
+                        in_tag = true;
+                        tag = i;
+                } else if (c == '&') {
+                        in_entity = true;
+                }
+        }
+
+        /* rather keep an unbalanced tag than dropping most of the text */
+        return balanced >= safe / 2 ? balanced : safe;
+}
+
 /* vim: set tabstop=8 shiftwidth=8 expandtab textwidth=0: */
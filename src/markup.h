@@ -11,5 +11,16 @@ void markup_strip_img(char **str, char **urls);
 
 char *markup_transform(char *str, enum markup_mode markup_mode);
 
+/**
+ * Find the length to truncate \p str to, so it's at most \p max bytes
+ * long.
+ *
+ * The cut doesn't split a UTF-8 character, a tag or an entity. If
+ * possible, it's also placed before any tag which isn't closed yet.
+ *
+ * @return the length of the prefix of \p str to keep
+ */
+size_t markup_truncate_len(const char *str, size_t max);
+
 #endif
 /* vim: set tabstop=8 shiftwidth=8 expandtab textwidth=0: */
@@ -2,15 +2,11 @@
 
 #include "menu.h"
 
-#include <errno.h>
 #include <glib.h>
-#include <regex.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/wait.h>
-#include <unistd.h>
 
 #include "dbus.h"
 #include "dunst.h"
@@ -20,74 +16,120 @@
 #include "settings.h"
 #include "utils.h"
 
-static bool is_initialized = false;
-static regex_t cregex;
+/** the prefixes, which start an URL in plain text */
+static const char *const url_schemes[] = {
+        "http://", "https://", "ftp://", "ftps://",
+        "news://", "mailto:", "file://", "www.",
+};
 
-static int regex_init(void)
+/**
+ * Check if \p c belongs to a word. Bytes of multibyte UTF-8 sequences
+ * are treated as letters.
+ */
+static inline bool url_is_word_char(char c)
 {
-        if (is_initialized)
-                return 1;
-
-        char *regex =
-            "\\b(https?://|ftps?://|news://|mailto:|file://|www\\.)"
-            "[-[:alnum:]_\\@;/?:&=%$.+!*\x27,~#]*"
-            "(\\([-[:alnum:]_\\@;/?:&=%$.+!*\x27,~#]*\\)|[-[:alnum:]_\\@;/?:&=%$+*~])+";
-        int ret = regcomp(&cregex, regex, REG_EXTENDED | REG_ICASE);
-        if (ret != 0) {
-                LOG_W("Failed to compile regex.");
-                return 0;
-        } else {
-                is_initialized = true;
-                return 1;
+        return g_ascii_isalnum(c) || c == '_' || (guchar) c >= 0x80;
+}
+
+/**
+ * Check if \p c may appear inside an URL (besides parentheses)
+ */
+static inline bool url_is_char(char c)
+{
+        return url_is_word_char(c) || (c && strchr("-\\@;/?:&=%$.+!*',~#", c));
+}
+
+/**
+ * Check if \p c may end an URL. Punctuation usually belongs to the
+ * surrounding sentence.
+ */
+static inline bool url_is_end_char(char c)
+{
+        return url_is_char(c) && !strchr(".!',#", c);
+}
+
+/**
+ * Get the length of the URL scheme at \p str.
+ *
+ * @return the length of the matching entry of #url_schemes or 0
+ */
+static size_t url_scheme_length(const char *str)
+{
+        for (int i = 0; i < G_N_ELEMENTS(url_schemes); i++) {
+                size_t len = strlen(url_schemes[i]);
+                if (g_ascii_strncasecmp(str, url_schemes[i], len) == 0)
+                        return len;
         }
+
+        return 0;
 }
 
-void regex_teardown(void)
+/**
+ * Get the length of the URL, whose scheme ends at \p str.
+ *
+ * The URL may contain pairs of parentheses, but has to end with a
+ * closing parenthesis or a character accepted by url_is_end_char().
+ *
+ * @return the length of the URL after the scheme or 0, if it's empty
+ */
+static size_t url_body_length(const char *str)
 {
-        if (is_initialized) {
-                regfree(&cregex);
-                is_initialized = false;
+        const char *p = str;
+        const char *end = str;
+
+        for (;;) {
+                if (*p == '(') {
+                        const char *close = p + 1;
+                        while (url_is_char(*close))
+                                close++;
+                        if (*close != ')')
+                                break;
+                        p = end = close + 1;
+                } else if (url_is_char(*p)) {
+                        if (url_is_end_char(*p))
+                                end = p + 1;
+                        p++;
+                } else {
+                        break;
+                }
         }
+
+        return end - str;
 }
 
 /*
  * Extract all urls from a given string.
  *
+ * The string gets scanned once: at every word boundary the known schemes
+ * get checked and the URL gets taken as far as it may extend.
+ *
  * Return: a string of urls separated by \n
  *
  */
 char *extract_urls(const char *to_match)
 {
-        char *urls = NULL;
-
-        if (!regex_init())
-                return NULL;
-
+        GString *urls = NULL;
         const char *p = to_match;
-        regmatch_t m;
-
-        while (1) {
-                int nomatch = regexec(&cregex, p, 1, &m, 0);
-                if (nomatch) {
-                        return urls;
-                }
-                int start;
-                int finish;
-                if (m.rm_so == -1) {
-                        break;
-                }
-                start = m.rm_so + (p - to_match);
-                finish = m.rm_eo + (p - to_match);
-
-                char *match = g_strndup(to_match + start, finish - start);
 
-                urls = string_append(urls, match, "\n");
+        while (*p) {
+                size_t scheme, body;
 
-                g_free(match);
+                if ((p == to_match || !url_is_word_char(p[-1]))
+                    && (scheme = url_scheme_length(p))
+                    && (body = url_body_length(p + scheme))) {
+                        if (urls)
+                                g_string_append_c(urls, '\n');
+                        else
+                                urls = g_string_new(NULL);
 
-                p += m.rm_eo;
+                        g_string_append_len(urls, p, scheme + body);
+                        p += scheme + body;
+                } else {
+                        p++;
+                }
         }
-        return urls;
+
+        return urls ? g_string_free(urls, false) : NULL;
 }
 
 /*
@@ -105,28 +147,21 @@ void open_browser(const char *in)
         else
                 url = g_strdup(in);
 
-        int browser_pid1 = fork();
+        char *browser_cmd = g_strconcat(settings.browser, " ", url, NULL);
+        char **cmd = g_strsplit(browser_cmd, " ", 0);
+        GError *err = NULL;
 
-        if (browser_pid1) {
-                g_free(url);
-                int status;
-                waitpid(browser_pid1, &status, 0);
-        } else {
-                int browser_pid2 = fork();
-                if (browser_pid2) {
-                        exit(0);
-                } else {
-                        char *browser_cmd = g_strconcat(settings.browser, " ", url, NULL);
-                        char **cmd = g_strsplit(browser_cmd, " ", 0);
-                        execvp(cmd[0], cmd);
-                        // execvp won't return if it's successful
-                        // so, if we're here, it's definitely an error
-                        fprintf(stderr, "Warning: failed to execute '%s': %s\n",
-                                        settings.browser,
-                                        strerror(errno));
-                        exit(EXIT_FAILURE);
-                }
+        /* without G_SPAWN_DO_NOT_REAP_CHILD glib reaps the browser itself */
+        if (!g_spawn_async(NULL, cmd, NULL, G_SPAWN_SEARCH_PATH,
+                           spawn_child_setup, NULL, NULL, &err)) {
+                LOG_W("Unable to open browser '%s': %s",
+                      settings.browser, err->message);
+                g_error_free(err);
         }
+
+        g_strfreev(cmd);
+        g_free(browser_cmd);
+        g_free(url);
 }
 
 /*
@@ -187,9 +222,138 @@ void dispatch_menu_result(const char *input)
         g_free(in);
 }
 
+/** the state of the context menu while dmenu is open */
+struct menu_state {
+        GPid pid;
+        GString *input;         /**< the lines handed to dmenu */
+        gsize written;          /**< how much of #input dmenu has got */
+        GString *output;        /**< what dmenu printed so far */
+        bool input_done;        /**< stdin of dmenu got closed */
+        bool output_done;       /**< stdout of dmenu got closed */
+        bool exited;            /**< dmenu got reaped */
+};
+
+/** the currently open menu or NULL */
+static struct menu_state *menu = NULL;
+
+/**
+ * Dispatch the result and forget about the menu, as soon as dmenu is
+ * gone and all of its output has been read.
+ */
+static void menu_finish(void)
+{
+        if (!menu->input_done || !menu->output_done || !menu->exited)
+                return;
+
+        if (menu->output->len > 0)
+                dispatch_menu_result(menu->output->str);
+
+        g_string_free(menu->input, true);
+        g_string_free(menu->output, true);
+        g_free(menu);
+        menu = NULL;
+}
+
+/**
+ * Feed the menu entries to dmenu whenever its stdin can take more.
+ */
+static gboolean menu_write(GIOChannel *source, GIOCondition cond, gpointer data)
+{
+        /* dmenu may close its end anytime, even after this check. SIGPIPE
+         * is ignored, so writing fails with EPIPE then. */
+        if ((cond & G_IO_OUT) && !(cond & (G_IO_ERR | G_IO_HUP))) {
+                gsize written = 0;
+                GError *err = NULL;
+                GIOStatus status = g_io_channel_write_chars(source,
+                                        menu->input->str + menu->written,
+                                        menu->input->len - menu->written,
+                                        &written, &err);
+
+                menu->written += written;
+
+                if (status == G_IO_STATUS_AGAIN)
+                        return G_SOURCE_CONTINUE;
+
+                if (status == G_IO_STATUS_ERROR) {
+                        /* dmenu quit before reading all entries */
+                        if (g_error_matches(err, G_IO_CHANNEL_ERROR, G_IO_CHANNEL_ERROR_PIPE))
+                                LOG_D("dmenu closed its input");
+                        else
+                                LOG_W("Unable to write to dmenu: %s", err->message);
+                        g_error_free(err);
+                } else if (menu->written < menu->input->len) {
+                        return G_SOURCE_CONTINUE;
+                }
+        }
+
+        /* everything written or dmenu is gone, the EOF closes the list */
+        g_io_channel_shutdown(source, false, NULL);
+        menu->input_done = true;
+        menu_finish();
+        return G_SOURCE_REMOVE;
+}
+
+/**
+ * Collect the output of dmenu until it closes its stdout.
+ */
+static gboolean menu_read(GIOChannel *source, GIOCondition cond, gpointer data)
+{
+        char buf[1024];
+        gsize len = 0;
+        GIOStatus status = G_IO_STATUS_EOF;
+
+        if (cond & G_IO_IN) {
+                GError *err = NULL;
+                status = g_io_channel_read_chars(source, buf, sizeof(buf), &len, &err);
+
+                g_string_append_len(menu->output, buf, len);
+
+                if (status == G_IO_STATUS_ERROR) {
+                        LOG_W("Unable to read from dmenu: %s", err->message);
+                        g_error_free(err);
+                }
+
+                if (status == G_IO_STATUS_NORMAL || status == G_IO_STATUS_AGAIN)
+                        return G_SOURCE_CONTINUE;
+        }
+
+        g_io_channel_shutdown(source, false, NULL);
+        menu->output_done = true;
+        menu_finish();
+        return G_SOURCE_REMOVE;
+}
+
+static void menu_exited(GPid pid, gint status, gpointer user_data)
+{
+        g_spawn_close_pid(pid);
+        menu->exited = true;
+        menu_finish();
+}
+
+/**
+ * Wrap \p fd into a non-blocking, unbuffered channel for raw bytes and
+ * watch it for \p cond.
+ */
+static void menu_watch(int fd, GIOCondition cond, GIOFunc func)
+{
+        GIOChannel *channel = g_io_channel_unix_new(fd);
+
+        g_io_channel_set_close_on_unref(channel, true);
+        g_io_channel_set_encoding(channel, NULL, NULL);
+        g_io_channel_set_buffered(channel, false);
+        g_io_channel_set_flags(channel, G_IO_FLAG_NONBLOCK, NULL);
+
+        g_io_add_watch(channel, cond, func, NULL);
+        /* the watch holds its own reference */
+        g_io_channel_unref(channel);
+}
+
 /*
  * Open the context menu that let's the user
  * select urls/actions/etc
+ *
+ * dmenu runs asynchronously, the main loop keeps going and the result
+ * gets dispatched as soon as dmenu has quit.
  */
 void context_menu(void)
 {
@@ -197,80 +361,57 @@ void context_menu(void)
                 LOG_C("Unable to open dmenu: No dmenu command set.");
                 return;
         }
-        char *dmenu_input = NULL;
+
+        if (menu) {
+                LOG_D("The context menu is already open.");
+                return;
+        }
+
+        GString *dmenu_input = g_string_new(NULL);
 
         for (const GList *iter = queues_get_displayed(); iter;
              iter = iter->next) {
                 notification *n = iter->data;
 
-                if (n->urls)
-                        dmenu_input = string_append(dmenu_input, n->urls, "\n");
+                if (notification_get_urls(n)) {
+                        g_string_append(dmenu_input, n->urls);
+                        g_string_append_c(dmenu_input, '\n');
+                }
 
-                if (n->actions)
-                        dmenu_input =
-                            string_append(dmenu_input, n->actions->dmenu_str,
-                                          "\n");
+                if (n->actions) {
+                        g_string_append(dmenu_input, n->actions->dmenu_str);
+                        g_string_append_c(dmenu_input, '\n');
+                }
         }
 
-        if (!dmenu_input)
-                return;
-
-        char buf[1024] = {0};
-        int child_io[2];
-        int parent_io[2];
-        if (pipe(child_io) != 0) {
-                LOG_W("pipe(): error in child: %s", strerror(errno));
-                g_free(dmenu_input);
+        if (dmenu_input->len == 0) {
+                g_string_free(dmenu_input, true);
                 return;
         }
-        if (pipe(parent_io) != 0) {
-                LOG_W("pipe(): error in parent: %s", strerror(errno));
-                g_free(dmenu_input);
+        /* no trailing newline, like the entries got joined before */
+        g_string_truncate(dmenu_input, dmenu_input->len - 1);
+
+        GPid pid;
+        int in_fd, out_fd;
+        GError *err = NULL;
+
+        if (!g_spawn_async_with_pipes(NULL, settings.dmenu_cmd, NULL,
+                                      G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD,
+                                      spawn_child_setup, NULL, &pid, &in_fd, &out_fd, NULL,
+                                      &err)) {
+                LOG_W("Unable to run '%s': %s", settings.dmenu, err->message);
+                g_error_free(err);
+                g_string_free(dmenu_input, true);
                 return;
         }
-        int pid = fork();
-
-        if (pid == 0) {
-                close(child_io[1]);
-                close(parent_io[0]);
-                close(0);
-                if (dup(child_io[0]) == -1) {
-                        LOG_W("dup(): error in child: %s", strerror(errno));
-                        exit(EXIT_FAILURE);
-                }
-                close(1);
-                if (dup(parent_io[1]) == -1) {
-                        LOG_W("dup(): error in parent: %s", strerror(errno));
-                        exit(EXIT_FAILURE);
-                }
-                execvp(settings.dmenu_cmd[0], settings.dmenu_cmd);
-                fprintf(stderr, "Warning: failed to execute '%s': %s\n",
-                                settings.dmenu,
-                                strerror(errno));
-                exit(EXIT_FAILURE);
-        } else {
-                close(child_io[0]);
-                close(parent_io[1]);
-                size_t wlen = strlen(dmenu_input);
-                if (write(child_io[1], dmenu_input, wlen) != wlen) {
-                        LOG_W("write(): error: %s", strerror(errno));
-                }
-                close(child_io[1]);
-
-                size_t len = read(parent_io[0], buf, 1023);
-
-                waitpid(pid, NULL, 0);
-
-                if (len == 0) {
-                        g_free(dmenu_input);
-                        return;
-                }
-        }
-
-        close(parent_io[0]);
 
-        dispatch_menu_result(buf);
+        menu = g_malloc0(sizeof(struct menu_state));
+        menu->pid = pid;
+        menu->input = dmenu_input;
+        menu->output = g_string_new(NULL);
 
-        g_free(dmenu_input);
+        menu_watch(in_fd, G_IO_OUT | G_IO_ERR | G_IO_HUP, menu_write);
+        menu_watch(out_fd, G_IO_IN | G_IO_ERR | G_IO_HUP, menu_read);
+        g_child_watch_add(pid, menu_exited, NULL);
 }
 /* vim: set tabstop=8 shiftwidth=8 expandtab textwidth=0: */
@@ -5,7 +5,6 @@
 char *extract_urls(const char *to_match);
 void open_browser(const char *in);
 void invoke_action(const char *action);
-void regex_teardown(void);
 
 #endif
 /* vim: set tabstop=8 shiftwidth=8 expandtab textwidth=0: */
@@ -3,29 +3,27 @@
 #include "notification.h"
 
 #include <assert.h>
-#include <errno.h>
 #include <glib.h>
 #include <libgen.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/wait.h>
 #include <unistd.h>
 
 #include "dbus.h"
 #include "dunst.h"
+#include "icon.h"
 #include "log.h"
 #include "markup.h"
 #include "menu.h"
 #include "queues.h"
 #include "rules.h"
 #include "settings.h"
+#include "trace.h"
 #include "utils.h"
 #include "x11/x.h"
 
-static void notification_extract_urls(notification *n);
-static void notification_format_message(notification *n);
 static void notification_dmenu_string(notification *n);
 
 /* see notification.h */
@@ -63,7 +61,7 @@ void notification_print(notification *n)
         printf("\tfullscreen: %s\n", enum_to_string_fullscreen(n->fullscreen));
         printf("\tprogress: %d\n", n->progress);
         printf("\tid: %d\n", n->id);
-        if (n->urls) {
+        if (notification_get_urls(n)) {
                 char *urls = string_replace_all("\n", "\t\t\n", g_strdup(n->urls));
                 printf("\turls:\n");
                 printf("\t{\n");
@@ -86,43 +84,117 @@ void notification_print(notification *n)
         printf("}\n");
 }
 
-/* see notification.h */
-void notification_run_script(notification *n)
+/** the argument vectors of the script runs waiting for a free slot */
+static GQueue script_queue = G_QUEUE_INIT;
+/** the number of scripts currently running */
+static int scripts_running = 0;
+
+/** serializes notification_init() with the main loop, see notification_lock() */
+static GRecMutex init_mutex;
+/** the last generation assigned by notification_init(), protected by #init_mutex */
+static guint init_generation = 0;
+
+static void script_queue_run(void);
+
+static void script_exited(GPid pid, gint status, gpointer user_data)
 {
-        if (!n->script || strlen(n->script) < 1)
+        g_spawn_close_pid(pid);
+        scripts_running--;
+
+        script_queue_run();
+}
+
+/**
+ * Spawn the script given by \p argv without waiting for it.
+ */
+static void script_spawn(char **argv)
+{
+        GPid pid;
+        GError *err = NULL;
+
+        if (!g_spawn_async(NULL, argv, NULL,
+                           G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD,
+                           spawn_child_setup, NULL, &pid, &err)) {
+                LOG_W("Unable to run script: %s", err->message);
+                g_error_free(err);
                 return;
+        }
+
+        TRACE2(script_spawn, argv[0], pid);
 
-        const char *appname = n->appname ? n->appname : "";
-        const char *summary = n->summary ? n->summary : "";
-        const char *body = n->body ? n->body : "";
-        const char *icon = n->icon ? n->icon : "";
+        scripts_running++;
+        g_child_watch_add(pid, script_exited, NULL);
+}
 
-        const char *urgency = notification_urgency_to_string(n->urgency);
+static bool script_slot_free(void)
+{
+        return settings.script_concurrency <= 0
+            || scripts_running < settings.script_concurrency;
+}
 
-        int pid1 = fork();
+/**
+ * Start the queued script runs, as long as there are free slots.
+ */
+static void script_queue_run(void)
+{
+        while (script_slot_free() && !g_queue_is_empty(&script_queue)) {
+                char **argv = g_queue_pop_head(&script_queue);
+                script_spawn(argv);
+                g_strfreev(argv);
+        }
+}
 
-        if (pid1) {
-                int status;
-                waitpid(pid1, &status, 0);
-        } else {
-                int pid2 = fork();
-                if (pid2) {
-                        exit(0);
-                } else {
-                        int ret = execlp(n->script,
-                                         n->script,
-                                         appname,
-                                         summary,
-                                         body,
-                                         icon,
-                                         urgency,
-                                         (char *)NULL);
-                        if (ret != 0) {
-                                LOG_W("Unable to run script: %s", strerror(errno));
-                                exit(EXIT_FAILURE);
+/**
+ * Handle a script run, which doesn't fit into the queue anymore.
+ */
+static void script_queue_overflow(char **argv)
+{
+        if (settings.script_overflow == SCRIPT_OVERFLOW_COALESCE) {
+                for (GList *iter = script_queue.head; iter; iter = iter->next) {
+                        char **queued = iter->data;
+                        if (strcmp(queued[0], argv[0]) == 0) {
+                                LOG_D("Script queue is full, replacing queued run of '%s'", argv[0]);
+                                g_strfreev(queued);
+                                iter->data = argv;
+                                return;
                         }
                 }
         }
+
+        LOG_W("Script queue is full, dropping run of '%s'", argv[0]);
+        g_strfreev(argv);
+}
+
+/* see notification.h */
+void notification_run_script(notification *n)
+{
+        if (!n->script || strlen(n->script) < 1)
+                return;
+
+        char **argv = g_malloc(7 * sizeof(char *));
+        argv[0] = g_strdup(n->script);
+        argv[1] = g_strdup(n->appname ? n->appname : "");
+        argv[2] = g_strdup(n->summary ? n->summary : "");
+        argv[3] = g_strdup(n->body ? n->body : "");
+        argv[4] = g_strdup(n->icon ? n->icon : "");
+        argv[5] = g_strdup(notification_urgency_to_string(n->urgency));
+        argv[6] = NULL;
+
+        if (script_slot_free() && g_queue_is_empty(&script_queue)) {
+                script_spawn(argv);
+                g_strfreev(argv);
+        } else if (script_queue.length < settings.script_queue_length) {
+                g_queue_push_tail(&script_queue, argv);
+        } else {
+                script_queue_overflow(argv);
+        }
+}
+
+/* see notification.h */
+void notification_scripts_teardown(void)
+{
+        g_queue_foreach(&script_queue, (GFunc) g_strfreev, NULL);
+        g_queue_clear(&script_queue);
 }
 
 /*
@@ -180,6 +252,55 @@ int notification_is_duplicate(const notification *a, const notification *b)
             && a->urgency == b->urgency;
 }
 
+/* see notification.h */
+bool notification_is_update(const notification *n, const notification *update)
+{
+        /* Comparing raw icons is not supported, they may differ */
+        if (n->raw_icon || update->raw_icon)
+                return false;
+
+        /* the rules may have changed the derived fields of both,
+         * compare what the clients sent */
+        if (g_strcmp0(n->dbus_client, update->dbus_client) != 0
+            || g_strcmp0(n->appname, update->appname) != 0
+            || g_strcmp0(n->summary, update->summary) != 0
+            || g_strcmp0(n->body, update->body) != 0
+            || g_strcmp0(n->category, update->category) != 0
+            || g_strcmp0(n->origin.icon, update->origin.icon) != 0
+            || n->origin.urgency != update->origin.urgency
+            || n->origin.timeout != update->origin.timeout
+            || n->origin.transient != update->origin.transient)
+                return false;
+
+        for (int i = 0; i < G_N_ELEMENTS(n->colors); i++)
+                if (n->origin.colors[i] != update->origin.colors[i])
+                        return false;
+
+        gsize count = n->actions ? n->actions->count : 0;
+        if (count != (update->actions ? update->actions->count : 0))
+                return false;
+
+        for (gsize i = 0; i < count; i++)
+                if (g_strcmp0(n->actions->actions[i], update->actions->actions[i]) != 0)
+                        return false;
+
+        return true;
+}
+
+/* see notification.h */
+guint notification_fingerprint(const notification *n)
+{
+        guint hash = g_str_hash(n->appname);
+
+        hash = hash * 31 + g_str_hash(n->summary);
+        hash = hash * 31 + g_str_hash(n->body);
+        if (settings.icon_position != icons_off && n->icon)
+                hash = hash * 31 + g_str_hash(n->icon);
+        hash = hash * 31 + n->urgency;
+
+        return hash;
+}
+
 /* see notification.h */
 void actions_free(Actions *a)
 {
@@ -197,28 +318,89 @@ void rawimage_free(RawImage *i)
         if (!i)
                 return;
 
-        g_free(i->data);
+        if (i->data_variant)
+                g_variant_unref(i->data_variant);
+        if (i->surface)
+                cairo_surface_destroy(i->surface);
         g_free(i);
 }
 
+/**
+ * Free a string field of \p n, unless it's part of the string arena
+ */
+static void notification_free_string(notification *n, char *str)
+{
+        if (n->string_arena
+            && str >= n->string_arena
+            && str < n->string_arena + n->string_arena_size)
+                return;
+
+        g_free(str);
+}
+
+/* see notification.h */
+void notification_set_strings(notification *n,
+                              const char *dbus_client,
+                              const char *appname,
+                              const char *summary,
+                              const char *body,
+                              const char *category)
+{
+        const char *src[] = { summary, body };
+        char **dst[] = { &n->summary, &n->body };
+        gsize size = 0;
+
+        assert(!n->string_arena);
+
+        if (dbus_client)
+                string_intern_set(&n->dbus_client, dbus_client);
+        if (appname)
+                string_intern_set(&n->appname, appname);
+        if (category)
+                string_intern_set(&n->category, category);
+
+        for (int i = 0; i < G_N_ELEMENTS(src); i++)
+                if (src[i])
+                        size += strlen(src[i]) + 1;
+
+        if (size == 0)
+                return;
+
+        char *arena = g_malloc(size);
+        n->string_arena = arena;
+        n->string_arena_size = size;
+
+        for (int i = 0; i < G_N_ELEMENTS(src); i++) {
+                if (!src[i])
+                        continue;
+
+                gsize len = strlen(src[i]) + 1;
+                g_free(*dst[i]);
+                *dst[i] = memcpy(arena, src[i], len);
+                arena += len;
+        }
+}
+
 /* see notification.h */
 void notification_free(notification *n)
 {
         if (!n)
                 return;
 
-        g_free(n->appname);
-        g_free(n->summary);
-        g_free(n->body);
-        g_free(n->icon);
+        notification_free_string(n, n->summary);
+        notification_free_string(n, n->body);
+        g_free(n->string_arena);
+
+        string_intern_unref(n->appname);
+        string_intern_unref(n->dbus_client);
+        string_intern_unref(n->category);
+        string_intern_unref(n->icon);
+        string_intern_unref(n->origin.icon);
+        for (int i = 0; i < G_N_ELEMENTS(n->origin.colors); i++)
+                string_intern_unref(n->origin.colors[i]);
         g_free(n->msg);
-        g_free(n->dbus_client);
-        g_free(n->category);
         g_free(n->text_to_render);
         g_free(n->urls);
-        g_free(n->colors[ColFG]);
-        g_free(n->colors[ColBG]);
-        g_free(n->colors[ColFrame]);
 
         actions_free(n->actions);
         rawimage_free(n->raw_icon);
@@ -226,6 +408,117 @@ void notification_free(notification *n)
         g_free(n);
 }
 
+/* see notification.h */
+void notification_reapply_rules(notification *n)
+{
+        notification_lock();
+
+        n->urgency = n->origin.urgency;
+        n->timeout = n->origin.timeout;
+        n->transient = n->origin.transient;
+        if (n->icon != n->origin.icon) {
+                string_intern_unref(n->icon);
+                n->icon = string_intern_ref(n->origin.icon);
+        }
+
+        n->markup = settings.markup;
+        n->format = g_intern_string(settings.format);
+        n->script = NULL;
+        n->history_ignore = false;
+        n->fullscreen = FS_SHOW;
+        n->rate_limit = settings.rate_limit;
+        n->rate_limit_action = settings.rate_limit_action;
+
+        notification_init(n);
+
+        notification_unlock();
+}
+
+/* see notification.h */
+void notification_lock(void)
+{
+        g_rec_mutex_lock(&init_mutex);
+}
+
+/* see notification.h */
+void notification_unlock(void)
+{
+        g_rec_mutex_unlock(&init_mutex);
+}
+
+/* see notification.h */
+void notification_compact(notification *n)
+{
+        g_clear_pointer(&n->msg, g_free);
+        g_clear_pointer(&n->text_to_render, g_free);
+        g_clear_pointer(&n->urls, g_free);
+        n->urls_extracted = false;
+        if (n->actions)
+                g_clear_pointer(&n->actions->dmenu_str, g_free);
+
+        if (n->raw_icon) {
+                g_clear_pointer(&n->raw_icon, rawimage_free);
+                if (!n->icon)
+                        n->icon = string_intern(settings.icons[n->urgency]);
+        }
+}
+
+/* see notification.h */
+void notification_expand(notification *n)
+{
+        if (n->msg)
+                return;
+
+        g_clear_pointer(&n->urls, g_free);
+        n->urls_extracted = false;
+        notification_dmenu_string(n);
+        notification_format_message(n);
+
+        n->fingerprint = notification_fingerprint(n);
+}
+
+static size_t string_memory_size(const char *str)
+{
+        return str ? strlen(str) + 1 : 0;
+}
+
+/* see notification.h */
+size_t notification_memory_size(const notification *n)
+{
+        size_t size = sizeof(notification);
+
+        /* the interned strings are shared with other notifications and
+         * don't get counted */
+        if (!n->string_arena) {
+                size += string_memory_size(n->summary);
+                size += string_memory_size(n->body);
+        }
+        size += string_memory_size(n->msg);
+        size += string_memory_size(n->text_to_render);
+        size += string_memory_size(n->urls);
+        if (n->string_arena)
+                size += n->string_arena_size;
+
+        if (n->actions) {
+                size += sizeof(Actions);
+                size += (n->actions->count + 1) * sizeof(char *);
+                for (gsize i = 0; i < n->actions->count; i++)
+                        size += string_memory_size(n->actions->actions[i]);
+                size += string_memory_size(n->actions->dmenu_str);
+        }
+
+        if (n->raw_icon) {
+                size += sizeof(RawImage);
+                if (n->raw_icon->data_variant)
+                        size += g_variant_get_size(n->raw_icon->data_variant);
+                if (n->raw_icon->surface)
+                        size += cairo_image_surface_get_stride(n->raw_icon->surface)
+                              * cairo_image_surface_get_height(n->raw_icon->surface);
+        }
+
+        return size;
+}
+
 /* see notification.h */
 void notification_replace_single_field(char **haystack,
                                        char **needle,
@@ -258,7 +551,7 @@ notification *notification_create(void)
         /* Unparameterized default values */
         n->first_render = true;
         n->markup = settings.markup;
-        n->format = settings.format;
+        n->format = g_intern_string(settings.format);
 
         n->timestamp = time_monotonic_now();
 
@@ -270,17 +563,23 @@ notification *notification_create(void)
 
         n->fullscreen = FS_SHOW;
 
+        n->rate_limit = settings.rate_limit;
+        n->rate_limit_action = settings.rate_limit_action;
+
         return n;
 }
 
 /* see notification.h */
 void notification_init(notification *n)
 {
+        TRACE1(init_begin, n);
+        notification_lock();
+
         /* default to empty string to avoid further NULL faults */
-        n->appname  = n->appname  ? n->appname  : g_strdup("unknown");
+        n->appname  = n->appname  ? n->appname  : string_intern("unknown");
         n->summary  = n->summary  ? n->summary  : g_strdup("");
         n->body     = n->body     ? n->body     : g_strdup("");
-        n->category = n->category ? n->category : g_strdup("");
+        n->category = n->category ? n->category : string_intern("");
 
         /* sanitize urgency */
         if (n->urgency < URG_MIN)
@@ -288,23 +587,36 @@ void notification_init(notification *n)
         if (n->urgency > URG_MAX)
                 n->urgency = URG_CRIT;
 
+        if (n->icon && strlen(n->icon) <= 0)
+                string_intern_set(&n->icon, NULL);
+
+        /* remember the values the rules may override */
+        n->origin.urgency = n->urgency;
+        n->origin.timeout = n->timeout;
+        n->origin.transient = n->transient;
+        if (n->origin.icon != n->icon) {
+                string_intern_unref(n->origin.icon);
+                n->origin.icon = string_intern_ref(n->icon);
+        }
+        /* the color hints go straight into origin, as it owns them */
+        for (int i = 0; i < G_N_ELEMENTS(n->colors); i++)
+                n->colors[i] = n->origin.colors[i];
+
         /* Timeout processing */
         if (n->timeout < 0)
                 n->timeout = settings.timeouts[n->urgency];
 
         /* Icon handling */
-        if (n->icon && strlen(n->icon) <= 0)
-                g_clear_pointer(&n->icon, g_free);
         if (!n->raw_icon && !n->icon)
-                n->icon = g_strdup(settings.icons[n->urgency]);
+                n->icon = string_intern(settings.icons[n->urgency]);
 
         /* Color hints */
         if (!n->colors[ColFG])
-                n->colors[ColFG] = g_strdup(xctx.colors[ColFG][n->urgency]);
+                n->colors[ColFG] = xctx.colors[ColFG][n->urgency];
         if (!n->colors[ColBG])
-                n->colors[ColBG] = g_strdup(xctx.colors[ColBG][n->urgency]);
+                n->colors[ColBG] = xctx.colors[ColBG][n->urgency];
         if (!n->colors[ColFrame])
-                n->colors[ColFrame] = g_strdup(xctx.colors[ColFrame][n->urgency]);
+                n->colors[ColFrame] = xctx.colors[ColFrame][n->urgency];
 
         /* Sanitize misc hints */
         if (n->progress < 0)
@@ -313,129 +625,270 @@ void notification_init(notification *n)
         /* Process rules */
         rule_apply_all(n);
 
-        /* UPDATE derived fields */
-        notification_extract_urls(n);
+        /* UPDATE derived fields, the URLs get extracted on demand */
+        g_clear_pointer(&n->urls, g_free);
+        n->urls_extracted = false;
         notification_dmenu_string(n);
         notification_format_message(n);
+
+        n->fingerprint = notification_fingerprint(n);
+        n->generation = ++init_generation;
+
+        if (n->raw_icon && settings.icon_position != icons_off)
+                icon_prepare_raw_image(n->raw_icon);
+
+        notification_unlock();
+        TRACE1(init_end, n);
+}
+
+/**
+ * The kinds of tokens of a compiled format string
+ */
+enum format_token_type {
+        FORMAT_LITERAL,         /**< text copied verbatim */
+        FORMAT_APPNAME,         /**< %a */
+        FORMAT_SUMMARY,         /**< %s */
+        FORMAT_BODY,            /**< %b */
+        FORMAT_ICON_BASENAME,   /**< %I */
+        FORMAT_ICON,            /**< %i */
+        FORMAT_PROGRESS,        /**< %p */
+        FORMAT_PROGRESS_VALUE,  /**< %n */
+        FORMAT_TOKEN_TYPES,
+};
+
+struct format_token {
+        enum format_token_type type;
+        const char *literal; /**< only for FORMAT_LITERAL, points into format_program.text */
+        size_t len;
+};
+
+/**
+ * A format string parsed into a sequence of tokens
+ */
+struct format_program {
+        char *text;       /**< the format string with resolved escape sequences */
+        GArray *tokens;   /**< the struct format_token of the program */
+};
+
+/** maps the format strings to their compiled struct format_program */
+static GHashTable *format_programs = NULL;
+
+static void format_program_add_literal(struct format_program *prog, const char *start, size_t len)
+{
+        if (len == 0)
+                return;
+
+        struct format_token token = { FORMAT_LITERAL, start, len };
+        g_array_append_val(prog->tokens, token);
+}
+
+/**
+ * Parse the format string into a struct format_program
+ */
+static struct format_program *format_program_compile(const char *format)
+{
+        struct format_program *prog = g_malloc(sizeof(struct format_program));
+        prog->text = string_replace_all("\\n", "\n", g_strdup(format));
+        prog->tokens = g_array_new(FALSE, FALSE, sizeof(struct format_token));
+
+        const char *literal = prog->text;
+        const char *substr;
+        for (substr = strchr(literal, '%'); substr; substr = strchr(substr, '%')) {
+                struct format_token token = { FORMAT_LITERAL, NULL, 0 };
+
+                switch (substr[1]) {
+                case 'a': token.type = FORMAT_APPNAME; break;
+                case 's': token.type = FORMAT_SUMMARY; break;
+                case 'b': token.type = FORMAT_BODY; break;
+                case 'I': token.type = FORMAT_ICON_BASENAME; break;
+                case 'i': token.type = FORMAT_ICON; break;
+                case 'p': token.type = FORMAT_PROGRESS; break;
+                case 'n': token.type = FORMAT_PROGRESS_VALUE; break;
+                case '%':
+                        /* keep the second '%' as start of the next literal */
+                        format_program_add_literal(prog, literal, substr - literal);
+                        literal = substr + 1;
+                        substr += 2;
+                        continue;
+                case '\0':
+                        LOG_W("format_string has trailing %% character. "
+                              "To escape it use %%%%.");
+                        substr++;
+                        continue;
+                default:
+                        LOG_W("format_string %%%c is unknown.", substr[1]);
+                        // keep it as it is,
+                        // as we can't interpret the format string
+                        substr++;
+                        continue;
+                }
+
+                format_program_add_literal(prog, literal, substr - literal);
+                g_array_append_val(prog->tokens, token);
+                substr += 2;
+                literal = substr;
+        }
+        format_program_add_literal(prog, literal, strlen(literal));
+
+        return prog;
 }
 
-static void notification_format_message(notification *n)
+static void format_program_free(gpointer data)
+{
+        struct format_program *prog = data;
+
+        g_array_free(prog->tokens, true);
+        g_free(prog->text);
+        g_free(prog);
+}
+
+/**
+ * Get the compiled program of the format string. Every distinct format
+ * string gets compiled only once.
+ *
+ * The program stays valid until notification_format_cache_clear(), which
+ * only gets called in the main loop and with notification_lock() held.
+ */
+static const struct format_program *format_program_get(const char *format)
+{
+        notification_lock();
+
+        if (!format_programs)
+                format_programs = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                        g_free, format_program_free);
+
+        struct format_program *prog = g_hash_table_lookup(format_programs, format);
+
+        if (!prog) {
+                prog = format_program_compile(format);
+                g_hash_table_insert(format_programs, g_strdup(format), prog);
+        }
+
+        notification_unlock();
+
+        return prog;
+}
+
+/* see notification.h */
+void notification_format_cache_clear(void)
+{
+        notification_lock();
+        g_clear_pointer(&format_programs, g_hash_table_destroy);
+        notification_unlock();
+}
+
+/* see notification.h */
+void notification_format_message(notification *n)
 {
         g_clear_pointer(&n->msg, g_free);
+        g_clear_pointer(&n->text_to_render, g_free);
 
-        n->msg = string_replace_all("\\n", "\n", g_strdup(n->format));
+        notification_lock();
+        const struct format_program *prog = format_program_get(n->format);
+        notification_unlock();
 
-        /* replace all formatter */
-        for(char *substr = strchr(n->msg, '%');
-                  substr;
-                  substr = strchr(substr, '%')) {
+        /* the replacement of every placeholder, computed at most once */
+        char *fields[FORMAT_TOKEN_TYPES] = { NULL };
+        char pg[16];
 
-                char pg[16];
+        for (guint i = 0; i < prog->tokens->len; i++) {
+                const struct format_token *token = &g_array_index(prog->tokens, struct format_token, i);
                 char *icon_tmp;
 
-                switch(substr[1]) {
-                case 'a':
-                        notification_replace_single_field(
-                                &n->msg,
-                                &substr,
-                                n->appname,
-                                MARKUP_NO);
+                if (token->type == FORMAT_LITERAL || fields[token->type])
+                        continue;
+
+                switch (token->type) {
+                case FORMAT_APPNAME:
+                        fields[token->type] = markup_transform(g_strdup(n->appname), MARKUP_NO);
                         break;
-                case 's':
-                        notification_replace_single_field(
-                                &n->msg,
-                                &substr,
-                                n->summary,
-                                MARKUP_NO);
+                case FORMAT_SUMMARY:
+                        fields[token->type] = markup_transform(g_strdup(n->summary), MARKUP_NO);
                         break;
-                case 'b':
-                        notification_replace_single_field(
-                                &n->msg,
-                                &substr,
-                                n->body,
-                                n->markup);
+                case FORMAT_BODY:
+                        fields[token->type] = markup_transform(g_strdup(n->body), n->markup);
                         break;
-                case 'I':
+                case FORMAT_ICON_BASENAME:
                         icon_tmp = g_strdup(n->icon);
-                        notification_replace_single_field(
-                                &n->msg,
-                                &substr,
-                                icon_tmp ? basename(icon_tmp) : "",
-                                MARKUP_NO);
+                        fields[token->type] = markup_transform(
+                                        g_strdup(icon_tmp ? basename(icon_tmp) : ""),
+                                        MARKUP_NO);
                         g_free(icon_tmp);
                         break;
-                case 'i':
-                        notification_replace_single_field(
-                                &n->msg,
-                                &substr,
-                                n->icon ? n->icon : "",
-                                MARKUP_NO);
+                case FORMAT_ICON:
+                        fields[token->type] = markup_transform(
+                                        g_strdup(n->icon ? n->icon : ""),
+                                        MARKUP_NO);
                         break;
-                case 'p':
+                case FORMAT_PROGRESS:
                         if (n->progress != -1)
                                 sprintf(pg, "[%3d%%]", n->progress);
-
-                        notification_replace_single_field(
-                                &n->msg,
-                                &substr,
-                                n->progress != -1 ? pg : "",
-                                MARKUP_NO);
+                        fields[token->type] = g_strdup(n->progress != -1 ? pg : "");
                         break;
-                case 'n':
+                case FORMAT_PROGRESS_VALUE:
                         if (n->progress != -1)
                                 sprintf(pg, "%d", n->progress);
-
-                        notification_replace_single_field(
-                                &n->msg,
-                                &substr,
-                                n->progress != -1 ? pg : "",
-                                MARKUP_NO);
-                        break;
-                case '%':
-                        notification_replace_single_field(
-                                &n->msg,
-                                &substr,
-                                "%",
-                                MARKUP_NO);
-                        break;
-                case '\0':
-                        LOG_W("format_string has trailing %% character. "
-                              "To escape it use %%%%.");
+                        fields[token->type] = g_strdup(n->progress != -1 ? pg : "");
                         break;
                 default:
-                        LOG_W("format_string %%%c is unknown.", substr[1]);
-                        // shift substr pointer forward,
-                        // as we can't interpret the format string
-                        substr++;
                         break;
                 }
         }
 
-        n->msg = g_strchomp(n->msg);
+        size_t sizes[FORMAT_TOKEN_TYPES];
+        for (int i = 0; i < FORMAT_TOKEN_TYPES; i++)
+                sizes[i] = fields[i] ? strlen(fields[i]) : 0;
 
-        /* truncate overlong messages */
-        if (strlen(n->msg) > DUNST_NOTIF_MAX_CHARS) {
-                char *buffer = g_malloc(DUNST_NOTIF_MAX_CHARS);
-                strncpy(buffer, n->msg, DUNST_NOTIF_MAX_CHARS);
-                buffer[DUNST_NOTIF_MAX_CHARS-1] = '\0';
+        size_t len = 0;
+        for (guint i = 0; i < prog->tokens->len; i++) {
+                const struct format_token *token = &g_array_index(prog->tokens, struct format_token, i);
+                len += token->type == FORMAT_LITERAL ? token->len : sizes[token->type];
+        }
+
+        char *msg = g_malloc(len + 1);
+        char *pos = msg;
+        for (guint i = 0; i < prog->tokens->len; i++) {
+                const struct format_token *token = &g_array_index(prog->tokens, struct format_token, i);
 
-                g_free(n->msg);
-                n->msg = buffer;
+                if (token->type == FORMAT_LITERAL) {
+                        memcpy(pos, token->literal, token->len);
+                        pos += token->len;
+                } else {
+                        memcpy(pos, fields[token->type], sizes[token->type]);
+                        pos += sizes[token->type];
+                }
         }
+        *pos = '\0';
+
+        for (int i = 0; i < FORMAT_TOKEN_TYPES; i++)
+                g_free(fields[i]);
+
+        n->msg = g_strchomp(msg);
+
+        /* truncate overlong messages */
+        if (strlen(n->msg) > DUNST_NOTIF_MAX_CHARS)
+                n->msg[markup_truncate_len(n->msg, DUNST_NOTIF_MAX_CHARS - 1)] = '\0';
 }
 
-static void notification_extract_urls(notification *n)
+/* see notification.h */
+const char *notification_get_urls(notification *n)
 {
+        if (n->urls_extracted)
+                return n->urls;
+
         g_clear_pointer(&n->urls, g_free);
+        n->urls_extracted = true;
 
         char *urls_in = string_append(g_strdup(n->summary), n->body, " ");
 
         char *urls_a = NULL;
         char *urls_img = NULL;
-        markup_strip_a(&urls_in, &urls_a);
-        markup_strip_img(&urls_in, &urls_img);
-        // remove links and images first to not confuse
-        // plain urls extraction
+        /* remove links and images first to not confuse
+         * plain urls extraction, tags can only start with '<' */
+        if (strchr(urls_in, '<')) {
+                markup_strip_a(&urls_in, &urls_a);
+                markup_strip_img(&urls_in, &urls_img);
+        }
         char *urls_text = extract_urls(urls_in);
 
         n->urls = string_append(n->urls, urls_a, "\n");
@@ -446,6 +899,8 @@ static void notification_extract_urls(notification *n)
         g_free(urls_a);
         g_free(urls_img);
         g_free(urls_text);
+
+        return n->urls;
 }
 
 static void notification_dmenu_string(notification *n)
@@ -468,27 +923,24 @@ static void notification_dmenu_string(notification *n)
 
 void notification_update_text_to_render(notification *n)
 {
-        g_clear_pointer(&n->text_to_render, g_free);
+        char prefix[32] = "";
+        char age[64] = "";
 
-        char *buf = NULL;
+        /* print dup_count */
+        const char *urls = settings.show_indicators ? notification_get_urls(n) : NULL;
 
-        char *msg = g_strchomp(n->msg);
-
-        /* print dup_count and msg */
         if ((n->dup_count > 0 && !settings.hide_duplicate_count)
-            && (n->actions || n->urls) && settings.show_indicators) {
-                buf = g_strdup_printf("(%d%s%s) %s",
-                                      n->dup_count,
-                                      n->actions ? "A" : "",
-                                      n->urls ? "U" : "", msg);
-        } else if ((n->actions || n->urls) && settings.show_indicators) {
-                buf = g_strdup_printf("(%s%s) %s",
-                                      n->actions ? "A" : "",
-                                      n->urls ? "U" : "", msg);
+            && (n->actions || urls) && settings.show_indicators) {
+                snprintf(prefix, sizeof(prefix), "(%d%s%s) ",
+                         n->dup_count,
+                         n->actions ? "A" : "",
+                         urls ? "U" : "");
+        } else if ((n->actions || urls) && settings.show_indicators) {
+                snprintf(prefix, sizeof(prefix), "(%s%s) ",
+                         n->actions ? "A" : "",
+                         urls ? "U" : "");
         } else if (n->dup_count > 0 && !settings.hide_duplicate_count) {
-                buf = g_strdup_printf("(%d) %s", n->dup_count, msg);
-        } else {
-                buf = g_strdup(msg);
+                snprintf(prefix, sizeof(prefix), "(%d) ", n->dup_count);
         }
 
         /* print age */
@@ -501,24 +953,49 @@ void notification_update_text_to_render(notification *n)
                 minutes = t_delta / G_USEC_PER_SEC / 60 % 60;
                 seconds = t_delta / G_USEC_PER_SEC % 60;
 
-                char *new_buf;
                 if (hours > 0) {
-                        new_buf =
-                            g_strdup_printf("%s (%ldh %ldm %lds old)", buf, hours,
-                                            minutes, seconds);
+                        snprintf(age, sizeof(age), " (%ldh %ldm %lds old)",
+                                 hours, minutes, seconds);
                 } else if (minutes > 0) {
-                        new_buf =
-                            g_strdup_printf("%s (%ldm %lds old)", buf, minutes,
-                                            seconds);
+                        snprintf(age, sizeof(age), " (%ldm %lds old)",
+                                 minutes, seconds);
                 } else {
-                        new_buf = g_strdup_printf("%s (%lds old)", buf, seconds);
+                        snprintf(age, sizeof(age), " (%lds old)", seconds);
                 }
+        }
 
-                g_free(buf);
-                buf = new_buf;
+        size_t prefix_len = strlen(prefix);
+        size_t age_len = strlen(age);
+
+        /* The prefix and the message rarely change between two frames,
+         * so only replace the age in the tail of the existing buffer.
+         * A new message clears the buffer, so the message doesn't have
+         * to be compared again. The tail may also hold text appended
+         * by the drawing code. */
+        if (n->text_to_render
+            && n->text_prefix_len == prefix_len
+            && memcmp(n->text_to_render, prefix, prefix_len) == 0) {
+                size_t head_len = n->text_head_len;
+
+                if (strcmp(n->text_to_render + head_len, age) != 0) {
+                        n->text_to_render = g_realloc(n->text_to_render,
+                                                      head_len + age_len + 1);
+                        memcpy(n->text_to_render + head_len, age, age_len + 1);
+                }
+                return;
         }
 
-        n->text_to_render = buf;
+        char *msg = g_strchomp(n->msg);
+        size_t msg_len = strlen(msg);
+        size_t head_len = prefix_len + msg_len;
+
+        g_free(n->text_to_render);
+        n->text_to_render = g_malloc(head_len + age_len + 1);
+        memcpy(n->text_to_render, prefix, prefix_len);
+        memcpy(n->text_to_render + prefix_len, msg, msg_len);
+        memcpy(n->text_to_render + head_len, age, age_len + 1);
+        n->text_prefix_len = prefix_len;
+        n->text_head_len = head_len;
 }
 
 /* see notification.h */
@@ -537,7 +1014,7 @@ void notification_do_action(notification *n)
                 }
                 context_menu();
 
-        } else if (n->urls) {
+        } else if (notification_get_urls(n)) {
                 if (strstr(n->urls, "\n"))
                         context_menu();
                 else
@@ -2,6 +2,7 @@
 #ifndef DUNST_NOTIFICATION_H
 #define DUNST_NOTIFICATION_H
 
+#include <cairo.h>
 #include <glib.h>
 #include <stdbool.h>
 
@@ -33,7 +34,9 @@ typedef struct _raw_image {
         int has_alpha;
         int bits_per_sample;
         int n_channels;
-        unsigned char *data;
+        const unsigned char *data; /**< the pixel data, points into #data_variant */
+        GVariant *data_variant;    /**< holds the pixel data, gets released when #surface got created */
+        cairo_surface_t *surface;  /**< the scaled icon, see icon_prepare_raw_image() */
 } RawImage;
 
 typedef struct _actions {
@@ -42,17 +45,30 @@ typedef struct _actions {
         gsize count;
 } Actions;
 
+/**
+ * The fields of a notification, which the rules may change, as they were
+ * before any rule got applied. They allow to apply the rules again after
+ * the configuration got reloaded.
+ */
+struct notification_origin {
+        enum urgency urgency;
+        gint64 timeout;        /**< the requested timeout, -1 for the default */
+        bool transient;
+        const char *icon;      /**< the icon sent by the client or NULL, interned with string_intern() */
+        const char *colors[3]; /**< the color hints or NULL, interned with string_intern() */
+};
+
 typedef struct _notification {
         int id;
-        char *dbus_client;
+        const char *dbus_client; /**< interned with string_intern() */
 
-        char *appname;
+        const char *appname;     /**< interned with string_intern() */
         char *summary;
         char *body;
-        char *category;
+        const char *category;    /**< interned with string_intern() */
         enum urgency urgency;
 
-        char *icon;          /**< plain icon information (may be a path or just a name) */
+        const char *icon;    /**< plain icon information (may be a path or just a name), interned with string_intern() */
         RawImage *raw_icon;  /**< passed icon data of notification, takes precedence over icon */
 
         gint64 start;      /**< begin of current display */
@@ -64,24 +80,36 @@ typedef struct _notification {
         enum markup_mode markup;
         const char *format;
         const char *script;
-        char *colors[3];
+        const char *colors[3]; /**< borrowed from origin.colors, a rule or the defaults */
 
         /* Hints */
         bool transient;     /**< timeout albeit user is idle */
         int progress;       /**< percentage (-1: undefined) */
         int history_ignore; /**< push to history or free directly */
+        int rate_limit;     /**< notifications per second from the same client, 0 for no limit */
+        enum rate_limit_action rate_limit_action;
 
         /* internal */
         bool redisplayed;       /**< has been displayed before? */
         bool first_render;      /**< markup has been rendered before? */
         int dup_count;          /**< amount of duplicate notifications stacked onto this */
+        guint fingerprint;      /**< hash over the fields compared by notification_is_duplicate() */
+        guint generation;       /**< unique number, assigned by every notification_init() */
         int displayed_height;
+        gint64 latency_mark;    /**< the end of the last measured stage, 0 if not measured, see stats.h */
         enum behavior_fullscreen fullscreen; //!< The instruction what to do with it, when desktop enters fullscreen
+        struct notification_origin origin; /**< the values before applying the rules, set by notification_init() */
 
         /* derived fields */
         char *msg;            /**< formatted message */
-        char *text_to_render; /**< formatted message (with age and action indicators) */
-        char *urls;           /**< urllist delimited by '\\n' */
+        char *text_to_render; /**< formatted message (with age and action indicators), cleared with a new #msg */
+        size_t text_head_len; /**< length of #text_to_render without the age suffix */
+        size_t text_prefix_len; /**< length of the indicators in front of #text_to_render */
+        char *urls;           /**< urllist delimited by '\\n', see notification_get_urls() */
+        bool urls_extracted;  /**< #urls is up to date */
+
+        char *string_arena;      /**< single allocation holding the strings set by notification_set_strings() */
+        gsize string_arena_size;
 } notification;
 
 /**
@@ -94,14 +122,66 @@ typedef struct _notification {
  */
 notification *notification_create(void);
 
+/**
+ * Copy \p summary and \p body into a single allocation owned by \p n and
+ * point the corresponding fields at the copies. These fields must not be
+ * reassigned afterwards, as they don't own their memory anymore.
+ *
+ * The other strings get interned with string_intern(), so the
+ * notifications of the same client share them.
+ *
+ * All parameters except \p n may be NULL, which leaves the field unset.
+ */
+void notification_set_strings(notification *n,
+                              const char *dbus_client,
+                              const char *appname,
+                              const char *summary,
+                              const char *body,
+                              const char *category);
+
 /**
  * Sanitize values of notification, apply all matching rules
  * and generate derived fields.
  *
+ * This may get called outside of the main loop, see notification_lock().
+ *
  * @param n: the notification to sanitize
  */
 void notification_init(notification *n);
 
+/**
+ * Get the URLs found in the summary and body of \p n, delimited by '\\n'.
+ *
+ * The URLs only get extracted on the first call after the notification
+ * got initialized or expanded.
+ *
+ * @return the URLs or NULL, if there are none
+ */
+const char *notification_get_urls(notification *n);
+
+/**
+ * Reset all fields of \p n, which the rules may change, to the values
+ * recorded by notification_init() and the current defaults. Then apply
+ * the current rules and regenerate the derived fields.
+ *
+ * A raw icon, which got replaced by a rule, can't be restored.
+ *
+ * @param n: the notification, which has been initialized before
+ */
+void notification_reapply_rules(notification *n);
+
+/**
+ * Lock the settings and the rules against notification_init() running
+ * in another thread. The main loop has to hold the lock while changing
+ * them. The lock is recursive.
+ */
+void notification_lock(void);
+
+/**
+ * Release the lock taken by notification_lock().
+ */
+void notification_unlock(void);
+
 /**
  * Free the actions structure
  *
@@ -123,6 +203,30 @@ void rawimage_free(RawImage *i);
  */
 void notification_free(notification *n);
 
+/**
+ * Free all fields of \p n, which can be derived from the others, and its
+ * raw icon data to keep it in history with as little memory as possible.
+ *
+ * If the raw icon gets dropped and no icon name is set, the default icon
+ * for the urgency is used instead.
+ *
+ * @see notification_expand()
+ */
+void notification_compact(notification *n);
+
+/**
+ * Regenerate the derived fields of a notification, which got compacted
+ * with notification_compact().
+ */
+void notification_expand(notification *n);
+
+/**
+ * Estimate the memory used by a notification and all of its fields.
+ *
+ * @return the size in bytes
+ */
+size_t notification_memory_size(const notification *n);
+
 /**
  * Helper function to compare two given notifications.
  */
@@ -136,17 +240,59 @@ int notification_cmp_data(const void *va, const void *vb, void *data);
 
 int notification_is_duplicate(const notification *a, const notification *b);
 
+/**
+ * Check, if \p update only differs from \p n in its progress and arrival
+ * time, so \p n can be updated in place instead of being replaced.
+ *
+ * Both have to be initialized with notification_init(), only the values
+ * sent by the clients get compared.
+ */
+bool notification_is_update(const notification *n, const notification *update);
+
+/**
+ * Calculate a hash over all fields, which get compared by
+ * notification_is_duplicate(). Duplicates always share the same
+ * fingerprint, but notifications with the same fingerprint
+ * are not necessarily duplicates.
+ *
+ * @param n The notification to calculate the fingerprint for
+ *
+ * @return the fingerprint of `n`
+ */
+guint notification_fingerprint(const notification *n);
+
 /**
  * Run the script associated with the
  * given notification.
+ *
+ * The script is spawned asynchronously. If settings.script_concurrency
+ * scripts are already running, the run gets queued.
  */
 void notification_run_script(notification *n);
+
+/**
+ * Drop all queued script runs.
+ */
+void notification_scripts_teardown(void);
 /**
  * print a human readable representation
  * of the given notification to stdout.
  */
 void notification_print(notification *n);
 
+/**
+ * Build the message of the notification (n->msg) out of its format string
+ * and its fields. The format strings get compiled once and are reused for
+ * all notifications with the same format afterwards.
+ */
+void notification_format_message(notification *n);
+
+/**
+ * Forget the compiled format strings, e.g. after the configuration got
+ * reloaded with other format strings.
+ */
+void notification_format_cache_clear(void);
+
 /**
  * Replace the two chars where **needle points
  * with a quoted "replacement", according to the markup settings.
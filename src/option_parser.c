@@ -12,19 +12,16 @@
 #include "log.h"
 #include "utils.h"
 
-typedef struct _entry_t {
-        char *key;
-        char *value;
-} entry_t;
-
 typedef struct _section_t {
         char *name;
-        int entry_count;
-        entry_t *entries;
+        guint index;          /**< the position of the section in #sections */
+        GHashTable *entries;  /**< maps the keys to their values */
 } section_t;
 
-static int section_count = 0;
-static section_t *sections;
+/** the sections in the order they appear in the file */
+static GPtrArray *sections = NULL;
+/** maps the names of the sections to their section_t */
+static GHashTable *section_index = NULL;
 
 static section_t *new_section(const char *name);
 static section_t *get_section(const char *name);
@@ -40,44 +37,51 @@ static void cmdline_usage_append(const char *key, const char *type, const char *
 
 static int cmdline_find_option(const char *key);
 
+static void free_section(gpointer data)
+{
+        section_t *s = data;
+
+        g_hash_table_destroy(s->entries);
+        g_free(s->name);
+        g_free(s);
+}
+
 section_t *new_section(const char *name)
 {
-        for (int i = 0; i < section_count; i++) {
-                if (!strcmp(name, sections[i].name)) {
-                        DIE("Duplicated section in dunstrc detected.");
-                }
+        if (!sections) {
+                sections = g_ptr_array_new_with_free_func(free_section);
+                section_index = g_hash_table_new(g_str_hash, g_str_equal);
+        }
+
+        if (g_hash_table_contains(section_index, name)) {
+                DIE("Duplicated section in dunstrc detected.");
         }
 
-        section_count++;
-        sections = g_realloc(sections, sizeof(section_t) * section_count);
-        sections[section_count - 1].name = g_strdup(name);
-        sections[section_count - 1].entries = NULL;
-        sections[section_count - 1].entry_count = 0;
-        return &sections[section_count - 1];
+        section_t *s = g_malloc(sizeof(section_t));
+        s->name = g_strdup(name);
+        s->index = sections->len;
+        s->entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+        g_ptr_array_add(sections, s);
+        g_hash_table_insert(section_index, s->name, s);
+        return s;
 }
 
 void free_ini(void)
 {
-        for (int i = 0; i < section_count; i++) {
-                for (int j = 0; j < sections[i].entry_count; j++) {
-                        g_free(sections[i].entries[j].key);
-                        g_free(sections[i].entries[j].value);
-                }
-                g_free(sections[i].entries);
-                g_free(sections[i].name);
+        g_clear_pointer(&section_index, g_hash_table_destroy);
+        if (sections) {
+                g_ptr_array_free(sections, true);
+                sections = NULL;
         }
-        g_clear_pointer(&sections, g_free);
-        section_count = 0;
 }
 
 section_t *get_section(const char *name)
 {
-        for (int i = 0; i < section_count; i++) {
-                if (strcmp(sections[i].name, name) == 0)
-                        return &sections[i];
-        }
+        if (!section_index)
+                return NULL;
 
-        return NULL;
+        return g_hash_table_lookup(section_index, name);
 }
 
 void add_entry(const char *section_name, const char *key, const char *value)
@@ -86,11 +90,11 @@ void add_entry(const char *section_name, const char *key, const char *value)
         if (!s)
                 s = new_section(section_name);
 
-        s->entry_count++;
-        int len = s->entry_count;
-        s->entries = g_realloc(s->entries, sizeof(entry_t) * len);
-        s->entries[s->entry_count - 1].key = g_strdup(key);
-        s->entries[s->entry_count - 1].value = clean_value(value);
+        /* the first occurrence of a key takes precedence */
+        if (g_hash_table_contains(s->entries, key))
+                return;
+
+        g_hash_table_insert(s->entries, g_strdup(key), clean_value(value));
 }
 
 const char *get_value(const char *section, const char *key)
@@ -100,12 +104,7 @@ const char *get_value(const char *section, const char *key)
                 return NULL;
         }
 
-        for (int i = 0; i < s->entry_count; i++) {
-                if (strcmp(s->entries[i].key, key) == 0) {
-                        return s->entries[i].value;
-                }
-        }
-        return NULL;
+        return g_hash_table_lookup(s->entries, key);
 }
 
 char *ini_get_path(const char *section, const char *key, const char *def)
@@ -159,21 +158,17 @@ bool ini_is_set(const char *ini_section, const char *ini_key)
 
 const char *next_section(const char *section)
 {
-        if (section_count == 0)
+        if (!sections || sections->len == 0)
                 return NULL;
 
         if (!section)
-                return sections[0].name;
-
-        for (int i = 0; i < section_count; i++) {
-                if (strcmp(section, sections[i].name) == 0) {
-                        if (i + 1 >= section_count)
-                                return NULL;
-                        else
-                                return sections[i + 1].name;
-                }
-        }
-        return NULL;
+                return ((section_t *) g_ptr_array_index(sections, 0))->name;
+
+        section_t *s = get_section(section);
+        if (!s || s->index + 1 >= sections->len)
+                return NULL;
+
+        return ((section_t *) g_ptr_array_index(sections, s->index + 1))->name;
 }
 
 int ini_get_bool(const char *section, const char *key, int def)
@@ -225,6 +220,7 @@ int load_ini_file(FILE *fp)
         size_t line_len = 0;
 
         int line_num = 0;
+        int ret = 0;
         char *current_section = NULL;
         while (getline(&line, &line_len, fp) != -1) {
                 line_num++;
@@ -243,6 +239,13 @@ int load_ini_file(FILE *fp)
 
                         *end = '\0';
 
+                        if (get_section(start + 1)) {
+                                LOG_W("Invalid config file at line %d: Duplicated section '%s'.",
+                                      line_num, start + 1);
+                                ret = -1;
+                                break;
+                        }
+
                         g_free(current_section);
                         current_section = (g_strdup(start + 1));
                         new_section(current_section);
@@ -282,7 +285,7 @@ int load_ini_file(FILE *fp)
         }
         free(line);
         g_free(current_section);
-        return 0;
+        return ret;
 }
 
 void cmdline_load(int argc, char *argv[])
@@ -548,6 +551,12 @@ const char *cmdline_create_usage(void)
         return usage_str;
 }
 
+/* see option_parser.h */
+void cmdline_usage_clear(void)
+{
+        g_clear_pointer(&usage_str, g_free);
+}
+
 /* see option_parser.h */
 enum behavior_fullscreen parse_enum_fullscreen(const char *string, enum behavior_fullscreen def)
 {
@@ -8,7 +8,14 @@
 
 #include "dunst.h"
 
-int load_ini_file(FILE *);
+/**
+ * Parse the ini file \p fp into the ini store.
+ *
+ * @return 0 on success, 1 if \p fp is NULL and -1 if the file contains
+ *         the same section twice. In the latter case, the store only
+ *         contains the sections before the duplicate.
+ */
+int load_ini_file(FILE *fp);
 char *ini_get_path(const char *section, const char *key, const char *def);
 char *ini_get_string(const char *section, const char *key, const char *def);
 gint64 ini_get_time(const char *section, const char *key, gint64 def);
@@ -28,6 +35,12 @@ int cmdline_get_bool(const char *key, int def, const char *description);
 bool cmdline_is_set(const char *key);
 const char *cmdline_create_usage(void);
 
+/**
+ * Drop the usage text collected by the cmdline_get_* functions, before
+ * the options get queried again.
+ */
+void cmdline_usage_clear(void);
+
 char *option_get_string(const char *ini_section,
                         const char *ini_key,
                         const char *cmdline_key,
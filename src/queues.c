@@ -20,15 +20,65 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "draw.h"
+#include "history_log.h"
+#include "icon.h"
 #include "log.h"
 #include "notification.h"
+#include "rules.h"
 #include "settings.h"
+#include "stats.h"
+#include "trace.h"
 #include "utils.h"
 
 /* notification lists */
-static GQueue *waiting   = NULL; /**< all new notifications get into here */
-static GQueue *displayed = NULL; /**< currently displayed notifications */
-static GQueue *history   = NULL; /**< history of displayed notifications */
+static GSequence *waiting = NULL; /**< all new notifications get into here, kept sorted */
+static GQueue *displayed  = NULL; /**< currently displayed notifications */
+static GQueue *history    = NULL; /**< history of displayed notifications */
+
+/**
+ * Position of a notification inside the waiting or displayed queue.
+ *
+ * Exactly one of both members is set.
+ */
+struct queue_slot {
+        GList *link;         /**< the link of the notification inside #displayed */
+        GSequenceIter *iter; /**< the position of the notification inside #waiting */
+};
+
+/** maps the notification ids of waiting and displayed to their #queue_slot */
+static GHashTable *id_index = NULL;
+/** maps the fingerprints of waiting and displayed notifications to a GSList of them */
+static GHashTable *fingerprints = NULL;
+
+/**
+ * The kinds of deadlines of a displayed notification
+ */
+enum timer_kind {
+        TIMER_TIMEOUT, /**< the notification times out */
+        TIMER_AGE,     /**< the displayed age of the notification changes */
+        TIMER_KINDS,
+};
+
+#define TIMER_INACTIVE G_MAXUINT
+
+/**
+ * A deadline of a displayed notification
+ */
+struct queue_timer {
+        gint64 when;          /**< the time, when the timer is due */
+        notification *n;
+        enum timer_kind kind;
+        guint pos;            /**< position inside #timers or TIMER_INACTIVE */
+};
+
+/** min-heap of all active struct queue_timer, ordered by their due time */
+static GPtrArray *timers = NULL;
+/** maps the displayed notifications to an array of their TIMER_KINDS timers */
+static GHashTable *timer_index = NULL;
+
+/** the sum of notification_memory_size() of all notifications in #history */
+static size_t history_memory = 0;
 
 unsigned int displayed_limit = 0;
 int next_notification_id = 1;
@@ -41,7 +91,386 @@ void queues_init(void)
 {
         history   = g_queue_new();
         displayed = g_queue_new();
-        waiting   = g_queue_new();
+        waiting   = g_sequence_new(NULL);
+
+        id_index = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+        fingerprints = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+        timers = g_ptr_array_new();
+        timer_index = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+}
+
+static inline gint64 queues_timer_when(guint pos)
+{
+        return ((struct queue_timer *) g_ptr_array_index(timers, pos))->when;
+}
+
+static void queues_timer_swap(guint a, guint b)
+{
+        struct queue_timer *ta = g_ptr_array_index(timers, a);
+        struct queue_timer *tb = g_ptr_array_index(timers, b);
+
+        g_ptr_array_index(timers, a) = tb;
+        g_ptr_array_index(timers, b) = ta;
+        ta->pos = b;
+        tb->pos = a;
+}
+
+static void queues_timer_sift_up(guint pos)
+{
+        while (pos > 0) {
+                guint parent = (pos - 1) / 2;
+
+                if (queues_timer_when(pos) >= queues_timer_when(parent))
+                        break;
+
+                queues_timer_swap(pos, parent);
+                pos = parent;
+        }
+}
+
+static void queues_timer_sift_down(guint pos)
+{
+        for (;;) {
+                guint left = 2 * pos + 1;
+                guint right = left + 1;
+                guint min = pos;
+
+                if (left < timers->len && queues_timer_when(left) < queues_timer_when(min))
+                        min = left;
+                if (right < timers->len && queues_timer_when(right) < queues_timer_when(min))
+                        min = right;
+
+                if (min == pos)
+                        break;
+
+                queues_timer_swap(pos, min);
+                pos = min;
+        }
+}
+
+/**
+ * Remove the timer from #timers, if it's active
+ */
+static void queues_timer_unset(struct queue_timer *timer)
+{
+        if (timer->pos == TIMER_INACTIVE)
+                return;
+
+        guint pos = timer->pos;
+        guint last = timers->len - 1;
+
+        if (pos != last)
+                queues_timer_swap(pos, last);
+
+        g_ptr_array_set_size(timers, last);
+        timer->pos = TIMER_INACTIVE;
+
+        if (pos != last) {
+                queues_timer_sift_down(pos);
+                queues_timer_sift_up(pos);
+        }
+}
+
+/**
+ * Set the due time of the timer and update its position in #timers
+ *
+ * @param timer The timer to update
+ * @param when The new due time, a negative value deactivates the timer
+ */
+static void queues_timer_set(struct queue_timer *timer, gint64 when)
+{
+        if (when < 0) {
+                queues_timer_unset(timer);
+                return;
+        }
+
+        if (timer->pos == TIMER_INACTIVE) {
+                timer->when = when;
+                timer->pos = timers->len;
+                g_ptr_array_add(timers, timer);
+                queues_timer_sift_up(timer->pos);
+        } else {
+                gint64 old = timer->when;
+                timer->when = when;
+                if (when < old)
+                        queues_timer_sift_up(timer->pos);
+                else
+                        queues_timer_sift_down(timer->pos);
+        }
+}
+
+/**
+ * Calculate the next deadline of the given kind for the notification
+ *
+ * @return the time of the deadline or -1, if there is none
+ */
+static gint64 queues_timer_deadline(const notification *n, enum timer_kind kind, gint64 now)
+{
+        gint64 age;
+
+        switch (kind) {
+        case TIMER_TIMEOUT:
+                /* hidden and sticky messages don't time out */
+                if (n->start == 0 || n->timeout == 0)
+                        return -1;
+                /* the notification times out as soon as the timeout got exceeded */
+                return n->start + n->timeout + 1;
+        case TIMER_AGE:
+                if (settings.show_age_threshold < 0)
+                        return -1;
+
+                age = now - n->timestamp;
+                if (age < settings.show_age_threshold)
+                        return n->timestamp + settings.show_age_threshold;
+
+                // exactly at the next shift of the second
+                return now + G_USEC_PER_SEC - (age % G_USEC_PER_SEC);
+        default:
+                return -1;
+        }
+}
+
+/**
+ * (Re)calculate all deadlines of the displayed notification
+ */
+static void queues_timers_schedule(notification *n)
+{
+        struct queue_timer *timer = g_hash_table_lookup(timer_index, n);
+
+        if (!timer) {
+                timer = g_malloc(TIMER_KINDS * sizeof(struct queue_timer));
+                for (int kind = 0; kind < TIMER_KINDS; kind++) {
+                        timer[kind].n = n;
+                        timer[kind].kind = kind;
+                        timer[kind].pos = TIMER_INACTIVE;
+                }
+                g_hash_table_insert(timer_index, n, timer);
+        }
+
+        gint64 now = time_monotonic_now();
+        for (int kind = 0; kind < TIMER_KINDS; kind++)
+                queues_timer_set(&timer[kind], queues_timer_deadline(n, kind, now));
+}
+
+/**
+ * Remove all deadlines of the notification
+ */
+static void queues_timers_remove(notification *n)
+{
+        struct queue_timer *timer = g_hash_table_lookup(timer_index, n);
+
+        if (!timer)
+                return;
+
+        for (int kind = 0; kind < TIMER_KINDS; kind++)
+                queues_timer_unset(&timer[kind]);
+
+        g_hash_table_remove(timer_index, n);
+}
+
+/**
+ * Add the notification to the #fingerprints table
+ *
+ * @param n The notification to add
+ */
+static void queues_fingerprint_add(notification *n)
+{
+        gpointer key = GUINT_TO_POINTER(n->fingerprint);
+        GSList *bucket = g_hash_table_lookup(fingerprints, key);
+
+        g_hash_table_insert(fingerprints, key, g_slist_prepend(bucket, n));
+}
+
+/**
+ * Remove the notification from the #fingerprints table
+ *
+ * @param n The notification to remove
+ */
+static void queues_fingerprint_remove(notification *n)
+{
+        gpointer key = GUINT_TO_POINTER(n->fingerprint);
+        GSList *bucket = g_hash_table_lookup(fingerprints, key);
+
+        bucket = g_slist_remove(bucket, n);
+
+        if (bucket)
+                g_hash_table_insert(fingerprints, key, bucket);
+        else
+                g_hash_table_remove(fingerprints, key);
+}
+
+/**
+ * Get the notification at the given slot
+ *
+ * @param slot The slot to look at
+ */
+static notification *queues_slot_get(const struct queue_slot *slot)
+{
+        return slot->link ? slot->link->data : g_sequence_get(slot->iter);
+}
+
+/**
+ * Register the notification at the given position inside #id_index
+ *
+ * @param n The notification to register
+ * @param link The link holding @p n inside #displayed or NULL
+ * @param iter The position of @p n inside #waiting or NULL
+ */
+static void queues_index_set(notification *n, GList *link, GSequenceIter *iter)
+{
+        struct queue_slot *slot = g_malloc(sizeof(struct queue_slot));
+
+        slot->link = link;
+        slot->iter = iter;
+
+        g_hash_table_replace(id_index, GINT_TO_POINTER(n->id), slot);
+        queues_fingerprint_add(n);
+}
+
+/**
+ * Remove the notification from #id_index, if it's registered there
+ *
+ * @param n The notification to remove
+ */
+static void queues_index_remove(notification *n)
+{
+        struct queue_slot *slot = g_hash_table_lookup(id_index, GINT_TO_POINTER(n->id));
+
+        if (slot && queues_slot_get(slot) == n)
+                g_hash_table_remove(id_index, GINT_TO_POINTER(n->id));
+
+        queues_fingerprint_remove(n);
+}
+
+/**
+ * Insert the notification into #waiting and register it in #id_index
+ *
+ * @param n The notification to insert
+ */
+static void queues_waiting_insert(notification *n)
+{
+        GSequenceIter *iter = g_sequence_insert_sorted(waiting, n, notification_cmp_data, NULL);
+
+        queues_index_set(n, NULL, iter);
+}
+
+/**
+ * Move the notification at \p iter back into order, after it got
+ * replaced by another one.
+ *
+ * The iterator stays valid, so #id_index doesn't need an update.
+ */
+static void queues_waiting_resort(GSequenceIter *iter)
+{
+        /* unsorted, notification_cmp_data() would move it to the end */
+        if (settings.sort)
+                g_sequence_sort_changed(iter, notification_cmp_data, NULL);
+}
+
+/**
+ * Insert the notification sorted into #displayed and register it in #id_index
+ *
+ * As notifications usually get taken from #waiting in sorted order,
+ * appending to the tail gets checked first.
+ *
+ * @param n The notification to insert
+ */
+static void queues_displayed_insert(notification *n)
+{
+        GList *sibling = g_queue_peek_tail_link(displayed);
+        GList *link;
+
+        if (sibling && notification_cmp_data(sibling->data, n, NULL) < 0) {
+                sibling = NULL;
+        } else {
+                sibling = g_queue_peek_head_link(displayed);
+                while (sibling && notification_cmp_data(sibling->data, n, NULL) < 0)
+                        sibling = sibling->next;
+        }
+
+        if (sibling) {
+                g_queue_insert_before(displayed, sibling, n);
+                link = sibling->prev;
+        } else {
+                g_queue_push_tail(displayed, n);
+                link = g_queue_peek_tail_link(displayed);
+        }
+
+        queues_index_set(n, link, NULL);
+        queues_timers_schedule(n);
+        stats_stage_done(n, STATS_STAGE_WAITING);
+}
+
+/**
+ * Remove the link from #displayed and the notification from #id_index
+ *
+ * @param link The link to remove (the notification itself stays untouched)
+ */
+static void queues_displayed_delete_link(GList *link)
+{
+        queues_timers_remove(link->data);
+        queues_index_remove(link->data);
+        g_queue_delete_link(displayed, link);
+}
+
+/**
+ * Remove the position from #waiting and the notification from #id_index
+ *
+ * @param iter The position to remove (the notification itself stays untouched)
+ */
+static void queues_waiting_delete_iter(GSequenceIter *iter)
+{
+        queues_index_remove(g_sequence_get(iter));
+        g_sequence_remove(iter);
+}
+
+/**
+ * Remove the notification at the given slot from its queue and from #id_index
+ *
+ * @param slot The slot to remove. The slot gets freed, the
+ *             notification itself stays untouched.
+ *
+ * @return the removed notification
+ */
+static notification *queues_slot_delete(struct queue_slot *slot)
+{
+        notification *n = queues_slot_get(slot);
+
+        if (slot->link)
+                queues_displayed_delete_link(slot->link);
+        else
+                queues_waiting_delete_iter(slot->iter);
+
+        return n;
+}
+
+/**
+ * Replace the notification at the given slot by another one
+ *
+ * @param slot The slot to put @p n into. The slot gets freed.
+ * @param n The new notification
+ */
+static void queues_slot_swap(struct queue_slot *slot, notification *n)
+{
+        notification *old = queues_slot_get(slot);
+        GList *link = slot->link;
+        GSequenceIter *iter = slot->iter;
+
+        queues_index_remove(old);
+
+        if (link) {
+                queues_timers_remove(old);
+                link->data = n;
+        } else {
+                g_sequence_set(iter, n);
+                queues_waiting_resort(iter);
+        }
+
+        queues_index_set(n, link, iter);
+
+        if (link)
+                queues_timers_schedule(n);
 }
 
 /* see queues.h */
@@ -59,7 +488,7 @@ const GList *queues_get_displayed(void)
 /* see queues.h */
 unsigned int queues_length_waiting(void)
 {
-        return waiting->length;
+        return g_sequence_get_length(waiting);
 }
 
 /* see queues.h */
@@ -103,142 +532,154 @@ int queues_notification_insert(notification *n)
         if (n->id == 0) {
                 n->id = ++next_notification_id;
                 if (!settings.stack_duplicates || !queues_stack_duplicate(n))
-                        g_queue_insert_sorted(waiting, n, notification_cmp_data, NULL);
+                        queues_waiting_insert(n);
         } else {
                 if (!queues_notification_replace_id(n))
-                        g_queue_insert_sorted(waiting, n, notification_cmp_data, NULL);
+                        queues_waiting_insert(n);
         }
 
         if (settings.print_notifications)
                 notification_print(n);
 
+        icon_request_for_notification(n);
+
         return n->id;
 }
 
 /**
  * Replaces duplicate notification and stacks it
  *
+ * Displayed duplicates are preferred over waiting ones.
+ *
  * @return true, if notification got stacked
  * @return false, if notification did not get stacked
  */
 static bool queues_stack_duplicate(notification *n)
 {
-        for (GList *iter = g_queue_peek_head_link(displayed); iter;
+        struct queue_slot *target = NULL;
+
+        for (GSList *iter = g_hash_table_lookup(fingerprints, GUINT_TO_POINTER(n->fingerprint));
+             iter;
              iter = iter->next) {
-                notification *orig = iter->data;
-                if (notification_is_duplicate(orig, n)) {
-                        /* If the progress differs, probably notify-send was used to update the notification
-                         * So only count it as a duplicate, if the progress was not the same.
-                         * */
-                        if (orig->progress == n->progress) {
-                                orig->dup_count++;
-                        } else {
-                                orig->progress = n->progress;
-                        }
+                notification *candidate = iter->data;
+                struct queue_slot *slot = g_hash_table_lookup(id_index, GINT_TO_POINTER(candidate->id));
 
-                        iter->data = n;
+                if (!slot || queues_slot_get(slot) != candidate
+                    || !notification_is_duplicate(candidate, n))
+                        continue;
 
-                        n->start = time_monotonic_now();
+                target = slot;
+                if (slot->link)
+                        break;
+        }
 
-                        n->dup_count = orig->dup_count;
+        if (!target)
+                return false;
 
-                        signal_notification_closed(orig, 1);
+        bool is_displayed = target->link != NULL;
+        notification *orig = queues_slot_get(target);
 
-                        notification_free(orig);
-                        return true;
-                }
+        /* If the progress differs, probably notify-send was used to update the notification
+         * So only count it as a duplicate, if the progress was not the same.
+         * */
+        if (orig->progress == n->progress) {
+                orig->dup_count++;
+        } else {
+                orig->progress = n->progress;
         }
 
-        for (GList *iter = g_queue_peek_head_link(waiting); iter;
-             iter = iter->next) {
-                notification *orig = iter->data;
-                if (notification_is_duplicate(orig, n)) {
-                        /* If the progress differs, probably notify-send was used to update the notification
-                         * So only count it as a duplicate, if the progress was not the same.
-                         * */
-                        if (orig->progress == n->progress) {
-                                orig->dup_count++;
-                        } else {
-                                orig->progress = n->progress;
-                        }
-                        iter->data = n;
+        if (is_displayed)
+                n->start = time_monotonic_now();
 
-                        n->dup_count = orig->dup_count;
+        queues_slot_swap(target, n);
 
-                        signal_notification_closed(orig, 1);
+        n->dup_count = orig->dup_count;
 
-                        notification_free(orig);
-                        return true;
-                }
-        }
+        signal_notification_closed(orig, 1);
 
-        return false;
+        notification_free(orig);
+        return true;
 }
 
 /* see queues.h */
 bool queues_notification_replace_id(notification *new)
 {
+        struct queue_slot *slot = g_hash_table_lookup(id_index, GINT_TO_POINTER(new->id));
 
-        for (GList *iter = g_queue_peek_head_link(displayed);
-                    iter;
-                    iter = iter->next) {
-                notification *old = iter->data;
-                if (old->id == new->id) {
-                        iter->data = new;
-                        new->start = time_monotonic_now();
-                        new->dup_count = old->dup_count;
-                        notification_run_script(new);
-                        notification_free(old);
-                        return true;
-                }
+        if (!slot)
+                return false;
+
+        notification *old = queues_slot_get(slot);
+
+        /* both share the same id, so the id index stays valid */
+        queues_fingerprint_remove(old);
+        if (slot->link) {
+                queues_timers_remove(old);
+                slot->link->data = new;
+        } else {
+                g_sequence_set(slot->iter, new);
+                queues_waiting_resort(slot->iter);
         }
+        queues_fingerprint_add(new);
+        new->dup_count = old->dup_count;
 
-        for (GList *iter = g_queue_peek_head_link(waiting);
-                    iter;
-                    iter = iter->next) {
-                notification *old = iter->data;
-                if (old->id == new->id) {
-                        iter->data = new;
-                        new->dup_count = old->dup_count;
-                        notification_free(old);
-                        return true;
-                }
+        if (slot->link) {
+                new->start = time_monotonic_now();
+                queues_timers_schedule(new);
+                notification_run_script(new);
         }
-        return false;
+
+        draw_forget_notification(new->id);
+        notification_free(old);
+        return true;
 }
 
 /* see queues.h */
-void queues_notification_close_id(int id, enum reason reason)
+bool queues_notification_update(const notification *update)
 {
-        notification *target = NULL;
+        struct queue_slot *slot = g_hash_table_lookup(id_index, GINT_TO_POINTER(update->id));
 
-        for (GList *iter = g_queue_peek_head_link(displayed); iter;
-             iter = iter->next) {
-                notification *n = iter->data;
-                if (n->id == id) {
-                        g_queue_remove(displayed, n);
-                        target = n;
-                        break;
-                }
-        }
+        if (!slot)
+                return false;
 
-        for (GList *iter = g_queue_peek_head_link(waiting); iter;
-             iter = iter->next) {
-                notification *n = iter->data;
-                if (n->id == id) {
-                        assert(target == NULL);
-                        g_queue_remove(waiting, n);
-                        target = n;
-                        break;
-                }
+        notification *n = queues_slot_get(slot);
+
+        if (!notification_is_update(n, update))
+                return false;
+
+        int progress = update->progress < 0 ? -1 : update->progress;
+
+        n->timestamp = update->timestamp;
+        if (n->progress != progress) {
+                n->progress = progress;
+                notification_format_message(n);
         }
 
-        if (target) {
-                //Don't notify clients if notification was pulled from history
-                if (!target->redisplayed)
-                        signal_notification_closed(target, reason);
-                queues_history_push(target);
+        if (slot->link) {
+                n->start = time_monotonic_now();
+                queues_timers_schedule(n);
         }
+
+        if (settings.print_notifications)
+                notification_print(n);
+
+        return true;
+}
+
+/* see queues.h */
+void queues_notification_close_id(int id, enum reason reason)
+{
+        struct queue_slot *slot = g_hash_table_lookup(id_index, GINT_TO_POINTER(id));
+
+        if (!slot)
+                return;
+
+        notification *target = queues_slot_delete(slot);
+
+        //Don't notify clients if notification was pulled from history
+        if (!target->redisplayed)
+                signal_notification_closed(target, reason);
+        queues_history_push(target);
 }
 
 /* see queues.h */
@@ -251,26 +692,52 @@ void queues_notification_close(notification *n, enum reason reason)
 /* see queues.h */
 void queues_history_pop(void)
 {
-        if (g_queue_is_empty(history))
-                return;
+        notification *n;
+        if (!g_queue_is_empty(history)) {
+                n = g_queue_pop_tail(history);
+                history_memory -= notification_memory_size(n);
+                notification_expand(n);
+                history_log_pop(false);
+        } else {
+                /* page in older notifications from the log */
+                n = history_log_pop(true);
+                if (!n)
+                        return;
+                n->id = ++next_notification_id;
+        }
 
-        notification *n = g_queue_pop_tail(history);
         n->redisplayed = true;
         n->start = 0;
         n->timeout = settings.sticky_history ? 0 : n->timeout;
-        g_queue_push_head(waiting, n);
+
+        /* The user asked for it, so it gets displayed next, even ahead of
+         * more urgent waiting ones or with sorting turned off. Only the
+         * head of #waiting is out of order then, the sorted insertions
+         * still keep the rest of it in order. */
+        queues_index_set(n, NULL, g_sequence_prepend(waiting, n));
 }
 
 /* see queues.h */
 void queues_history_push(notification *n)
 {
         if (!n->history_ignore) {
-                if (settings.history_length > 0 && history->length >= settings.history_length) {
+                notification_compact(n);
+                size_t size = notification_memory_size(n);
+                size_t max_memory = (size_t) settings.history_max_memory * 1024;
+
+                while (!g_queue_is_empty(history)
+                       && (   (settings.history_length > 0
+                               && history->length >= settings.history_length)
+                           || (max_memory > 0
+                               && history_memory + size > max_memory))) {
                         notification *to_free = g_queue_pop_head(history);
+                        history_memory -= notification_memory_size(to_free);
                         notification_free(to_free);
                 }
 
                 g_queue_push_tail(history, n);
+                history_memory += size;
+                history_log_push(n);
         } else {
                 notification_free(n);
         }
@@ -279,60 +746,64 @@ void queues_history_push(notification *n)
 /* see queues.h */
 void queues_history_push_all(void)
 {
+        signal_batch_begin();
+
         while (displayed->length > 0) {
                 queues_notification_close(g_queue_peek_head_link(displayed)->data, REASON_USER);
         }
 
-        while (waiting->length > 0) {
-                queues_notification_close(g_queue_peek_head_link(waiting)->data, REASON_USER);
+        while (!g_sequence_is_empty(waiting)) {
+                queues_notification_close(g_sequence_get(g_sequence_get_begin_iter(waiting)), REASON_USER);
         }
+
+        signal_batch_end();
 }
 
 /* see queues.h */
 void queues_check_timeouts(bool idle, bool fullscreen)
 {
-        /* nothing to do */
-        if (displayed->length == 0)
-                return;
-
         bool is_idle = fullscreen ? false : idle;
+        gint64 now = time_monotonic_now();
 
-        GList *iter = g_queue_peek_head_link(displayed);
-        while (iter) {
-                notification *n = iter->data;
+        /* notifications expiring at once get announced in one batch */
+        signal_batch_begin();
 
-                /*
-                 * Update iter to the next item before we either exit the
-                 * current iteration of the loop or potentially delete the
-                 * notification which would invalidate the pointer.
-                 */
-                iter = iter->next;
+        /* only handle the timers, which are due */
+        while (timers->len > 0) {
+                struct queue_timer *timer = g_ptr_array_index(timers, 0);
+                notification *n = timer->n;
 
-                /* don't timeout when user is idle */
-                if (is_idle && !n->transient) {
-                        n->start = time_monotonic_now();
+                if (timer->when > now)
+                        break;
+
+                if (timer->kind == TIMER_AGE) {
+                        queues_timer_set(timer, queues_timer_deadline(n, TIMER_AGE, now));
                         continue;
                 }
 
-                /* skip hidden and sticky messages */
-                if (n->start == 0 || n->timeout == 0) {
+                /* don't timeout when user is idle */
+                if (is_idle && !n->transient) {
+                        n->start = now;
+                        queues_timer_set(timer, queues_timer_deadline(n, TIMER_TIMEOUT, now));
                         continue;
                 }
 
-                /* remove old message */
-                if (time_monotonic_now() - n->start > n->timeout) {
-                        queues_notification_close(n, REASON_TIME);
-                }
+                queues_notification_close(n, REASON_TIME);
         }
+
+        signal_batch_end();
 }
 
-/* see queues.h */
-void queues_update(bool fullscreen)
+/**
+ * The body of queues_update(), so the tracepoints cover all its returns
+ */
+static void queues_update_displayed(bool fullscreen)
 {
         if (pause_displayed) {
                 while (displayed->length > 0) {
-                        g_queue_insert_sorted(
-                            waiting, g_queue_pop_head(displayed), notification_cmp_data, NULL);
+                        notification *n = g_queue_peek_head(displayed);
+                        queues_displayed_delete_link(g_queue_peek_head_link(displayed));
+                        queues_waiting_insert(n);
                 }
                 return;
         }
@@ -345,19 +816,19 @@ void queues_update(bool fullscreen)
                         GList *nextiter = iter->next;
 
                         if (n->fullscreen == FS_PUSHBACK){
-                                g_queue_delete_link(displayed, iter);
-                                g_queue_insert_sorted(waiting, n, notification_cmp_data, NULL);
+                                queues_displayed_delete_link(iter);
+                                queues_waiting_insert(n);
                         }
 
                         iter = nextiter;
                 }
         }
 
-        /* move notifications from queue to displayed */
-        GList *iter = g_queue_peek_head_link(waiting);
-        while (iter) {
-                notification *n = iter->data;
-                GList *nextiter = iter->next;
+        /* move notifications from queue to displayed, highest priority first */
+        GSequenceIter *iter = g_sequence_get_begin_iter(waiting);
+        while (!g_sequence_iter_is_end(iter)) {
+                notification *n = g_sequence_get(iter);
+                GSequenceIter *nextiter = g_sequence_iter_next(iter);
 
                 if (displayed_limit > 0 && displayed->length >= displayed_limit) {
                         /* the list is full */
@@ -379,43 +850,96 @@ void queues_update(bool fullscreen)
                         notification_run_script(n);
                 }
 
-                g_queue_delete_link(waiting, iter);
-                g_queue_insert_sorted(displayed, n, notification_cmp_data, NULL);
+                queues_waiting_delete_iter(iter);
+                queues_displayed_insert(n);
 
                 iter = nextiter;
         }
 }
 
+/* see queues.h */
+void queues_update(bool fullscreen)
+{
+        TRACE(queues_update_begin);
+        queues_update_displayed(fullscreen);
+        TRACE1(queues_update_end, displayed->length);
+}
+
 /* see queues.h */
 gint64 queues_get_next_datachange(gint64 time)
 {
-        gint64 sleep = G_MAXINT64;
+        if (timers->len == 0)
+                return -1;
 
-        for (GList *iter = g_queue_peek_head_link(displayed); iter;
-                        iter = iter->next) {
+        gint64 when = queues_timer_when(0);
+
+        // while we're processing, the next timer may be already due
+        return when > time ? when - time : 0;
+}
+
+/**
+ * Check if any rule of \p changed matches \p n, either with the values
+ * the rules produced or with the values sent by the client.
+ */
+static bool queues_rules_match(const GSList *changed, notification *n)
+{
+        notification orig = *n;
+
+        orig.urgency = n->origin.urgency;
+        orig.transient = n->origin.transient;
+        orig.icon = n->origin.icon;
+        if (!orig.icon && !orig.raw_icon)
+                orig.icon = settings.icons[orig.urgency];
+
+        for (const GSList *iter = changed; iter; iter = iter->next) {
+                if (rule_matches_notification(iter->data, n)
+                    || rule_matches_notification(iter->data, &orig))
+                        return true;
+        }
+
+        return false;
+}
+
+/* see queues.h */
+void queues_reapply_rules(const GSList *changed, bool all)
+{
+        GSList *affected = NULL;
+
+        for (GSequenceIter *iter = g_sequence_get_begin_iter(waiting);
+             !g_sequence_iter_is_end(iter);
+             iter = g_sequence_iter_next(iter)) {
+                notification *n = g_sequence_get(iter);
+                if (all || queues_rules_match(changed, n))
+                        affected = g_slist_prepend(affected, n);
+        }
+
+        for (GList *iter = g_queue_peek_head_link(displayed); iter; iter = iter->next) {
                 notification *n = iter->data;
-                gint64 ttl = n->timeout - (time - n->start);
-
-                if (n->timeout > 0) {
-                        if (ttl > 0)
-                                sleep = MIN(sleep, ttl);
-                        else
-                                // while we're processing, the notification already timed out
-                                return 0;
-                }
+                if (all || queues_rules_match(changed, n))
+                        affected = g_slist_prepend(affected, n);
+                else
+                        queues_timers_schedule(n);
+        }
+
+        /* The rules may change the fingerprint or the position inside
+         * the queue, so the notification has to be inserted again. */
+        for (GSList *iter = affected; iter; iter = iter->next) {
+                notification *n = iter->data;
+                struct queue_slot *slot = g_hash_table_lookup(id_index, GINT_TO_POINTER(n->id));
+                bool was_displayed = slot->link != NULL;
 
-                if (settings.show_age_threshold >= 0) {
-                        gint64 age = time - n->timestamp;
+                queues_slot_delete(slot);
+                notification_reapply_rules(n);
+                icon_request_for_notification(n);
 
-                        if (age > settings.show_age_threshold)
-                                // sleep exactly until the next shift of the second happens
-                                sleep = MIN(sleep, ((G_USEC_PER_SEC) - (age % (G_USEC_PER_SEC))));
-                        else if (n->timeout == 0 || ttl > settings.show_age_threshold)
-                                sleep = MIN(sleep, settings.show_age_threshold);
-                }
+                if (was_displayed)
+                        queues_displayed_insert(n);
+                else
+                        queues_waiting_insert(n);
         }
 
-        return sleep != G_MAXINT64 ? sleep : -1;
+        LOG_D("Reapplied the rules to %u notifications", g_slist_length(affected));
+        g_slist_free(affected);
 }
 
 /* see queues.h */
@@ -451,7 +975,25 @@ static void teardown_notification(gpointer data)
 void teardown_queues(void)
 {
         g_queue_free_full(history, teardown_notification);
+        history_memory = 0;
         g_queue_free_full(displayed, teardown_notification);
-        g_queue_free_full(waiting, teardown_notification);
+        for (GSequenceIter *iter = g_sequence_get_begin_iter(waiting);
+             !g_sequence_iter_is_end(iter);
+             iter = g_sequence_iter_next(iter))
+                teardown_notification(g_sequence_get(iter));
+        g_sequence_free(waiting);
+
+        g_clear_pointer(&id_index, g_hash_table_destroy);
+
+        GHashTableIter iter;
+        gpointer bucket;
+        g_hash_table_iter_init(&iter, fingerprints);
+        while (g_hash_table_iter_next(&iter, NULL, &bucket))
+                g_slist_free(bucket);
+        g_clear_pointer(&fingerprints, g_hash_table_destroy);
+
+        g_clear_pointer(&timer_index, g_hash_table_destroy);
+        g_ptr_array_free(timers, TRUE);
+        timers = NULL;
 }
 /* vim: set tabstop=8 shiftwidth=8 expandtab textwidth=0: */
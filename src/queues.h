@@ -78,6 +78,21 @@ int queues_notification_insert(notification *n);
  */
 bool queues_notification_replace_id(notification *new);
 
+/**
+ * Apply an update of the progress to the notification with the same id,
+ * without replacing it.
+ *
+ * This skips the rules and the script of the notification, so it only
+ * succeeds, if notification_is_update() is true for both.
+ *
+ * @param update the initialized notification received from the client.
+ *               It isn't taken over.
+ *
+ * @return true, if a matching notification has been found and updated
+ * @return false, else
+ */
+bool queues_notification_update(const notification *update);
+
 /**
  * Close the notification that has n->id == id
  *
@@ -119,7 +134,8 @@ void queues_history_push(notification *n);
 void queues_history_push_all(void);
 
 /**
- * Check timeout of each notification and close it, if necessary
+ * Check the due timers of the displayed notifications and close the
+ * notifications, which timed out
  *
  * @param idle the program's idle status. Important to calculate the
  *             timeout for transient notifications
@@ -177,6 +193,17 @@ void queues_pause_off(void);
  */
 bool queues_pause_status(void);
 
+/**
+ * Apply the rules again to the waiting and displayed notifications after
+ * the configuration got reloaded. The deadlines of all displayed
+ * notifications get recalculated.
+ *
+ * @param changed the rules, which got added, removed or changed
+ * @param all if true, the rules get applied to every notification, e.g.
+ *            because the defaults for the notifications changed
+ */
+void queues_reapply_rules(const GSList *changed, bool all);
+
 /**
  * Remove all notifications from all list and free the notifications
  *
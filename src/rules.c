@@ -4,8 +4,58 @@
 
 #include <fnmatch.h>
 #include <glib.h>
+#include <string.h>
 
 #include "dunst.h"
+#include "trace.h"
+#include "utils.h"
+
+/**
+ * The way a rule filters the appname
+ */
+enum appname_filter {
+        APPNAME_ANY,     /**< the rule doesn't filter by appname */
+        APPNAME_LITERAL, /**< the appname has to be equal to the pattern */
+        APPNAME_PREFIX,  /**< the pattern is a literal prefix followed by '*' */
+        APPNAME_GLOB,    /**< the pattern has to be matched with fnmatch() */
+};
+
+/**
+ * The interned fields of a notification, whose matches get memoized
+ */
+enum memo_field {
+        MEMO_APPNAME,
+        MEMO_ICON,
+        MEMO_CATEGORY,
+        MEMO_FIELDS,
+};
+
+/** the number of strings per field, whose matches get memoized at most */
+#define RULES_MEMO_SIZE 1024
+
+/**
+ * A node of the prefix trie for the APPNAME_PREFIX rules
+ */
+struct rule_trie {
+        GHashTable *children; /**< maps the next character to the child node */
+        GSList *rules;        /**< indices of the rules, whose prefix ends here */
+};
+
+/** The precompiled rules, see rules_compile() */
+static struct {
+        bool compiled;
+        guint length;
+        rule_t **rules;                /**< all rules in order of application */
+        enum appname_filter *filter;   /**< the appname filter of each rule */
+        bool *candidate;               /**< scratch space for rule_apply_all() */
+        GHashTable *literal;           /**< maps literal appnames to a GSList of rule indices */
+        struct rule_trie *prefix;      /**< the prefix trie for the APPNAME_PREFIX rules */
+        /** per field, maps the interned strings to the match results of
+         * each rule: -1 if not matched yet, 0 or 1 otherwise */
+        GHashTable *memo[MEMO_FIELDS];
+} matcher = { 0 };
+
+static bool rule_matches_filters(rule_t *r, int index, notification *n);
 
 /*
  * Apply rule to notification.
@@ -20,44 +70,238 @@ void rule_apply(rule_t *r, notification *n)
                 n->fullscreen = r->fullscreen;
         if (r->history_ignore != -1)
                 n->history_ignore = r->history_ignore;
+        if (r->rate_limit != -1)
+                n->rate_limit = r->rate_limit;
+        if (r->rate_limit_action != RATE_LIMIT_NULL)
+                n->rate_limit_action = r->rate_limit_action;
         if (r->set_transient != -1)
                 n->transient = r->set_transient;
         if (r->markup != MARKUP_NULL)
                 n->markup = r->markup;
         if (r->new_icon) {
-                g_free(n->icon);
-                n->icon = g_strdup(r->new_icon);
+                string_intern_set(&n->icon, r->new_icon);
                 g_clear_pointer(&n->raw_icon, rawimage_free);
         }
-        if (r->fg) {
-                g_free(n->colors[ColFG]);
-                n->colors[ColFG] = g_strdup(r->fg);
+        if (r->fg)
+                n->colors[ColFG] = g_intern_string(r->fg);
+        if (r->bg)
+                n->colors[ColBG] = g_intern_string(r->bg);
+        if (r->fc)
+                n->colors[ColFrame] = g_intern_string(r->fc);
+        if (r->format)
+                n->format = g_intern_string(r->format);
+        if (r->script)
+                n->script = g_intern_string(r->script);
+}
+
+static enum appname_filter rule_get_appname_filter(const char *pattern)
+{
+        if (!pattern)
+                return APPNAME_ANY;
+
+        size_t special = strcspn(pattern, "*?[\\");
+
+        if (pattern[special] == '\0')
+                return APPNAME_LITERAL;
+        if (pattern[special] == '*' && pattern[special + 1] == '\0')
+                return APPNAME_PREFIX;
+
+        return APPNAME_GLOB;
+}
+
+static void rule_trie_free(gpointer data)
+{
+        struct rule_trie *node = data;
+
+        if (!node)
+                return;
+
+        if (node->children)
+                g_hash_table_destroy(node->children);
+        g_slist_free(node->rules);
+        g_free(node);
+}
+
+static void rule_trie_insert(struct rule_trie *node, const char *prefix, size_t len, guint index)
+{
+        for (size_t i = 0; i < len; i++) {
+                gpointer key = GUINT_TO_POINTER((guchar) prefix[i]);
+                struct rule_trie *child;
+
+                if (!node->children)
+                        node->children = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                                               NULL, rule_trie_free);
+
+                child = g_hash_table_lookup(node->children, key);
+                if (!child) {
+                        child = g_malloc0(sizeof(struct rule_trie));
+                        g_hash_table_insert(node->children, key, child);
+                }
+
+                node = child;
         }
-        if (r->bg) {
-                g_free(n->colors[ColBG]);
-                n->colors[ColBG] = g_strdup(r->bg);
+
+        node->rules = g_slist_prepend(node->rules, GUINT_TO_POINTER(index));
+}
+
+/**
+ * Mark all rules as candidates, which got registered along the path of str
+ */
+static void rule_trie_mark(const struct rule_trie *node, const char *str, bool *candidate)
+{
+        while (node) {
+                for (GSList *iter = node->rules; iter; iter = iter->next)
+                        candidate[GPOINTER_TO_UINT(iter->data)] = true;
+
+                if (*str == '\0' || !node->children)
+                        break;
+
+                node = g_hash_table_lookup(node->children, GUINT_TO_POINTER((guchar) *str));
+                str++;
         }
-        if (r->fc) {
-                g_free(n->colors[ColFrame]);
-                n->colors[ColFrame] = g_strdup(r->fc);
+}
+
+static void rules_free_compiled(void)
+{
+        g_free(matcher.rules);
+        g_free(matcher.filter);
+        g_free(matcher.candidate);
+
+        if (matcher.literal) {
+                GHashTableIter iter;
+                gpointer indices;
+                g_hash_table_iter_init(&iter, matcher.literal);
+                while (g_hash_table_iter_next(&iter, NULL, &indices))
+                        g_slist_free(indices);
+                g_hash_table_destroy(matcher.literal);
         }
-        if (r->format)
-                n->format = r->format;
-        if (r->script)
-                n->script = r->script;
+
+        rule_trie_free(matcher.prefix);
+
+        for (int f = 0; f < MEMO_FIELDS; f++)
+                if (matcher.memo[f])
+                        g_hash_table_destroy(matcher.memo[f]);
+
+        memset(&matcher, 0, sizeof(matcher));
+}
+
+/*
+ * Precompile the appname filters of all rules.
+ */
+void rules_compile(void)
+{
+        rules_free_compiled();
+
+        matcher.length = g_slist_length(rules);
+        matcher.rules = g_malloc(matcher.length * sizeof(rule_t *));
+        matcher.filter = g_malloc(matcher.length * sizeof(enum appname_filter));
+        matcher.candidate = g_malloc(matcher.length * sizeof(bool));
+        matcher.literal = g_hash_table_new(g_str_hash, g_str_equal);
+        matcher.prefix = g_malloc0(sizeof(struct rule_trie));
+
+        /* the keys are interned and the memo holds a reference on them, so
+         * the same address can't be reused by another string meanwhile */
+        for (int f = 0; f < MEMO_FIELDS; f++)
+                matcher.memo[f] = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                                        (GDestroyNotify) string_intern_unref,
+                                                        g_free);
+
+        guint i = 0;
+        for (GSList *iter = rules; iter; iter = iter->next, i++) {
+                rule_t *r = iter->data;
+
+                matcher.rules[i] = r;
+                matcher.filter[i] = rule_get_appname_filter(r->appname);
+
+                if (matcher.filter[i] == APPNAME_LITERAL) {
+                        GSList *indices = g_hash_table_lookup(matcher.literal, r->appname);
+                        indices = g_slist_prepend(indices, GUINT_TO_POINTER(i));
+                        g_hash_table_insert(matcher.literal, r->appname, indices);
+                } else if (matcher.filter[i] == APPNAME_PREFIX) {
+                        rule_trie_insert(matcher.prefix, r->appname, strlen(r->appname) - 1, i);
+                }
+        }
+
+        matcher.compiled = true;
+}
+
+/**
+ * Match \p str against the filter \p pattern of the rule at \p index.
+ *
+ * The result gets memoized for the interned \p str, so the next
+ * notification of the same client doesn't need to call fnmatch() again.
+ * Without an index (-1), fnmatch() gets called directly.
+ */
+static bool rule_field_matches(enum memo_field field, int index,
+                               const char *pattern, const char *str)
+{
+        if (!pattern)
+                return true;
+        if (!str)
+                return false;
+        if (index < 0)
+                return !fnmatch(pattern, str, 0);
+
+        GHashTable *memo = matcher.memo[field];
+        gint8 *results = g_hash_table_lookup(memo, str);
+
+        if (!results) {
+                /* forget everything instead of tracking the usage,
+                 * the common clients are back again soon */
+                if (g_hash_table_size(memo) >= RULES_MEMO_SIZE)
+                        g_hash_table_remove_all(memo);
+
+                results = g_malloc(matcher.length);
+                memset(results, -1, matcher.length);
+                g_hash_table_insert(memo, (gpointer) string_intern_ref(str), results);
+        }
+
+        if (results[index] < 0)
+                results[index] = !fnmatch(pattern, str, 0);
+
+        return results[index];
 }
 
 /*
  * Check all rules if they match n and apply.
+ *
+ * Only the rules matching the appname of n get checked further,
+ * but still in the order they got defined.
  */
 void rule_apply_all(notification *n)
 {
-        for (GSList *iter = rules; iter; iter = iter->next) {
-                rule_t *r = iter->data;
-                if (rule_matches_notification(r, n)) {
+        if (!matcher.compiled)
+                rules_compile();
+
+        TRACE1(rules_begin, n);
+
+        for (guint i = 0; i < matcher.length; i++)
+                matcher.candidate[i] = matcher.filter[i] == APPNAME_ANY
+                                    || matcher.filter[i] == APPNAME_GLOB;
+
+        if (n->appname) {
+                GSList *indices = g_hash_table_lookup(matcher.literal, n->appname);
+                for (GSList *iter = indices; iter; iter = iter->next)
+                        matcher.candidate[GPOINTER_TO_UINT(iter->data)] = true;
+
+                rule_trie_mark(matcher.prefix, n->appname, matcher.candidate);
+        }
+
+        for (guint i = 0; i < matcher.length; i++) {
+                rule_t *r = matcher.rules[i];
+
+                if (!matcher.candidate[i])
+                        continue;
+
+                if (matcher.filter[i] == APPNAME_GLOB
+                    && !rule_field_matches(MEMO_APPNAME, i, r->appname, n->appname))
+                        continue;
+
+                if (rule_matches_filters(r, i, n))
                         rule_apply(r, n);
-                }
         }
+
+        TRACE1(rules_end, n);
 }
 
 /*
@@ -84,6 +328,105 @@ void rule_init(rule_t *r)
         r->bg = NULL;
         r->fc = NULL;
         r->format = NULL;
+        r->script = NULL;
+        r->rate_limit = -1;
+        r->rate_limit_action = RATE_LIMIT_NULL;
+}
+
+/* see rules.h */
+rule_t *rule_dup(const rule_t *r)
+{
+        rule_t *dup = g_memdup(r, sizeof(rule_t));
+
+        dup->name = g_strdup(r->name);
+        dup->appname = g_strdup(r->appname);
+        dup->summary = g_strdup(r->summary);
+        dup->body = g_strdup(r->body);
+        dup->icon = g_strdup(r->icon);
+        dup->category = g_strdup(r->category);
+        dup->new_icon = g_strdup(r->new_icon);
+        dup->fg = g_strdup(r->fg);
+        dup->bg = g_strdup(r->bg);
+        dup->fc = g_strdup(r->fc);
+        dup->format = g_strdup(r->format);
+        dup->script = g_strdup(r->script);
+
+        return dup;
+}
+
+/* see rules.h */
+void rule_free(rule_t *r)
+{
+        if (!r)
+                return;
+
+        g_free(r->name);
+        g_free(r->appname);
+        g_free(r->summary);
+        g_free(r->body);
+        g_free(r->icon);
+        g_free(r->category);
+        g_free(r->new_icon);
+        g_free(r->fg);
+        g_free(r->bg);
+        g_free(r->fc);
+        g_free((char *) r->format);
+        g_free((char *) r->script);
+        g_free(r);
+}
+
+/* see rules.h */
+bool rule_equal(const rule_t *a, const rule_t *b)
+{
+        return g_strcmp0(a->name, b->name) == 0
+            && g_strcmp0(a->appname, b->appname) == 0
+            && g_strcmp0(a->summary, b->summary) == 0
+            && g_strcmp0(a->body, b->body) == 0
+            && g_strcmp0(a->icon, b->icon) == 0
+            && g_strcmp0(a->category, b->category) == 0
+            && a->msg_urgency == b->msg_urgency
+            && a->timeout == b->timeout
+            && a->urgency == b->urgency
+            && a->markup == b->markup
+            && a->history_ignore == b->history_ignore
+            && a->match_transient == b->match_transient
+            && a->set_transient == b->set_transient
+            && g_strcmp0(a->new_icon, b->new_icon) == 0
+            && g_strcmp0(a->fg, b->fg) == 0
+            && g_strcmp0(a->bg, b->bg) == 0
+            && g_strcmp0(a->fc, b->fc) == 0
+            && g_strcmp0(a->format, b->format) == 0
+            && g_strcmp0(a->script, b->script) == 0
+            && a->fullscreen == b->fullscreen
+            && a->rate_limit == b->rate_limit
+            && a->rate_limit_action == b->rate_limit_action;
+}
+
+/* see rules.h */
+GSList *rules_diff(GSList *old, GSList *new)
+{
+        GSList *changed = NULL;
+        GSList *o = old, *n = new;
+
+        /* Later rules override earlier ones, so a rule only stays the
+         * same, if it kept its position. Unnamed rules can't be told
+         * apart and always count as changed. */
+        for (; o && n; o = o->next, n = n->next) {
+                rule_t *prev = o->data;
+                rule_t *r = n->data;
+
+                if (!r->name || !rule_equal(prev, r)) {
+                        changed = g_slist_prepend(changed, prev);
+                        changed = g_slist_prepend(changed, r);
+                }
+        }
+
+        for (; o; o = o->next)
+                changed = g_slist_prepend(changed, o->data);
+        for (; n; n = n->next)
+                changed = g_slist_prepend(changed, n->data);
+
+        return changed;
 }
 
 /*
@@ -91,11 +434,22 @@ void rule_init(rule_t *r)
  */
 bool rule_matches_notification(rule_t *r, notification *n)
 {
-        return   ( (!r->appname  || (n->appname  && !fnmatch(r->appname,  n->appname, 0)))
-                && (!r->summary  || (n->summary  && !fnmatch(r->summary,  n->summary, 0)))
+        return rule_field_matches(MEMO_APPNAME, -1, r->appname, n->appname)
+               && rule_matches_filters(r, -1, n);
+}
+
+/*
+ * Check all filters of the rule besides the appname.
+ *
+ * With the index of the rule in the compiled matcher, the matches of
+ * the interned fields get memoized.
+ */
+static bool rule_matches_filters(rule_t *r, int index, notification *n)
+{
+        return   ( (!r->summary  || (n->summary  && !fnmatch(r->summary,  n->summary, 0)))
                 && (!r->body     || (n->body     && !fnmatch(r->body,     n->body, 0)))
-                && (!r->icon     || (n->icon     && !fnmatch(r->icon,     n->icon, 0)))
-                && (!r->category || (n->category && !fnmatch(r->category, n->category, 0)))
+                && rule_field_matches(MEMO_ICON, index, r->icon, n->icon)
+                && rule_field_matches(MEMO_CATEGORY, index, r->category, n->category)
                 && (r->match_transient == -1 || (r->match_transient == n->transient))
                 && (r->msg_urgency == URG_NONE || r->msg_urgency == n->urgency));
 }
@@ -32,13 +32,48 @@ typedef struct _rule_t {
         const char *format;
         const char *script;
         enum behavior_fullscreen fullscreen;
+        int rate_limit;
+        enum rate_limit_action rate_limit_action;
 } rule_t;
 
 extern GSList *rules;
 
 void rule_init(rule_t *r);
+
+/**
+ * Create a deep copy of \p r, to be freed with rule_free().
+ */
+rule_t *rule_dup(const rule_t *r);
+
+/**
+ * Free the rule and all of its strings.
+ */
+void rule_free(rule_t *r);
+
+/**
+ * Check if both rules have the same name, filters and actions.
+ */
+bool rule_equal(const rule_t *a, const rule_t *b);
+
+/**
+ * Collect the rules, which got added, removed or changed from \p old to
+ * \p new. Rules are identified by their name and their position, as
+ * moving a rule changes which rules it overrides.
+ *
+ * @return a list of the changed rules from \p new and the removed or
+ *         changed rules from \p old. Free it with g_slist_free().
+ */
+GSList *rules_diff(GSList *old, GSList *new);
 void rule_apply(rule_t *r, notification *n);
 void rule_apply_all(notification *n);
+
+/**
+ * Precompile the lookup structures for the global rules list.
+ *
+ * Has to be called again after changing the rules list, rule_apply_all()
+ * only compiles the rules on its own on the first call.
+ */
+void rules_compile(void);
 bool rule_matches_notification(rule_t *r, notification *n);
 
 #endif
@@ -49,6 +49,46 @@ static enum markup_mode parse_markup_mode(const char *mode)
         }
 }
 
+static enum presentation parse_presentation(const char *mode)
+{
+        if (strcmp(mode, "auto") == 0)
+                return PRESENTATION_AUTO;
+        else if (strcmp(mode, "shm") == 0)
+                return PRESENTATION_SHM;
+        else if (strcmp(mode, "xlib") == 0)
+                return PRESENTATION_XLIB;
+        else {
+                LOG_W("Unknown presentation mode: '%s'", mode);
+                return PRESENTATION_AUTO;
+        }
+}
+
+static enum script_overflow parse_script_overflow(const char *mode)
+{
+        if (strcmp(mode, "drop") == 0)
+                return SCRIPT_OVERFLOW_DROP;
+        else if (strcmp(mode, "coalesce") == 0)
+                return SCRIPT_OVERFLOW_COALESCE;
+        else {
+                LOG_W("Unknown script overflow mode: '%s'", mode);
+                return SCRIPT_OVERFLOW_DROP;
+        }
+}
+
+static enum rate_limit_action parse_rate_limit_action(const char *action, enum rate_limit_action def)
+{
+        if (strcmp(action, "drop") == 0)
+                return RATE_LIMIT_DROP;
+        else if (strcmp(action, "collapse") == 0)
+                return RATE_LIMIT_COLLAPSE;
+        else if (strcmp(action, "delay") == 0)
+                return RATE_LIMIT_DELAY;
+        else {
+                LOG_W("Unknown rate limit action: '%s'", action);
+                return def;
+        }
+}
+
 static enum mouse_action parse_mouse_action(const char *action)
 {
         if (strcmp(action, "none") == 0)
@@ -85,9 +125,16 @@ static enum urgency ini_get_urgency(const char *section, const char *key, const
         return ret;
 }
 
-void load_settings(char *cmdline_config_path)
+/**
+ * Find the configuration file and parse it into the ini store.
+ *
+ * @param cmdline_config_path the path given via `-config` or NULL
+ * @param fatal if true, errors terminate dunst. Otherwise they get logged.
+ *
+ * @return false, if the given file can't be opened or is invalid
+ */
+static bool settings_read_config(const char *cmdline_config_path, bool fatal)
 {
-
 #ifndef STATIC_CONFIG
         xdgHandle xdg;
         FILE *config_file = NULL;
@@ -102,7 +149,12 @@ void load_settings(char *cmdline_config_path)
                 }
 
                 if(!config_file) {
-                        DIE("Cannot find config file: '%s'", cmdline_config_path);
+                        if (fatal)
+                                DIE("Cannot find config file: '%s'", cmdline_config_path);
+
+                        LOG_W("Cannot find config file: '%s'", cmdline_config_path);
+                        xdgWipeHandle(&xdg);
+                        return false;
                 }
         }
         if (!config_file) {
@@ -114,16 +166,35 @@ void load_settings(char *cmdline_config_path)
                 config_file = xdgConfigOpen("dunstrc", "r", &xdg);
                 if (!config_file) {
                         LOG_W("No dunstrc found.");
-                        xdgWipeHandle(&xdg);
                 }
         }
+        xdgWipeHandle(&xdg);
+
+        int ret = load_ini_file(config_file);
+
+        if (config_file)
+                fclose(config_file);
+
+        if (ret < 0) {
+                if (fatal)
+                        DIE("Duplicated section in dunstrc detected.");
 
-        load_ini_file(config_file);
+                free_ini();
+                return false;
+        }
 #else
         LOG_M("dunstrc parsing disabled. "
               "Using STATIC_CONFIG is deprecated behavior.");
 #endif
+        return true;
+}
 
+/**
+ * Fill #settings and #rules from the ini store and the command line
+ * and free the ini store afterwards.
+ */
+static void settings_parse(void)
+{
         {
                 char *loglevel = option_get_string(
                                 "global",
@@ -237,6 +308,12 @@ void load_settings(char *cmdline_config_path)
                 "Ignore newline characters in notifications"
         );
 
+        settings.max_body_length = option_get_int(
+                "global",
+                "max_body_length", "-max_body_length", defaults.max_body_length,
+                "Max bytes of a received body, the rest gets cut off. 0 for no limit"
+        );
+
         settings.idle_threshold = option_get_time(
                 "global",
                 "idle_threshold", "-idle_threshold", defaults.idle_threshold,
@@ -337,6 +414,26 @@ void load_settings(char *cmdline_config_path)
                 "When should the age of the notification be displayed?"
         );
 
+        settings.frame_interval = option_get_time(
+                "global",
+                "frame_interval", "-frame_interval", defaults.frame_interval,
+                "Minimum time between two redraws of the window"
+        );
+
+        {
+                char *c = option_get_string(
+                        "global",
+                        "presentation", "-presentation", "",
+                        "How to transfer the window contents to the X server [auto/shm/xlib]"
+                );
+
+                if (strlen(c) > 0)
+                        settings.presentation = parse_presentation(c);
+                else
+                        settings.presentation = defaults.presentation;
+                g_free(c);
+        }
+
         settings.hide_duplicate_count = option_get_bool(
                 "global",
                 "hide_duplicate_count", "-hide_duplicate_count", false,
@@ -355,6 +452,18 @@ void load_settings(char *cmdline_config_path)
                 "Max amount of notifications kept in history"
         );
 
+        settings.history_max_memory = option_get_int(
+                "global",
+                "history_max_memory", "-history_max_memory", defaults.history_max_memory,
+                "Max kilobytes of memory used by the notifications in history, 0 for no limit"
+        );
+
+        settings.history_log_length = option_get_int(
+                "global",
+                "history_log_length", "-history_log_length", defaults.history_log_length,
+                "Max amount of notifications kept in the history log on disk, 0 to disable the log"
+        );
+
         settings.show_indicators = option_get_bool(
                 "global",
                 "show_indicators", "-show_indicators", defaults.show_indicators,
@@ -474,6 +583,12 @@ void load_settings(char *cmdline_config_path)
                 "Scale larger icons down to this size, set to 0 to disable"
         );
 
+        settings.icon_cache_size = option_get_int(
+                "global",
+                "icon_cache_size", "-icon_cache_size", defaults.icon_cache_size,
+                "Memory limit for cached icons in kilobytes, set to 0 to disable"
+        );
+
         // If the deprecated icon_folders option is used,
         // read it and generate its usage string.
         if (ini_is_set("global", "icon_folders") || cmdline_is_set("-icon_folders")) {
@@ -707,9 +822,62 @@ void load_settings(char *cmdline_config_path)
                 "Always run rule-defined scripts, even if the notification is suppressed with format = \"\"."
         );
 
-        /* push hardcoded default rules into rules list */
+        settings.script_concurrency = option_get_int(
+                "global",
+                "script_concurrency", "-script_concurrency", defaults.script_concurrency,
+                "Maximum number of scripts running at once, 0 for no limit"
+        );
+
+        settings.script_queue_length = option_get_int(
+                "global",
+                "script_queue_length", "-script_queue_length", defaults.script_queue_length,
+                "Number of script runs waiting for a running script to finish"
+        );
+
+        {
+                char *c = option_get_string(
+                        "global",
+                        "script_overflow", "-script_overflow", "",
+                        "What to do with script runs, when the queue is full [drop/coalesce]"
+                );
+
+                if (strlen(c) > 0)
+                        settings.script_overflow = parse_script_overflow(c);
+                else
+                        settings.script_overflow = defaults.script_overflow;
+                g_free(c);
+        }
+
+        settings.rate_limit = option_get_int(
+                "global",
+                "rate_limit", "-rate_limit", defaults.rate_limit,
+                "Notifications per second a single client may send, 0 for no limit"
+        );
+
+        settings.rate_limit_burst = option_get_int(
+                "global",
+                "rate_limit_burst", "-rate_limit_burst", defaults.rate_limit_burst,
+                "Number of notifications a client may send at once, before the rate limit applies"
+        );
+
+        {
+                char *c = option_get_string(
+                        "global",
+                        "rate_limit_action", "-rate_limit_action", "",
+                        "What to do with notifications exceeding the rate limit [drop/collapse/delay]"
+                );
+
+                if (strlen(c) > 0)
+                        settings.rate_limit_action = parse_rate_limit_action(c, defaults.rate_limit_action);
+                else
+                        settings.rate_limit_action = defaults.rate_limit_action;
+                g_free(c);
+        }
+
+        /* push copies of the hardcoded default rules into rules list,
+         * so the dunstrc can't modify the defaults themselves */
         for (int i = 0; i < G_N_ELEMENTS(default_rules); i++) {
-                rules = g_slist_insert(rules, &(default_rules[i]), -1);
+                rules = g_slist_insert(rules, rule_dup(&default_rules[i]), -1);
         }
 
         const char *cur_section = NULL;
@@ -738,10 +906,10 @@ void load_settings(char *cmdline_config_path)
                 if (!r) {
                         r = g_malloc(sizeof(rule_t));
                         rule_init(r);
+                        r->name = g_strdup(cur_section);
                         rules = g_slist_insert(rules, r, -1);
                 }
 
-                r->name = g_strdup(cur_section);
                 r->appname = ini_get_string(cur_section, "appname", r->appname);
                 r->summary = ini_get_string(cur_section, "summary", r->summary);
                 r->body = ini_get_string(cur_section, "body", r->body);
@@ -780,15 +948,91 @@ void load_settings(char *cmdline_config_path)
                         r->fullscreen = parse_enum_fullscreen(c, r->fullscreen);
                         g_free(c);
                 }
+                r->rate_limit = ini_get_int(cur_section, "rate_limit", r->rate_limit);
+                {
+                        char *c = ini_get_string(
+                                cur_section,
+                                "rate_limit_action", NULL
+                        );
+
+                        if (c) {
+                                r->rate_limit_action = parse_rate_limit_action(c, r->rate_limit_action);
+                                g_free(c);
+                        }
+                }
                 r->script = ini_get_path(cur_section, "script", NULL);
         }
 
-#ifndef STATIC_CONFIG
-        if (config_file) {
-                fclose(config_file);
-                free_ini();
-                xdgWipeHandle(&xdg);
+        rules_compile();
+
+        free_ini();
+}
+
+void load_settings(char *cmdline_config_path)
+{
+        settings_read_config(cmdline_config_path, true);
+        settings_parse();
+}
+
+/* see settings.h */
+bool reload_settings(char *cmdline_config_path, settings_t *old_settings, GSList **old_rules)
+{
+        if (cmdline_config_path && 0 == strcmp(cmdline_config_path, "-")) {
+                LOG_W("Cannot reload the configuration read from stdin.");
+                return false;
         }
-#endif
+
+        if (!settings_read_config(cmdline_config_path, false)) {
+                LOG_W("Keeping the previous configuration.");
+                return false;
+        }
+
+        *old_settings = settings;
+        *old_rules = rules;
+
+        memset(&settings, 0, sizeof(settings));
+        rules = NULL;
+        cmdline_usage_clear();
+
+        settings_parse();
+        return true;
+}
+
+/* see settings.h */
+void settings_free(settings_t *s)
+{
+        g_free(s->font);
+        g_free(s->normbgcolor);
+        g_free(s->normfgcolor);
+        g_free(s->normframecolor);
+        g_free(s->critbgcolor);
+        g_free(s->critfgcolor);
+        g_free(s->critframecolor);
+        g_free(s->lowbgcolor);
+        g_free(s->lowfgcolor);
+        g_free(s->lowframecolor);
+        g_free(s->format);
+        for (int i = 0; i < G_N_ELEMENTS(s->icons); i++)
+                g_free(s->icons[i]);
+        g_free(s->title);
+        g_free(s->class);
+        g_free(s->sep_custom_color_str);
+        g_free(s->frame_color);
+        g_free(s->dmenu);
+        g_strfreev(s->dmenu_cmd);
+        g_free(s->browser);
+        g_free(s->icon_path);
+        g_free((char *) s->close_ks.str);
+        g_free((char *) s->close_all_ks.str);
+        g_free((char *) s->history_ks.str);
+        g_free((char *) s->context_ks.str);
+
+        memset(s, 0, sizeof(settings_t));
+}
+
+/* see settings.h */
+void rules_free(GSList *list)
+{
+        g_slist_free_full(list, (GDestroyNotify) rule_free);
 }
 /* vim: set tabstop=8 shiftwidth=8 expandtab textwidth=0: */
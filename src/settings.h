@@ -13,6 +13,9 @@ enum separator_color { SEP_FOREGROUND, SEP_AUTO, SEP_FRAME, SEP_CUSTOM };
 enum follow_mode { FOLLOW_NONE, FOLLOW_MOUSE, FOLLOW_KEYBOARD };
 enum markup_mode { MARKUP_NULL, MARKUP_NO, MARKUP_STRIP, MARKUP_FULL };
 enum mouse_action { MOUSE_NONE, MOUSE_DO_ACTION, MOUSE_CLOSE_CURRENT, MOUSE_CLOSE_ALL };
+enum presentation { PRESENTATION_AUTO, PRESENTATION_SHM, PRESENTATION_XLIB };
+enum script_overflow { SCRIPT_OVERFLOW_DROP, SCRIPT_OVERFLOW_COALESCE };
+enum rate_limit_action { RATE_LIMIT_NULL, RATE_LIMIT_DROP, RATE_LIMIT_COLLAPSE, RATE_LIMIT_DELAY };
 
 struct geometry {
         int x;
@@ -54,13 +57,18 @@ typedef struct _settings {
         int indicate_hidden;
         gint64 idle_threshold;
         gint64 show_age_threshold;
+        gint64 frame_interval;
+        enum presentation presentation;
         enum alignment align;
         int sticky_history;
         int history_length;
+        int history_max_memory;
+        int history_log_length;
         int show_indicators;
         int word_wrap;
         enum ellipsize ellipsize;
         int ignore_newline;
+        int max_body_length;
         int line_height;
         int notification_height;
         int separator_height;
@@ -77,9 +85,16 @@ typedef struct _settings {
         char *browser;
         enum icon_position_t icon_position;
         int max_icon_size;
+        int icon_cache_size;
         char *icon_path;
         enum follow_mode f_mode;
         bool always_run_script;
+        int script_concurrency;
+        int script_queue_length;
+        enum script_overflow script_overflow;
+        int rate_limit;
+        int rate_limit_burst;
+        enum rate_limit_action rate_limit_action;
         keyboard_shortcut close_ks;
         keyboard_shortcut close_all_ks;
         keyboard_shortcut history_ks;
@@ -95,5 +110,31 @@ extern settings_t settings;
 
 void load_settings(char *cmdline_config_path);
 
+/**
+ * Parse the configuration file again and replace #settings and the rules
+ * with the new values.
+ *
+ * If the configuration file can't be read or is invalid, nothing changes.
+ *
+ * @param cmdline_config_path the path given via `-config` or NULL
+ * @param old_settings return location for the previous settings. Free them
+ *                     with settings_free() after use.
+ * @param old_rules return location for the previous rules list. Free it
+ *                  with rules_free() after use.
+ *
+ * @return true, if the configuration got replaced
+ */
+bool reload_settings(char *cmdline_config_path, settings_t *old_settings, GSList **old_rules);
+
+/**
+ * Free all strings of \p s, which got allocated while parsing the settings.
+ */
+void settings_free(settings_t *s);
+
+/**
+ * Free a rules list created while parsing the settings, including its rules.
+ */
+void rules_free(GSList *list);
+
 #endif
 /* vim: set tabstop=8 shiftwidth=8 expandtab textwidth=0: */
@@ -0,0 +1,177 @@
+/* copyright 2013 Sascha Kruse and contributors (see LICENSE for licensing information) */
+
+#include "stats.h"
+
+#include <glib.h>
+#include <string.h>
+
+#include "log.h"
+#include "notification.h"
+#include "utils.h"
+
+#define STATS_BUCKETS 25
+
+/** The latencies of a single stage */
+struct histogram {
+        guint64 count;
+        gint64 sum;
+        gint64 max;
+        guint64 buckets[STATS_BUCKETS]; /**< bucket i counts the latencies below 2^(i+1) us */
+};
+
+static const char *stage_names[STATS_STAGES] = {
+        [STATS_STAGE_INIT]    = "init",
+        [STATS_STAGE_INSERT]  = "insert",
+        [STATS_STAGE_WAITING] = "waiting",
+        [STATS_STAGE_LAYOUT]  = "layout",
+        [STATS_STAGE_PRESENT] = "present",
+        [STATS_STAGE_TOTAL]   = "total",
+};
+
+static const char *counter_names[STATS_COUNTERS] = {
+        [STATS_NOTIFICATIONS]     = "notifications",
+        [STATS_FRAMES]            = "frames",
+        [STATS_ICON_CACHE_HITS]   = "icon_cache_hits",
+        [STATS_ICON_CACHE_MISSES] = "icon_cache_misses",
+        [STATS_X_ROUND_TRIPS]     = "x_round_trips",
+};
+
+static struct histogram histograms[STATS_STAGES] = { { 0 } };
+static guint64 counters[STATS_COUNTERS] = { 0 };
+/** the time of the first recorded value, to get the rates */
+static gint64 stats_started = 0;
+
+/* see stats.h */
+void stats_count(enum stats_counter counter, guint amount)
+{
+        counters[counter] += amount;
+}
+
+static void stats_record(enum stats_stage stage, gint64 latency)
+{
+        struct histogram *h = &histograms[stage];
+        int bucket = 0;
+
+        latency = MAX(0, latency);
+        while ((latency >> (bucket + 1)) > 0 && bucket < STATS_BUCKETS - 1)
+                bucket++;
+
+        h->count++;
+        h->sum += latency;
+        h->max = MAX(h->max, latency);
+        h->buckets[bucket]++;
+}
+
+/* see stats.h */
+void stats_start(notification *n)
+{
+        if (!stats_started)
+                stats_started = n->timestamp;
+
+        n->latency_mark = n->timestamp;
+        counters[STATS_NOTIFICATIONS]++;
+}
+
+/* see stats.h */
+void stats_stage_done(notification *n, enum stats_stage stage)
+{
+        if (!n->latency_mark)
+                return;
+
+        gint64 now = time_monotonic_now();
+        stats_record(stage, now - n->latency_mark);
+        n->latency_mark = now;
+}
+
+/* see stats.h */
+void stats_drawn(notification *n)
+{
+        if (!n->latency_mark)
+                return;
+
+        stats_stage_done(n, STATS_STAGE_PRESENT);
+        stats_record(STATS_STAGE_TOTAL, n->latency_mark - n->timestamp);
+        n->latency_mark = 0;
+}
+
+/* see stats.h */
+GVariant *stats_to_variant(void)
+{
+        GVariantBuilder c, s;
+
+        g_variant_builder_init(&c, G_VARIANT_TYPE("a{st}"));
+        for (int i = 0; i < STATS_COUNTERS; i++)
+                g_variant_builder_add(&c, "{st}", counter_names[i], counters[i]);
+        g_variant_builder_add(&c, "{st}", "uptime_us",
+                              stats_started ? time_monotonic_now() - stats_started : 0);
+
+        g_variant_builder_init(&s, G_VARIANT_TYPE("a(stttat)"));
+        for (int i = 0; i < STATS_STAGES; i++) {
+                struct histogram *h = &histograms[i];
+                GVariant *buckets = g_variant_new_fixed_array(G_VARIANT_TYPE_UINT64,
+                                                              h->buckets,
+                                                              STATS_BUCKETS,
+                                                              sizeof(guint64));
+
+                g_variant_builder_add(&s, "(sttt@at)", stage_names[i],
+                                      h->count, h->sum, h->max, buckets);
+        }
+
+        return g_variant_new("(a{st}a(stttat))", &c, &s);
+}
+
+/* see stats.h */
+void stats_reset(void)
+{
+        memset(histograms, 0, sizeof(histograms));
+        memset(counters, 0, sizeof(counters));
+        stats_started = 0;
+}
+
+/**
+ * @return the upper bound of the latency below which the given fraction
+ *         of the recorded latencies lies
+ */
+static gint64 histogram_percentile(const struct histogram *h, double fraction)
+{
+        guint64 needed = (guint64) (h->count * fraction + 0.5);
+        guint64 seen = 0;
+
+        for (int i = 0; i < STATS_BUCKETS; i++) {
+                seen += h->buckets[i];
+                if (seen >= needed)
+                        return MIN((gint64) 1 << (i + 1), h->max);
+        }
+
+        return h->max;
+}
+
+/* see stats.h */
+void stats_dump(void)
+{
+        double uptime = stats_started
+                ? (double) (time_monotonic_now() - stats_started) / G_USEC_PER_SEC
+                : 0;
+
+        for (int i = 0; i < STATS_COUNTERS; i++)
+                LOG_D("Statistics: %s: %" G_GUINT64_FORMAT " (%.2f/s)",
+                      counter_names[i], counters[i],
+                      uptime > 0 ? counters[i] / uptime : 0);
+
+        for (int i = 0; i < STATS_STAGES; i++) {
+                const struct histogram *h = &histograms[i];
+
+                if (h->count == 0)
+                        continue;
+
+                LOG_D("Statistics: %-7s latency of %" G_GUINT64_FORMAT " notifications: "
+                      "avg %.2fms, p50 < %.2fms, p99 < %.2fms, max %.2fms",
+                      stage_names[i], h->count,
+                      (double) h->sum / h->count / 1000,
+                      histogram_percentile(h, 0.5) / 1000.0,
+                      histogram_percentile(h, 0.99) / 1000.0,
+                      h->max / 1000.0);
+        }
+}
+
+/* vim: set tabstop=8 shiftwidth=8 expandtab textwidth=0: */
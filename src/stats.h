@@ -0,0 +1,75 @@
+/* copyright 2013 Sascha Kruse and contributors (see LICENSE for licensing information) */
+#ifndef DUNST_STATS_H
+#define DUNST_STATS_H
+
+#include <glib.h>
+
+#include "notification.h"
+
+/**
+ * The stages of a notification from its arrival via DBus until it's on
+ * the screen. Each stage measures the time since the end of the previous
+ * one.
+ */
+enum stats_stage {
+        STATS_STAGE_INIT,    /**< parsing the message, notification_init() and the rules */
+        STATS_STAGE_INSERT,  /**< inserting the notification into the queues */
+        STATS_STAGE_WAITING, /**< waiting for a free slot in the displayed queue */
+        STATS_STAGE_LAYOUT,  /**< the next frame creating the layouts */
+        STATS_STAGE_PRESENT, /**< rendering and x_display_surface() */
+        STATS_STAGE_TOTAL,   /**< from the arrival until being on screen */
+        STATS_STAGES,
+};
+
+enum stats_counter {
+        STATS_NOTIFICATIONS,
+        STATS_FRAMES,
+        STATS_ICON_CACHE_HITS,
+        STATS_ICON_CACHE_MISSES,
+        STATS_X_ROUND_TRIPS,
+        STATS_COUNTERS,
+};
+
+/**
+ * Add \p amount to the counter.
+ */
+void stats_count(enum stats_counter counter, guint amount);
+
+/**
+ * Start measuring the latency of \p n, beginning with its arrival.
+ */
+void stats_start(notification *n);
+
+/**
+ * Record the time since the previous stage of \p n in the histogram of
+ * \p stage. Does nothing, if the latency of \p n isn't measured.
+ */
+void stats_stage_done(notification *n, enum stats_stage stage);
+
+/**
+ * Record the last stage and the total latency of \p n, after it got
+ * displayed on the screen, and stop measuring it.
+ */
+void stats_drawn(notification *n);
+
+/**
+ * @return a new floating GVariant of the type `(a{st}a(stttat))`, holding
+ *         the counters and the name, number, sum and maximum of the
+ *         latencies in microseconds and the histogram of each stage.
+ *         Bucket i of the histogram counts the latencies below 2^(i+1)
+ *         microseconds.
+ */
+GVariant *stats_to_variant(void);
+
+/**
+ * Drop all counters and recorded latencies.
+ */
+void stats_reset(void);
+
+/**
+ * Log the counters and a summary of each histogram at debug level.
+ */
+void stats_dump(void);
+
+#endif
+/* vim: set tabstop=8 shiftwidth=8 expandtab textwidth=0: */
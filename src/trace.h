@@ -0,0 +1,27 @@
+/* copyright 2013 Sascha Kruse and contributors (see LICENSE for licensing information) */
+#ifndef DUNST_TRACE_H
+#define DUNST_TRACE_H
+
+/*
+ * Static tracepoints on the hot paths, for profiling with bpftrace or perf
+ * without a debug build. See contrib/dunst_trace.bt for the probes.
+ *
+ * They only get compiled in with `make TRACEPOINTS=1`, which needs
+ * sys/sdt.h from systemtap. Otherwise the macros expand to nothing and
+ * their arguments don't get evaluated.
+ */
+
+#ifdef ENABLE_TRACEPOINTS
+#include <sys/sdt.h>
+
+#define TRACE(probe)            DTRACE_PROBE(dunst, probe)
+#define TRACE1(probe, a)        DTRACE_PROBE1(dunst, probe, a)
+#define TRACE2(probe, a, b)     DTRACE_PROBE2(dunst, probe, a, b)
+#else
+#define TRACE(probe)            do {} while (0)
+#define TRACE1(probe, a)        do {} while (0)
+#define TRACE2(probe, a, b)     do {} while (0)
+#endif
+
+#endif
+/* vim: set tabstop=8 shiftwidth=8 expandtab textwidth=0: */
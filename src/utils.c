@@ -4,6 +4,8 @@
 #include <assert.h>
 #include <errno.h>
 #include <glib.h>
+#include <signal.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -183,4 +185,97 @@ gint64 time_monotonic_now(void)
         return (gint64)tv_now.tv_sec  * G_USEC_PER_SEC
                      + tv_now.tv_nsec / 1000;
 }
+
+/* see utils.h */
+void spawn_child_setup(gpointer data)
+{
+        signal(SIGPIPE, SIG_DFL);
+}
+
+/**
+ * A string in the pool of string_intern()
+ */
+struct interned_string {
+        gint refs;      /**< protected by #pool_mutex */
+        char str[];
+};
+
+/** maps the strings to their struct interned_string */
+static GHashTable *pool = NULL;
+static GMutex pool_mutex;
+
+static struct interned_string *interned_from_str(const char *str)
+{
+        return (struct interned_string *) (str - offsetof(struct interned_string, str));
+}
+
+/* see utils.h */
+const char *string_intern(const char *str)
+{
+        if (!str)
+                return NULL;
+
+        g_mutex_lock(&pool_mutex);
+
+        if (!pool)
+                pool = g_hash_table_new(g_str_hash, g_str_equal);
+
+        struct interned_string *s = g_hash_table_lookup(pool, str);
+        if (s) {
+                s->refs++;
+        } else {
+                size_t len = strlen(str) + 1;
+
+                s = g_malloc(sizeof(struct interned_string) + len);
+                s->refs = 1;
+                memcpy(s->str, str, len);
+                g_hash_table_insert(pool, s->str, s);
+        }
+
+        g_mutex_unlock(&pool_mutex);
+
+        return s->str;
+}
+
+/* see utils.h */
+const char *string_intern_ref(const char *interned)
+{
+        if (!interned)
+                return NULL;
+
+        g_mutex_lock(&pool_mutex);
+        interned_from_str(interned)->refs++;
+        g_mutex_unlock(&pool_mutex);
+
+        return interned;
+}
+
+/* see utils.h */
+void string_intern_unref(const char *interned)
+{
+        if (!interned)
+                return;
+
+        struct interned_string *s = interned_from_str(interned);
+
+        g_mutex_lock(&pool_mutex);
+
+        assert(s->refs > 0);
+        if (--s->refs == 0) {
+                g_hash_table_remove(pool, s->str);
+                g_free(s);
+        }
+
+        g_mutex_unlock(&pool_mutex);
+}
+
+/* see utils.h */
+void string_intern_set(const char **dst, const char *str)
+{
+        const char *old = *dst;
+
+        *dst = string_intern(str);
+        string_intern_unref(old);
+}
+
 /* vim: set tabstop=8 shiftwidth=8 expandtab textwidth=0: */
@@ -36,5 +36,47 @@ gint64 string_to_time(const char *string);
  */
 gint64 time_monotonic_now(void);
 
+/**
+ * The child_setup function for g_spawn_async() and friends.
+ *
+ * dunst ignores SIGPIPE, which spawned programs would inherit. This
+ * restores the default action in the child.
+ */
+void spawn_child_setup(gpointer data);
+
+/**
+ * Get the shared copy of \p str from the string pool, adding it if it's
+ * not there yet. In contrast to `g_intern_string`, each copy is reference
+ * counted and gets freed again once its last reference got dropped.
+ *
+ * Equal strings get the same address, so interned strings can be
+ * compared and hashed by their pointer. Thread-safe.
+ *
+ * @returns: A new reference to the interned string or NULL, if \p str
+ *           is NULL. It must not be modified and has to be released with
+ *           string_intern_unref().
+ */
+const char *string_intern(const char *str);
+
+/**
+ * Take another reference of a string returned by string_intern(). This
+ * is cheaper than interning it again.
+ *
+ * @returns: \p interned
+ */
+const char *string_intern_ref(const char *interned);
+
+/**
+ * Release a reference of a string returned by string_intern() or
+ * string_intern_ref(). NULL is ignored.
+ */
+void string_intern_unref(const char *interned);
+
+/**
+ * Replace the interned string at \p dst with the interned copy of \p str
+ * and release the previous one.
+ */
+void string_intern_set(const char **dst, const char *str);
+
 #endif
 /* vim: set tabstop=8 shiftwidth=8 expandtab textwidth=0: */
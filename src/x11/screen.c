@@ -17,6 +17,7 @@
 
 #include "src/log.h"
 #include "src/settings.h"
+#include "src/stats.h"
 #include "x.h"
 
 screen_info *screens;
@@ -29,6 +30,16 @@ int randr_event_base = 0;
 static int randr_major_version = 0;
 static int randr_minor_version = 0;
 
+/** the index of the active screen in #screens, -1 if it has to be looked up */
+static int active_screen = -1;
+
+/** the focused window, whose fullscreen state is tracked */
+static Window fullscreen_window = None;
+/** the cached fullscreen state of #fullscreen_window */
+static bool fullscreen_state = false;
+/** #fullscreen_window and #fullscreen_state are initialized */
+static bool fullscreen_valid = false;
+
 void randr_init(void);
 void randr_update(void);
 void xinerama_update(void);
@@ -147,6 +158,7 @@ void screen_check_event(XEvent event)
         if (event.type == randr_event_base + RRScreenChangeNotify) {
                 LOG_D("XEvent: processing 'RRScreenChangeNotify'");
                 randr_update();
+                screens_invalidate();
 
         } else {
                 LOG_D("XEvent: Ignoring '%d'", event.type);
@@ -191,11 +203,6 @@ void screen_update_fallback(void)
         screens[0].h = DisplayHeight(xctx.dpy, screen);
 }
 
-/* see screen.h */
-bool have_fullscreen_window(void)
-{
-        return window_is_fullscreen(get_focused_window());
-}
 
 /**
  * X11 ErrorHandler to mainly discard BadWindow parameter error
@@ -223,11 +230,6 @@ bool window_is_fullscreen(Window window)
         if (!window)
                 return false;
 
-        Atom has_wm_state = XInternAtom(xctx.dpy, "_NET_WM_STATE", True);
-        if (has_wm_state == None){
-                return false;
-        }
-
         XFlush(xctx.dpy);
         XSetErrorHandler(XErrorHandlerFullscreen);
 
@@ -239,7 +241,7 @@ bool window_is_fullscreen(Window window)
         int result = XGetWindowProperty(
                         xctx.dpy,
                         window,
-                        has_wm_state,
+                        xctx.net_wm_state,
                         0,                     /* long_offset */
                         sizeof(window),        /* long_length */
                         false,                 /* delete */
@@ -253,17 +255,13 @@ bool window_is_fullscreen(Window window)
         XFlush(xctx.dpy);
         XSync(xctx.dpy, false);
         XSetErrorHandler(NULL);
+        stats_count(STATS_X_ROUND_TRIPS, 2);
 
         if (result == Success) {
                 for(int i = 0; i < n_items; i++) {
-                        char *atom = XGetAtomName(xctx.dpy, ((Atom*)prop_to_return)[i]);
-
-                        if (atom) {
-                                if(0 == strcmp("_NET_WM_STATE_FULLSCREEN", atom))
-                                        fs = true;
-                                XFree(atom);
-                                if(fs)
-                                        break;
+                        if (((Atom*)prop_to_return)[i] == xctx.net_wm_state_fullscreen) {
+                                fs = true;
+                                break;
                         }
                 }
         }
@@ -274,11 +272,89 @@ bool window_is_fullscreen(Window window)
         return fs;
 }
 
+/**
+ * Start tracking the currently focused window: select property changes on it,
+ * to get notified about changes of _NET_WM_STATE, and read its state.
+ */
+static void fullscreen_track_focused_window(void)
+{
+        Window focused = get_focused_window();
+
+        if (focused != fullscreen_window) {
+                XFlush(xctx.dpy);
+                XSetErrorHandler(XErrorHandlerFullscreen);
+
+                if (fullscreen_window)
+                        XSelectInput(xctx.dpy, fullscreen_window, NoEventMask);
+                if (focused)
+                        XSelectInput(xctx.dpy, focused, PropertyChangeMask);
+
+                XSync(xctx.dpy, false);
+                XSetErrorHandler(NULL);
+                stats_count(STATS_X_ROUND_TRIPS, 1);
+
+                fullscreen_window = focused;
+        }
+
+        fullscreen_state = window_is_fullscreen(focused);
+        fullscreen_valid = true;
+}
+
+/* see screen.h */
+bool have_fullscreen_window(void)
+{
+        if (!fullscreen_valid)
+                fullscreen_track_focused_window();
+
+        return fullscreen_state;
+}
+
+/* see screen.h */
+bool fullscreen_check_event(const XPropertyEvent *ev)
+{
+        Window root = RootWindow(xctx.dpy, DefaultScreen(xctx.dpy));
+        bool before = have_fullscreen_window();
+
+        if (ev->window == root && ev->atom == xctx.net_active_window) {
+                if (settings.f_mode == FOLLOW_KEYBOARD)
+                        screen_invalidate_active();
+                fullscreen_track_focused_window();
+        }
+        else if (ev->window == fullscreen_window && ev->atom == xctx.net_wm_state)
+                fullscreen_state = window_is_fullscreen(fullscreen_window);
+        else
+                return false;
+
+        return before != fullscreen_state;
+}
+
+/* see screen.h */
+void screen_invalidate_active(void)
+{
+        active_screen = -1;
+}
+
+/* see screen.h */
+void screens_invalidate(void)
+{
+        screen_invalidate_active();
+        for (int i = 0; i < screens_len; i++)
+                screens[i].dpi = 0;
+}
+
+/* see screen.h */
+void screen_frame_start(void)
+{
+        /* there are no events, when the pointer moves to another screen */
+        if (settings.f_mode == FOLLOW_MOUSE)
+                screen_invalidate_active();
+}
+
 /*
  * Select the screen on which the Window
  * should be displayed.
  */
-screen_info *get_active_screen(void)
+static int screen_find_active(void)
 {
         int ret = 0;
         if (settings.monitor > 0 && settings.monitor < screens_len) {
@@ -313,6 +389,7 @@ screen_info *get_active_screen(void)
                                       &dummy,
                                       &dummy,
                                       &dummy_ui);
+                        stats_count(STATS_X_ROUND_TRIPS, 1);
                 }
 
                 if (settings.f_mode == FOLLOW_KEYBOARD) {
@@ -348,19 +425,33 @@ sc_cleanup:
         x_follow_tear_down_error_handler();
         assert(screens);
         assert(ret >= 0 && ret < screens_len);
-        return &screens[ret];
+        return ret;
+}
+
+/* see screen.h */
+screen_info *get_active_screen(void)
+{
+        if (active_screen < 0 || active_screen >= screens_len)
+                active_screen = screen_find_active();
+
+        return &screens[active_screen];
 }
 
 double get_dpi_for_screen(screen_info *scr)
 {
+        if (scr->dpi > 0)
+                return scr->dpi;
+
         double dpi = 0;
         if ((!settings.force_xinerama && settings.per_monitor_dpi &&
                 (dpi = autodetect_dpi(scr))))
-                return dpi;
+                scr->dpi = dpi;
         else if ((dpi = get_xft_dpi_value()))
-                return dpi;
+                scr->dpi = dpi;
         else
-                return 96;
+                scr->dpi = 96;
+
+        return scr->dpi;
 }
 
 /*
@@ -390,6 +481,7 @@ static Window get_focused_window(void)
                            &nitems,
                            &bytes_after,
                            &prop_return);
+        stats_count(STATS_X_ROUND_TRIPS, 1);
         if (prop_return) {
                 focused = *(Window *)prop_return;
                 XFree(prop_return);
@@ -411,6 +503,7 @@ static int x_follow_tear_down_error_handler(void)
         XFlush(xctx.dpy);
         XSync(xctx.dpy, false);
         XSetErrorHandler(NULL);
+        stats_count(STATS_X_ROUND_TRIPS, 1);
         return dunst_follow_errored;
 }
 
@@ -14,17 +14,46 @@ typedef struct {
         unsigned int h;
         unsigned int mmh;
         unsigned int w;
+        double dpi;             /**< memoized by get_dpi_for_screen(), 0 if unknown */
 } screen_info;
 
 void init_screens(void);
 void screen_check_event(XEvent event);
 
+/**
+ * Get the screen, on which the window should be displayed.
+ *
+ * The result is cached until screen_invalidate_active() gets called.
+ */
 screen_info *get_active_screen(void);
+
+/**
+ * Drop the cached active screen, so the next call of get_active_screen()
+ * looks it up again.
+ */
+void screen_invalidate_active(void);
+
+/**
+ * Drop the cached active screen and the memoized DPI of all screens.
+ */
+void screens_invalidate(void);
+
+/**
+ * Prepare for drawing a new frame. With `follow = mouse`, the active
+ * screen gets looked up once per frame.
+ */
+void screen_frame_start(void);
+
+/**
+ * Get the DPI of the screen. The value is memoized in \p scr.
+ */
 double get_dpi_for_screen(screen_info *scr);
 
 /**
- * Find the currently focused window and check if it's in
- * fullscreen mode
+ * Check if the currently focused window is in fullscreen mode.
+ *
+ * The state is cached and only updated via fullscreen_check_event(),
+ * so calling this doesn't cause any requests to the X server.
  *
  * @see window_is_fullscreen()
  * @see get_focused_window()
@@ -33,6 +62,14 @@ double get_dpi_for_screen(screen_info *scr);
  */
 bool have_fullscreen_window(void);
 
+/**
+ * Update the cached fullscreen state, if \p ev changed the active window
+ * or the state of the active window.
+ *
+ * @return `true` if the fullscreen state changed
+ */
+bool fullscreen_check_event(const XPropertyEvent *ev);
+
 /**
  * Check if window is in fullscreen mode
  *
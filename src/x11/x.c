@@ -6,6 +6,7 @@
 #include <X11/Xatom.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
 #include <X11/extensions/shape.h>
 #include <assert.h>
 #include <cairo-xlib.h>
@@ -17,6 +18,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
 #include <unistd.h>
 
 #include "src/draw.h"
@@ -27,6 +30,8 @@
 #include "src/notification.h"
 #include "src/queues.h"
 #include "src/settings.h"
+#include "src/stats.h"
+#include "src/trace.h"
 #include "src/utils.h"
 
 #include "screen.h"
@@ -42,6 +47,10 @@ struct window_x11 {
         int cur_screen;
         bool visible;
         struct dimensions dim;
+        cairo_region_t *exposed; /**< areas of the window the X server asked us to repaint */
+        XShmSegmentInfo shm_info;
+        XImage *shm_image;       /**< the image in the shared memory segment, NULL if not allocated */
+        bool shm_failed;         /**< shared memory can't be used, present via xlib */
 };
 
 struct x11_source {
@@ -52,8 +61,6 @@ struct x11_source {
 xctx_t xctx;
 bool dunst_grab_errored = false;
 
-static bool fullscreen_last = false;
-
 static void x_shortcut_init(keyboard_shortcut *ks);
 static int x_shortcut_grab(keyboard_shortcut *ks);
 static void x_shortcut_ungrab(keyboard_shortcut *ks);
@@ -61,6 +68,7 @@ static void x_shortcut_ungrab(keyboard_shortcut *ks);
 static void x_shortcut_setup_error_handler(void);
 static int x_shortcut_tear_down_error_handler(void);
 static void setopacity(Window win, unsigned long opacity);
+static void x_win_apply_settings(window_x11 *win);
 static void x_handle_click(XEvent ev);
 
 static void x_win_move(window_x11 *win, int x, int y, int width, int height)
@@ -148,20 +156,230 @@ static void x_win_round_corners(window_x11 *win, const int rad)
                 win->xwin, ShapeNotifyMask);
 }
 
-void x_display_surface(cairo_surface_t *srf, window_x11 *win, const struct dimensions *dim)
+static bool x_shm_errored = false;
+
+static int x_shm_error_handler(Display *display, XErrorEvent *e)
 {
-        x_win_move(win, dim->x, dim->y, dim->w, dim->h);
-        cairo_xlib_surface_set_size(win->root_surface, dim->w, dim->h);
+        x_shm_errored = true;
+        return 0;
+}
+
+/**
+ * Give up on shared memory presentation for the window.
+ *
+ * @return false, always
+ */
+static bool x_shm_fail(window_x11 *win, const char *reason)
+{
+        win->shm_failed = true;
+
+        if (settings.presentation == PRESENTATION_SHM)
+                LOG_W("Cannot use shared memory presentation: %s. Falling back to xlib.", reason);
+        else
+                LOG_I("Not using shared memory presentation: %s", reason);
+
+        return false;
+}
+
+static void x_shm_image_free(window_x11 *win)
+{
+        if (!win->shm_image)
+                return;
+
+        XShmDetach(xctx.dpy, &win->shm_info);
+        XDestroyImage(win->shm_image);
+        shmdt(win->shm_info.shmaddr);
+        win->shm_image = NULL;
+}
+
+/**
+ * Make sure the window has a shared image of the given size.
+ *
+ * @return true, if the shared image can be used for presentation
+ */
+static bool x_shm_image_ensure(window_x11 *win, int width, int height)
+{
+        if (win->shm_failed)
+                return false;
+
+        if (win->shm_image
+            && win->shm_image->width == width
+            && win->shm_image->height == height)
+                return true;
+
+        x_shm_image_free(win);
+
+        int scr = DefaultScreen(xctx.dpy);
+        Visual *visual = DefaultVisual(xctx.dpy, scr);
+        XImage *img = XShmCreateImage(xctx.dpy, visual, DefaultDepth(xctx.dpy, scr),
+                                      ZPixmap, NULL, &win->shm_info, width, height);
+
+        if (!img)
+                return x_shm_fail(win, "creating the image failed");
+
+        /* the rows get copied verbatim from a CAIRO_FORMAT_ARGB32 surface */
+        if (   img->bits_per_pixel != 32
+            || img->byte_order != (G_BYTE_ORDER == G_LITTLE_ENDIAN ? LSBFirst : MSBFirst)
+            || visual->red_mask != 0xff0000
+            || visual->green_mask != 0xff00
+            || visual->blue_mask != 0xff) {
+                XDestroyImage(img);
+                return x_shm_fail(win, "unsupported visual");
+        }
+
+        win->shm_info.shmid = shmget(IPC_PRIVATE, img->bytes_per_line * img->height, IPC_CREAT | 0600);
+        if (win->shm_info.shmid < 0) {
+                XDestroyImage(img);
+                return x_shm_fail(win, "shmget failed");
+        }
+
+        win->shm_info.shmaddr = img->data = shmat(win->shm_info.shmid, NULL, 0);
+        if (win->shm_info.shmaddr == (char *) -1) {
+                shmctl(win->shm_info.shmid, IPC_RMID, NULL);
+                XDestroyImage(img);
+                return x_shm_fail(win, "shmat failed");
+        }
+        win->shm_info.readOnly = false;
+
+        /* attaching fails asynchronously for remote displays */
+        XSync(xctx.dpy, false);
+        x_shm_errored = false;
+        XErrorHandler old_handler = XSetErrorHandler(x_shm_error_handler);
+        Status attached = XShmAttach(xctx.dpy, &win->shm_info);
+        XSync(xctx.dpy, false);
+        XSetErrorHandler(old_handler);
+
+        /* the segment gets removed as soon as both sides detached from it */
+        shmctl(win->shm_info.shmid, IPC_RMID, NULL);
+
+        if (!attached || x_shm_errored) {
+                XDestroyImage(img);
+                shmdt(win->shm_info.shmaddr);
+                return x_shm_fail(win, "the X server cannot attach the segment");
+        }
+
+        win->shm_image = img;
+        LOG_D("Allocated shared image of %dx%d", width, height);
+
+        return true;
+}
+
+/**
+ * Copy the region of \p srf into the shared image and let the X server
+ * put it onto the window.
+ *
+ * @return the number of bytes copied into the shared image
+ */
+static size_t x_shm_present(window_x11 *win, cairo_surface_t *srf, const cairo_region_t *region)
+{
+        XImage *img = win->shm_image;
+        GC gc = DefaultGC(xctx.dpy, DefaultScreen(xctx.dpy));
+
+        cairo_surface_flush(srf);
+        const unsigned char *data = cairo_image_surface_get_data(srf);
+        int stride = cairo_image_surface_get_stride(srf);
+
+        size_t bytes = 0;
+        int n = cairo_region_num_rectangles(region);
+        for (int i = 0; i < n; i++) {
+                cairo_rectangle_int_t rect;
+                cairo_region_get_rectangle(region, i, &rect);
+
+                for (int y = rect.y; y < rect.y + rect.height; y++)
+                        memcpy(img->data + y * img->bytes_per_line + rect.x * 4,
+                               data + y * stride + rect.x * 4,
+                               rect.width * 4);
+
+                XShmPutImage(xctx.dpy, win->xwin, gc, img,
+                             rect.x, rect.y, rect.x, rect.y,
+                             rect.width, rect.height, false);
+                bytes += (size_t) rect.width * rect.height * 4;
+        }
+
+        /* the server has to be done reading, before the image gets overwritten */
+        XSync(xctx.dpy, false);
+        stats_count(STATS_X_ROUND_TRIPS, 1);
+
+        return bytes;
+}
+
+/**
+ * Paint the region of \p srf onto the window via cairo-xlib, which sends
+ * the image through the X connection.
+ *
+ * @return the number of bytes of image data sent
+ */
+static size_t x_xlib_present(window_x11 *win, cairo_surface_t *srf, const cairo_region_t *region)
+{
+        size_t bytes = 0;
+
+        cairo_save(win->c_ctx);
+
+        int n = cairo_region_num_rectangles(region);
+        for (int i = 0; i < n; i++) {
+                cairo_rectangle_int_t rect;
+                cairo_region_get_rectangle(region, i, &rect);
+                cairo_rectangle(win->c_ctx, rect.x, rect.y, rect.width, rect.height);
+                bytes += (size_t) rect.width * rect.height * 4;
+        }
+        cairo_clip(win->c_ctx);
 
         cairo_set_source_surface(win->c_ctx, srf, 0, 0);
         cairo_paint(win->c_ctx);
+        cairo_restore(win->c_ctx);
         cairo_show_page(win->c_ctx);
 
-        if (settings.corner_radius != 0)
+        return bytes;
+}
+
+void x_display_surface(cairo_surface_t *srf,
+                       window_x11 *win,
+                       const struct dimensions *dim,
+                       const cairo_region_t *damage)
+{
+        bool resized = dim->w != win->dim.w || dim->h != win->dim.h;
+        bool reshaped = resized || dim->corner_radius != win->dim.corner_radius;
+        size_t bytes = 0;
+
+        TRACE(present_begin);
+
+        x_win_move(win, dim->x, dim->y, dim->w, dim->h);
+        win->dim.corner_radius = dim->corner_radius;
+
+        if (resized)
+                cairo_xlib_surface_set_size(win->root_surface, dim->w, dim->h);
+
+        cairo_rectangle_int_t full = { 0, 0, dim->w, dim->h };
+        cairo_region_t *region;
+        if (damage && !resized) {
+                region = cairo_region_copy(damage);
+                cairo_region_union(region, win->exposed);
+                cairo_region_intersect_rectangle(region, &full);
+        } else {
+                region = cairo_region_create_rectangle(&full);
+        }
+
+        if (!cairo_region_is_empty(region)) {
+                if (x_shm_image_ensure(win, dim->w, dim->h)) {
+                        bytes = x_shm_present(win, srf, region);
+                        LOG_D("Presented %zu bytes via shared memory", bytes);
+                } else {
+                        bytes = x_xlib_present(win, srf, region);
+                        LOG_D("Presented %zu bytes via the X connection", bytes);
+                }
+        }
+
+        cairo_region_destroy(region);
+
+        cairo_region_destroy(win->exposed);
+        win->exposed = cairo_region_create();
+
+        if (settings.corner_radius != 0 && reshaped)
                 x_win_round_corners(win, dim->corner_radius);
 
         XFlush(xctx.dpy);
 
+        TRACE1(present_end, bytes);
 }
 
 bool x_win_visible(window_x11 *win)
@@ -268,7 +486,6 @@ gboolean x_mainloop_fd_dispatch(GSource *source, GSourceFunc callback, gpointer
 {
         window_x11 *win = ((struct x11_source*) source)->win;
 
-        bool fullscreen_now;
         screen_info *scr;
         XEvent ev;
         unsigned int state;
@@ -278,8 +495,15 @@ gboolean x_mainloop_fd_dispatch(GSource *source, GSourceFunc callback, gpointer
                 switch (ev.type) {
                 case Expose:
                         LOG_D("XEvent: processing 'Expose'");
+                        {
+                                cairo_rectangle_int_t rect = {
+                                        ev.xexpose.x, ev.xexpose.y,
+                                        ev.xexpose.width, ev.xexpose.height
+                                };
+                                cairo_region_union_rectangle(win->exposed, &rect);
+                        }
                         if (ev.xexpose.count == 0 && win->visible) {
-                                draw();
+                                schedule_redraw();
                         }
                         break;
                 case ButtonRelease:
@@ -328,10 +552,12 @@ gboolean x_mainloop_fd_dispatch(GSource *source, GSourceFunc callback, gpointer
                         break;
                 case FocusIn:
                         LOG_D("XEvent: processing 'FocusIn'");
+                        screen_invalidate_active();
                         wake_up();
                         break;
                 case FocusOut:
                         LOG_D("XEvent: processing 'FocusOut'");
+                        screen_invalidate_active();
                         wake_up();
                         break;
                 case CreateNotify:
@@ -342,21 +568,25 @@ gboolean x_mainloop_fd_dispatch(GSource *source, GSourceFunc callback, gpointer
                         break;
                 case PropertyNotify:
                         LOG_D("XEvent: processing 'PropertyNotify'");
-                        fullscreen_now = have_fullscreen_window();
-                        scr = get_active_screen();
-
-                        if (fullscreen_now != fullscreen_last) {
-                                fullscreen_last = fullscreen_now;
+                        if (fullscreen_check_event(&ev.xproperty)) {
                                 wake_up();
                         } else if (   settings.f_mode != FOLLOW_NONE
-                        /* Ignore PropertyNotify, when we're still on the
-                         * same screen. PropertyNotify is only necessary
-                         * to detect a focus change to another screen
-                         */
                                    && win->visible
-                                   && scr->id != win->cur_screen) {
-                                draw();
-                                win->cur_screen = scr->id;
+                                   && ev.xproperty.window == DefaultRootWindow(xctx.dpy)) {
+                                /* Ignore PropertyNotify, when we're still on the
+                                 * same screen. PropertyNotify is only necessary
+                                 * to detect a focus change to another screen.
+                                 * The focused window reports its properties
+                                 * for fullscreen_check_event() only, e.g. a
+                                 * new title mustn't query the pointer.
+                                 */
+                                if (settings.f_mode == FOLLOW_MOUSE)
+                                        screen_invalidate_active();
+                                scr = get_active_screen();
+                                if (scr->id != win->cur_screen) {
+                                        schedule_redraw();
+                                        win->cur_screen = scr->id;
+                                }
                         }
                         break;
                 default:
@@ -442,6 +672,31 @@ void x_free(void)
                 XCloseDisplay(xctx.dpy);
 }
 
+/* see x.h */
+void x_colors_init(void)
+{
+        xctx.colors[ColFG][URG_LOW] = g_intern_string(settings.lowfgcolor);
+        xctx.colors[ColFG][URG_NORM] = g_intern_string(settings.normfgcolor);
+        xctx.colors[ColFG][URG_CRIT] = g_intern_string(settings.critfgcolor);
+
+        xctx.colors[ColBG][URG_LOW] = g_intern_string(settings.lowbgcolor);
+        xctx.colors[ColBG][URG_NORM] = g_intern_string(settings.normbgcolor);
+        xctx.colors[ColBG][URG_CRIT] = g_intern_string(settings.critbgcolor);
+
+        if (settings.lowframecolor)
+                xctx.colors[ColFrame][URG_LOW] = g_intern_string(settings.lowframecolor);
+        else
+                xctx.colors[ColFrame][URG_LOW] = g_intern_string(settings.frame_color);
+        if (settings.normframecolor)
+                xctx.colors[ColFrame][URG_NORM] = g_intern_string(settings.normframecolor);
+        else
+                xctx.colors[ColFrame][URG_NORM] = g_intern_string(settings.frame_color);
+        if (settings.critframecolor)
+                xctx.colors[ColFrame][URG_CRIT] = g_intern_string(settings.critframecolor);
+        else
+                xctx.colors[ColFrame][URG_CRIT] = g_intern_string(settings.frame_color);
+}
+
 /*
  * Setup X11 stuff
  */
@@ -469,33 +724,56 @@ void x_setup(void)
         x_shortcut_grab(&settings.context_ks);
         x_shortcut_ungrab(&settings.context_ks);
 
-        xctx.colors[ColFG][URG_LOW] = settings.lowfgcolor;
-        xctx.colors[ColFG][URG_NORM] = settings.normfgcolor;
-        xctx.colors[ColFG][URG_CRIT] = settings.critfgcolor;
-
-        xctx.colors[ColBG][URG_LOW] = settings.lowbgcolor;
-        xctx.colors[ColBG][URG_NORM] = settings.normbgcolor;
-        xctx.colors[ColBG][URG_CRIT] = settings.critbgcolor;
-
-        if (settings.lowframecolor)
-                xctx.colors[ColFrame][URG_LOW] = settings.lowframecolor;
-        else
-                xctx.colors[ColFrame][URG_LOW] = settings.frame_color;
-        if (settings.normframecolor)
-                xctx.colors[ColFrame][URG_NORM] = settings.normframecolor;
-        else
-                xctx.colors[ColFrame][URG_NORM] = settings.frame_color;
-        if (settings.critframecolor)
-                xctx.colors[ColFrame][URG_CRIT] = settings.critframecolor;
-        else
-                xctx.colors[ColFrame][URG_CRIT] = settings.frame_color;
+        x_colors_init();
 
         xctx.screensaver_info = XScreenSaverAllocInfo();
 
+        {
+                char *names[] = {
+                        "_NET_ACTIVE_WINDOW",
+                        "_NET_WM_STATE",
+                        "_NET_WM_STATE_FULLSCREEN",
+                };
+                Atom atoms[G_N_ELEMENTS(names)];
+
+                XInternAtoms(xctx.dpy, names, G_N_ELEMENTS(names), false, atoms);
+                xctx.net_active_window = atoms[0];
+                xctx.net_wm_state = atoms[1];
+                xctx.net_wm_state_fullscreen = atoms[2];
+        }
+
         init_screens();
         x_shortcut_grab(&settings.history_ks);
 }
 
+/* see x.h */
+void x_reload(window_x11 *win, struct _settings *old)
+{
+        x_shortcut_ungrab(&old->close_ks);
+        x_shortcut_ungrab(&old->close_all_ks);
+        x_shortcut_ungrab(&old->history_ks);
+        x_shortcut_ungrab(&old->context_ks);
+
+        x_shortcut_init(&settings.close_ks);
+        x_shortcut_init(&settings.close_all_ks);
+        x_shortcut_init(&settings.history_ks);
+        x_shortcut_init(&settings.context_ks);
+
+        x_shortcut_grab(&settings.history_ks);
+        if (win->visible) {
+                x_shortcut_grab(&settings.close_ks);
+                x_shortcut_grab(&settings.close_all_ks);
+                x_shortcut_grab(&settings.context_ks);
+        }
+
+        x_colors_init();
+        x_win_apply_settings(win);
+
+        if (old->force_xinerama != settings.force_xinerama)
+                init_screens();
+        screens_invalidate();
+}
+
 struct geometry x_parse_geometry(const char *geom_str)
 {
         assert(geom_str);
@@ -573,12 +851,9 @@ static void x_set_wm(Window win)
                         2L);
 
         /* set state above */
-        Atom net_wm_state =
-                XInternAtom(xctx.dpy, "_NET_WM_STATE", false);
-
         data[0] = XInternAtom(xctx.dpy, "_NET_WM_STATE_ABOVE", false);
 
-        XChangeProperty(xctx.dpy, win, net_wm_state, XA_ATOM, 32,
+        XChangeProperty(xctx.dpy, win, xctx.net_wm_state, XA_ATOM, 32,
                 PropModeReplace, (unsigned char *) data, 1L);
 }
 
@@ -607,6 +882,29 @@ GSource* x_win_reg_source(window_x11 *win)
         return (GSource*)xsrc;
 }
 
+/**
+ * Set the window properties and the events to listen for, which depend
+ * on the settings
+ */
+static void x_win_apply_settings(window_x11 *win)
+{
+        Window root = RootWindow(xctx.dpy, DefaultScreen(xctx.dpy));
+
+        x_set_wm(win->xwin);
+        settings.transparency =
+            settings.transparency > 100 ? 100 : settings.transparency;
+        setopacity(win->xwin,
+                   (unsigned long)((100 - settings.transparency) *
+                                   (0xffffffff / 100)));
+
+        /* PropertyChangeMask is needed to track the active window */
+        long root_event_mask = SubstructureNotifyMask | PropertyChangeMask;
+        if (settings.f_mode != FOLLOW_NONE) {
+                root_event_mask |= FocusChangeMask;
+        }
+        XSelectInput(xctx.dpy, root, root_event_mask);
+}
+
 /*
  * Setup the window
  */
@@ -639,25 +937,20 @@ window_x11 *x_win_create(void)
                                  CWOverrideRedirect | CWBackPixmap | CWEventMask,
                                  &wa);
 
-        x_set_wm(win->xwin);
-        settings.transparency =
-            settings.transparency > 100 ? 100 : settings.transparency;
-        setopacity(win->xwin,
-                   (unsigned long)((100 - settings.transparency) *
-                                   (0xffffffff / 100)));
+        x_win_apply_settings(win);
 
         win->root_surface = cairo_xlib_surface_create(xctx.dpy, win->xwin,
                                                       DefaultVisual(xctx.dpy, 0),
                                                       WIDTH, HEIGHT);
         win->c_ctx = cairo_create(win->root_surface);
+        win->exposed = cairo_region_create();
 
-        win->esrc = x_win_reg_source(win);
+        if (settings.presentation == PRESENTATION_XLIB)
+                win->shm_failed = true;
+        else if (!XShmQueryExtension(xctx.dpy))
+                x_shm_fail(win, "the X server doesn't support MIT-SHM");
 
-        long root_event_mask = SubstructureNotifyMask;
-        if (settings.f_mode != FOLLOW_NONE) {
-                root_event_mask |= FocusChangeMask | PropertyChangeMask;
-        }
-        XSelectInput(xctx.dpy, root, root_event_mask);
+        win->esrc = x_win_reg_source(win);
 
         return win;
 }
@@ -669,6 +962,8 @@ void x_win_destroy(window_x11 *win)
 
         cairo_destroy(win->c_ctx);
         cairo_surface_destroy(win->root_surface);
+        cairo_region_destroy(win->exposed);
+        x_shm_image_free(win);
         XDestroyWindow(xctx.dpy, win->xwin);
 
         g_free(win);
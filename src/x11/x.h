@@ -25,6 +25,7 @@ typedef struct _keyboard_shortcut {
 #include "src/settings.h"
 
 typedef struct window_x11 window_x11;
+struct _settings;
 
 struct dimensions {
         int x;
@@ -39,6 +40,9 @@ typedef struct _xctx {
         Display *dpy;
         const char *colors[3][3];
         XScreenSaverInfo *screensaver_info;
+        Atom net_active_window;       /**< _NET_ACTIVE_WINDOW, interned in x_setup() */
+        Atom net_wm_state;            /**< _NET_WM_STATE, interned in x_setup() */
+        Atom net_wm_state_fullscreen; /**< _NET_WM_STATE_FULLSCREEN, interned in x_setup() */
 } xctx_t;
 
 typedef struct _color_t {
@@ -56,7 +60,17 @@ void x_win_destroy(window_x11 *win);
 void x_win_show(window_x11 *win);
 void x_win_hide(window_x11 *win);
 
-void x_display_surface(cairo_surface_t *srf, window_x11 *win, const struct dimensions *dim);
+/**
+ * Push the contents of \p srf to the window and move it to \p dim.
+ *
+ * @param damage the parts of \p srf, which changed since the last call. If
+ *               NULL or the window got resized, the whole surface is pushed.
+ *               Areas the X server reported as exposed are always included.
+ */
+void x_display_surface(cairo_surface_t *srf,
+                       window_x11 *win,
+                       const struct dimensions *dim,
+                       const cairo_region_t *damage);
 
 bool x_win_visible(window_x11 *win);
 cairo_t* x_win_get_context(window_x11 *win);
@@ -64,8 +78,24 @@ cairo_t* x_win_get_context(window_x11 *win);
 /* X misc */
 bool x_is_idle(void);
 void x_setup(void);
+
+/**
+ * Intern the default colors for each urgency from the settings.
+ *
+ * x_setup() calls this as well, but it doesn't need the X connection and
+ * can be used to initialize notifications before X is set up.
+ */
+void x_colors_init(void);
 void x_free(void);
 
+/**
+ * Bring the X11 state in sync with the reloaded settings: the keyboard
+ * shortcuts, the default colors, the window properties and the screens.
+ *
+ * @param old the settings before the reload
+ */
+void x_reload(window_x11 *win, struct _settings *old);
+
 struct geometry x_parse_geometry(const char *geom_str);
 
 #endif
@@ -0,0 +1,366 @@
+/* copyright 2013 Sascha Kruse and contributors (see LICENSE for licensing information) */
+
+/*
+ * Headless benchmark of the notification pipeline.
+ *
+ * The notifications go through notification_init(), the queues and
+ * draw_offscreen() just like they would after arriving via DBus, but
+ * without any connection to DBus or X. Each workload prints a single
+ * line of JSON to stdout with the wall time, the allocations and the
+ * statistics collected by stats.c.
+ *
+ * Run it with `make bench` or `cd test && ./bench [workload...]`.
+ */
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "src/draw.h"
+#include "src/dunst.h"
+#include "src/icon.h"
+#include "src/log.h"
+#include "src/notification.h"
+#include "src/option_parser.h"
+#include "src/queues.h"
+#include "src/rules.h"
+#include "src/settings.h"
+#include "src/stats.h"
+#include "src/utils.h"
+
+#ifdef __GLIBC__
+/*
+ * Count the allocations by interposing the allocator of glibc. This also
+ * catches the allocations of glib, pango and cairo.
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static guint64 allocations = 0;
+static guint64 allocated_bytes = 0;
+
+static inline void count_allocation(size_t size)
+{
+        __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&allocated_bytes, size, __ATOMIC_RELAXED);
+}
+
+void *malloc(size_t size)
+{
+        count_allocation(size);
+        return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+        count_allocation(nmemb * size);
+        return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+        count_allocation(size);
+        return __libc_realloc(ptr, size);
+}
+#define ALLOCATIONS_COUNTED true
+#else
+static guint64 allocations = 0;
+static guint64 allocated_bytes = 0;
+#define ALLOCATIONS_COUNTED false
+#endif
+
+/** the screen all notifications get laid out for */
+static screen_info bench_screen = { .id = 0, .w = 1920, .h = 1080, .dpi = 96 };
+
+struct workload {
+        const char *name;
+        void (*run)(void);
+};
+
+/**
+ * Hand the notification to the queues like on_notify() does.
+ */
+static void bench_notify(notification *n)
+{
+        stats_start(n);
+
+        /* the Notify worker initializes every notification */
+        notification_init(n);
+
+        if (n->id != 0 && queues_notification_update(n)) {
+                notification_free(n);
+                return;
+        }
+
+        stats_stage_done(n, STATS_STAGE_INIT);
+
+        if (queues_notification_insert(n) != 0)
+                stats_stage_done(n, STATS_STAGE_INSERT);
+}
+
+static void bench_frame(void)
+{
+        queues_update(false);
+        draw_offscreen(&bench_screen);
+}
+
+static notification *bench_notification(const char *appname, int i)
+{
+        notification *n = notification_create();
+
+        n->appname = string_intern(appname);
+        /* unique summaries, so they don't get stacked as duplicates */
+        n->summary = g_strdup_printf("Notification %d", i);
+        n->body = g_strdup("The <b>quick</b> brown fox jumps over the lazy dog");
+        n->urgency = URG_NORM;
+
+        return n;
+}
+
+/**
+ * A burst of notifications arriving faster than they get drawn.
+ */
+static void bench_storm(void)
+{
+        for (int i = 0; i < 2000; i++) {
+                bench_notify(bench_notification("storm", i));
+                if (i % 20 == 0)
+                        bench_frame();
+        }
+        bench_frame();
+}
+
+/**
+ * A progress bar updating its notification via replaces_id.
+ */
+static void bench_replace(void)
+{
+        notification *n = bench_notification("progress", 0);
+        n->progress = 0;
+        bench_notify(n);
+        bench_frame();
+
+        int id = n->id;
+        for (int i = 1; i <= 1000; i++) {
+                n = bench_notification("progress", 0);
+                n->id = id;
+                n->progress = i % 101;
+                /* every tenth update changes the text and replaces
+                 * the notification completely */
+                if (i % 10 == 0) {
+                        g_free(n->body);
+                        n->body = g_strdup_printf("Step %d", i / 10);
+                }
+                bench_notify(n);
+                bench_frame();
+        }
+}
+
+/**
+ * Notifications with bodies of 64KiB each.
+ */
+static void bench_large_bodies(void)
+{
+        GString *body = g_string_new(NULL);
+        while (body->len < 64 * 1024)
+                g_string_append(body, "Lorem ipsum <i>dolor</i> sit amet, consectetur adipiscing elit. ");
+
+        for (int i = 0; i < 50; i++) {
+                notification *n = bench_notification("large", i);
+                g_free(n->body);
+                n->body = g_strdup(body->str);
+                bench_notify(n);
+                bench_frame();
+        }
+
+        g_string_free(body, true);
+}
+
+/**
+ * Notifications checked against a thousand rules.
+ */
+static void bench_rules(void)
+{
+        GSList *saved = rules;
+        rules = NULL;
+
+        for (int i = 0; i < 1000; i++) {
+                rule_t *r = g_malloc(sizeof(rule_t));
+                rule_init(r);
+                r->name = g_strdup_printf("rule%d", i);
+
+                switch (i % 4) {
+                case 0:
+                        r->appname = g_strdup_printf("app%d", i);
+                        break;
+                case 1:
+                        r->appname = g_strdup_printf("app%d*", i);
+                        break;
+                case 2:
+                        r->appname = g_strdup_printf("*pp%d", i);
+                        break;
+                default:
+                        r->summary = g_strdup_printf("*%d*", i);
+                        break;
+                }
+                r->urgency = URG_CRIT;
+
+                rules = g_slist_prepend(rules, r);
+        }
+        rules = g_slist_reverse(rules);
+        rules_compile();
+
+        for (int i = 0; i < 2000; i++) {
+                char appname[16];
+                snprintf(appname, sizeof(appname), "app%d", i % 1200);
+
+                bench_notify(bench_notification(appname, i));
+                if (i % 20 == 0)
+                        bench_frame();
+        }
+        bench_frame();
+
+        rules_free(rules);
+        rules = saved;
+        rules_compile();
+}
+
+static RawImage *bench_raw_image(int size, guchar shade)
+{
+        RawImage *image = g_malloc0(sizeof(RawImage));
+        gsize len = (gsize) size * size * 4;
+        guchar *data = g_malloc(len);
+
+        memset(data, shade, len);
+
+        image->width = size;
+        image->height = size;
+        image->rowstride = size * 4;
+        image->has_alpha = true;
+        image->bits_per_sample = 8;
+        image->n_channels = 4;
+        image->data_variant = g_variant_ref_sink(
+                g_variant_new_from_data(G_VARIANT_TYPE_BYTESTRING, data, len,
+                                        true, g_free, data));
+        image->data = g_variant_get_data(image->data_variant);
+
+        return image;
+}
+
+/**
+ * Notifications carrying a 1024x1024 image hint.
+ */
+static void bench_raw_icons(void)
+{
+        for (int i = 0; i < 50; i++) {
+                notification *n = bench_notification("raw", i);
+                n->raw_icon = bench_raw_image(1024, i);
+                bench_notify(n);
+                bench_frame();
+        }
+}
+
+static const struct workload workloads[] = {
+        { "storm",        bench_storm },
+        { "replace",      bench_replace },
+        { "large_bodies", bench_large_bodies },
+        { "rules",        bench_rules },
+        { "raw_icons",    bench_raw_icons },
+};
+
+static void print_stats(GVariant *stats)
+{
+        GVariantIter *counters, *stages;
+        const char *name;
+        guint64 count, sum, max;
+        GVariant *buckets;
+        bool first = true;
+
+        g_variant_get(stats, "(a{st}a(stttat))", &counters, &stages);
+
+        printf("\"counters\":{");
+        while (g_variant_iter_next(counters, "{&st}", &name, &count)) {
+                printf("%s\"%s\":%" G_GUINT64_FORMAT, first ? "" : ",", name, count);
+                first = false;
+        }
+
+        printf("},\"stages\":{");
+        first = true;
+        while (g_variant_iter_next(stages, "(&sttt@at)", &name, &count, &sum, &max, &buckets)) {
+                printf("%s\"%s\":{\"count\":%" G_GUINT64_FORMAT
+                       ",\"sum_us\":%" G_GUINT64_FORMAT
+                       ",\"max_us\":%" G_GUINT64_FORMAT "}",
+                       first ? "" : ",", name, count, sum, max);
+                first = false;
+                g_variant_unref(buckets);
+        }
+        printf("}");
+
+        g_variant_iter_free(counters);
+        g_variant_iter_free(stages);
+}
+
+static void run_workload(const struct workload *w)
+{
+        queues_init();
+        stats_reset();
+
+        guint64 allocations_start = allocations;
+        guint64 bytes_start = allocated_bytes;
+        gint64 start = time_monotonic_now();
+
+        w->run();
+
+        gint64 wall = time_monotonic_now() - start;
+        guint64 count = allocations - allocations_start;
+        guint64 bytes = allocated_bytes - bytes_start;
+
+        printf("{\"workload\":\"%s\",\"wall_us\":%" G_GINT64_FORMAT ",", w->name, wall);
+        if (ALLOCATIONS_COUNTED)
+                printf("\"allocations\":%" G_GUINT64_FORMAT
+                       ",\"allocated_bytes\":%" G_GUINT64_FORMAT ",",
+                       count, bytes);
+
+        GVariant *stats = g_variant_ref_sink(stats_to_variant());
+        print_stats(stats);
+        g_variant_unref(stats);
+        printf("}\n");
+        fflush(stdout);
+
+        teardown_queues();
+        draw_invalidate();
+}
+
+int main(int argc, char *argv[])
+{
+        cmdline_load(argc, argv);
+        dunst_log_init(true);
+
+        load_settings("data/dunstrc.default");
+
+        /* a stacked duplicate closes the old notification, which can't
+         * get signalled without DBus */
+        settings.stack_duplicates = false;
+
+        draw_setup_offscreen();
+
+        int ran = 0;
+        for (size_t i = 0; i < G_N_ELEMENTS(workloads); i++) {
+                bool wanted = argc <= 1;
+                for (int a = 1; a < argc && !wanted; a++)
+                        wanted = strcmp(argv[a], workloads[i].name) == 0;
+
+                if (wanted) {
+                        run_workload(&workloads[i]);
+                        ran++;
+                }
+        }
+
+        icon_loader_teardown();
+        draw_deinit();
+
+        return ran > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+/* vim: set tabstop=8 shiftwidth=8 expandtab textwidth=0: */
@@ -0,0 +1,175 @@
+#include "greatest.h"
+#include "src/history_log.h"
+#include "src/notification.h"
+#include "src/option_parser.h"
+#include "src/settings.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+static char *state_home = NULL;
+static char *log_path = NULL;
+
+/* Start every test with an empty log */
+static void history_log_reset(void)
+{
+        history_log_teardown();
+        g_unlink(log_path);
+        history_log_init();
+}
+
+static void push_summary(const char *summary)
+{
+        notification *n = notification_create();
+        notification_set_strings(n, NULL, "dunstify", summary, "Body", NULL);
+        notification_init(n);
+        history_log_push(n);
+        notification_free(n);
+}
+
+static void push_range(int from, int to)
+{
+        for (int i = from; i < to; i++) {
+                char *summary = g_strdup_printf("Summary %d", i);
+                push_summary(summary);
+                g_free(summary);
+        }
+}
+
+TEST assert_pop_summary(const char *summary)
+{
+        notification *n = history_log_pop(true);
+        ASSERT(n);
+        ASSERT_STR_EQ(summary, n->summary);
+        ASSERT_STR_EQ("dunstify", n->appname);
+        ASSERT_STR_EQ("Body", n->body);
+        notification_free(n);
+        PASS();
+}
+
+TEST assert_pop_range(int from, int to)
+{
+        for (int i = to - 1; i >= from; i--) {
+                char *summary = g_strdup_printf("Summary %d", i);
+                CHECK_CALL(assert_pop_summary(summary));
+                g_free(summary);
+        }
+        PASS();
+}
+
+TEST test_history_log_replay(void)
+{
+        history_log_reset();
+        push_range(0, 5);
+
+        history_log_teardown();
+        history_log_init();
+
+        CHECK_CALL(assert_pop_range(0, 5));
+        ASSERT_EQ(NULL, history_log_pop(true));
+        PASS();
+}
+
+TEST test_history_log_replay_truncated(void)
+{
+        history_log_reset();
+        push_range(0, 3);
+        history_log_teardown();
+
+        GStatBuf st;
+        ASSERT_EQ(0, g_stat(log_path, &st));
+        ASSERT_EQ(0, truncate(log_path, st.st_size - 4));
+
+        history_log_init();
+
+        /* the partial record got cut off the file */
+        GStatBuf truncated;
+        ASSERT_EQ(0, g_stat(log_path, &truncated));
+        ASSERT(truncated.st_size < st.st_size - 4);
+
+        CHECK_CALL(assert_pop_range(0, 2));
+        ASSERT_EQ(NULL, history_log_pop(true));
+        PASS();
+}
+
+TEST test_history_log_compaction(void)
+{
+        history_log_reset();
+
+        /* leave 12 live entries, popped ones must not come back */
+        push_range(0, 16);
+        for (int i = 0; i < 4; i++)
+                ASSERT_EQ(NULL, history_log_pop(false));
+
+        /* 21 live entries exceed twice the length of 10 */
+        push_range(16, 25);
+        history_log_teardown();
+
+        GStatBuf before;
+        ASSERT_EQ(0, g_stat(log_path, &before));
+
+        history_log_init();
+
+        /* compaction happened on the flush, not now */
+        GStatBuf after;
+        ASSERT_EQ(0, g_stat(log_path, &after));
+        ASSERT_EQ(before.st_size, after.st_size);
+
+        CHECK_CALL(assert_pop_range(16, 25));
+        CHECK_CALL(assert_pop_summary("Summary 11"));
+        ASSERT_EQ(NULL, history_log_pop(true));
+        PASS();
+}
+
+TEST test_history_log_pop_after_reload(void)
+{
+        history_log_reset();
+        push_range(0, 3);
+        history_log_teardown();
+
+        history_log_init();
+        CHECK_CALL(assert_pop_summary("Summary 2"));
+        push_summary("Summary 3");
+        history_log_teardown();
+
+        history_log_init();
+        CHECK_CALL(assert_pop_summary("Summary 3"));
+        CHECK_CALL(assert_pop_range(0, 2));
+        ASSERT_EQ(NULL, history_log_pop(true));
+        PASS();
+}
+
+SUITE(suite_history_log)
+{
+        cmdline_load(0, NULL);
+        load_settings("data/dunstrc.default");
+
+        int history_log_length = settings.history_log_length;
+        settings.history_log_length = 10;
+
+        state_home = g_dir_make_tmp("dunst-test-XXXXXX", NULL);
+        g_setenv("XDG_STATE_HOME", state_home, true);
+        log_path = g_build_filename(state_home, "dunst", "history", NULL);
+
+        RUN_TEST(test_history_log_replay);
+        RUN_TEST(test_history_log_replay_truncated);
+        RUN_TEST(test_history_log_compaction);
+        RUN_TEST(test_history_log_pop_after_reload);
+
+        history_log_teardown();
+        g_unlink(log_path);
+
+        char *dir = g_path_get_dirname(log_path);
+        g_rmdir(dir);
+        g_free(dir);
+        g_rmdir(state_home);
+
+        g_unsetenv("XDG_STATE_HOME");
+        settings.history_log_length = history_log_length;
+
+        g_clear_pointer(&log_path, g_free);
+        g_clear_pointer(&state_home, g_free);
+}
+/* vim: set tabstop=8 shiftwidth=8 expandtab textwidth=0: */
@@ -122,6 +122,75 @@ TEST test_get_pixbuf_from_icon_fileuri(void)
         PASS();
 }
 
+TEST test_get_pixbuf_from_icon_index_path_change(void)
+{
+        char *old_path = settings.icon_path;
+
+        settings.icon_path = "." ICONPREFIX "/valid";
+        GdkPixbuf *pixbuf = get_pixbuf_from_icon("onlypng");
+        ASSERT(pixbuf);
+        g_clear_pointer(&pixbuf, g_object_unref);
+
+        settings.icon_path = "." ICONPREFIX "/invalid";
+        pixbuf = get_pixbuf_from_icon("onlypng");
+        ASSERTm("The index didn't get rebuilt for the new icon_path", pixbuf == NULL);
+
+        settings.icon_path = old_path;
+        PASS();
+}
+
+TEST test_gdk_pixbuf_to_cairo_surface(void)
+{
+        GdkPixbuf *pixbuf = get_pixbuf_from_icon("onlypng");
+        ASSERT(pixbuf);
+
+        cairo_surface_t *surface = gdk_pixbuf_to_cairo_surface(pixbuf);
+        ASSERT_EQ(CAIRO_STATUS_SUCCESS, cairo_surface_status(surface));
+        ASSERT_EQ(gdk_pixbuf_get_width(pixbuf), cairo_image_surface_get_width(surface));
+        ASSERT_EQ(gdk_pixbuf_get_height(pixbuf), cairo_image_surface_get_height(surface));
+
+        cairo_surface_destroy(surface);
+        g_clear_pointer(&pixbuf, g_object_unref);
+        PASS();
+}
+
+TEST test_icon_get_for_notification_cached(void)
+{
+        notification *n = notification_create();
+        n->icon = string_intern("onlypng");
+
+        cairo_surface_t *first = icon_get_for_notification(n);
+        cairo_surface_t *second = icon_get_for_notification(n);
+        ASSERT(first);
+        ASSERTm("The icon didn't get cached", first == second);
+        cairo_surface_destroy(first);
+        cairo_surface_destroy(second);
+
+        settings.icon_cache_size = 0;
+        second = icon_get_for_notification(n);
+        ASSERT(second);
+        ASSERTm("The icon got cached despite disabled cache", first != second);
+        cairo_surface_destroy(second);
+        settings.icon_cache_size = 4096;
+
+        icon_cache_clear();
+        notification_free(n);
+        PASS();
+}
+
+TEST test_icon_get_for_notification_cached_invalid(void)
+{
+        notification *n = notification_create();
+        n->icon = string_intern("invalid");
+
+        ASSERT(icon_get_for_notification(n) == NULL);
+        ASSERT(icon_get_for_notification(n) == NULL);
+
+        icon_cache_clear();
+        notification_free(n);
+        PASS();
+}
+
 SUITE(suite_icon)
 {
         settings.icon_path =
@@ -137,7 +206,15 @@ SUITE(suite_icon)
         RUN_TEST(test_get_pixbuf_from_icon_onlypng);
         RUN_TEST(test_get_pixbuf_from_icon_filename);
         RUN_TEST(test_get_pixbuf_from_icon_fileuri);
+        RUN_TEST(test_get_pixbuf_from_icon_index_path_change);
+        RUN_TEST(test_gdk_pixbuf_to_cairo_surface);
+
+        settings.icon_cache_size = 4096;
+        RUN_TEST(test_icon_get_for_notification_cached);
+        RUN_TEST(test_icon_get_for_notification_cached_invalid);
+        settings.icon_cache_size = 0;
 
         settings.icon_path = NULL;
+        icon_index_free();
 }
 /* vim: set tabstop=8 shiftwidth=8 expandtab textwidth=0: */
@@ -36,6 +36,10 @@ TEST test_markup_transform(void)
         g_free(ptr);
         ASSERT_STR_EQ("<i>foo</i>\nbar\nbaz", (ptr=markup_transform(g_strdup("<i>foo</i><br>bar\nbaz"), MARKUP_FULL)));
         g_free(ptr);
+        ASSERT_STR_EQ("&quot;foo&quot;\n&amp; bar", (ptr=markup_transform(g_strdup("<b>&quot;foo&quot;</b><br />&amp; bar"), MARKUP_STRIP)));
+        g_free(ptr);
+        ASSERT_STR_EQ("plain text", (ptr=markup_transform(g_strdup("plain text"), MARKUP_NO)));
+        g_free(ptr);
 
         settings.ignore_newline = true;
         ASSERT_STR_EQ("&lt;i&gt;foo&lt;/i&gt;&lt;br&gt;bar baz", (ptr=markup_transform(g_strdup("<i>foo</i><br>bar\nbaz"), MARKUP_NO)));
@@ -142,12 +146,40 @@ TEST test_markup_strip_img(void)
         PASS();
 }
 
+TEST test_markup_truncate_len(void)
+{
+        /* plain text gets cut at the limit */
+        ASSERT_EQ(5, markup_truncate_len("plain text", 5));
+        /* but not within a UTF-8 character */
+        ASSERT_EQ(1, markup_truncate_len("a\xc3\xa4" "b", 2));
+        /* an entity */
+        ASSERT_EQ(4, markup_truncate_len("foo &amp; bar", 6));
+        /* or a tag */
+        ASSERT_EQ(4, markup_truncate_len("foo <b>bar</b>", 6));
+        /* rather before an unclosed tag */
+        ASSERT_EQ(12, markup_truncate_len("foo bar baz <b>bold</b>", 18));
+        ASSERT_EQ(28, markup_truncate_len("foo bar baz <b>bold</b> more text", 28));
+        /* unless that would drop most of the text */
+        ASSERT_EQ(15, markup_truncate_len("<b>foo bar baz bold</b>", 15));
+        /* void tags don't need to be closed */
+        ASSERT_EQ(12, markup_truncate_len("foo<br>bar baz", 12));
+        /* and a lone '<' isn't a tag */
+        char *x = g_strnfill(400, 'x');
+        char *lt = g_strconcat("a < ", x, NULL);
+        ASSERT_EQ(300, markup_truncate_len(lt, 300));
+        g_free(lt);
+        g_free(x);
+
+        PASS();
+}
+
 SUITE(suite_markup)
 {
         RUN_TEST(test_markup_strip);
         RUN_TEST(test_markup_strip_a);
         RUN_TEST(test_markup_strip_img);
         RUN_TEST(test_markup_transform);
+        RUN_TEST(test_markup_truncate_len);
 }
 
 /* vim: set tabstop=8 shiftwidth=8 expandtab textwidth=0: */
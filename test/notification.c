@@ -1,15 +1,18 @@
 #include "greatest.h"
+#include "src/dunst.h"
 #include "src/notification.h"
 #include "src/option_parser.h"
+#include "src/rules.h"
 #include "src/settings.h"
+#include "src/utils.h"
 
 #include <glib.h>
 
-TEST test_notification_is_duplicate_field(char **field, notification *a,
+TEST test_notification_is_duplicate_field(const char **field, notification *a,
                                           notification *b)
 {
         ASSERT(notification_is_duplicate(a, b));
-        char *tmp = *field;
+        const char *tmp = *field;
         (*field) = "Something different";
         ASSERT_FALSE(notification_is_duplicate(a, b));
         (*field) = tmp;
@@ -24,20 +27,22 @@ TEST test_notification_is_duplicate(void *notifications)
         notification *b = n[1];
 
         ASSERT(notification_is_duplicate(a, b));
+        ASSERT_EQ(notification_fingerprint(a), notification_fingerprint(b));
 
         CHECK_CALL(test_notification_is_duplicate_field(&(b->appname), a, b));
-        CHECK_CALL(test_notification_is_duplicate_field(&(b->summary), a, b));
-        CHECK_CALL(test_notification_is_duplicate_field(&(b->body), a, b));
+        CHECK_CALL(test_notification_is_duplicate_field((const char **) &(b->summary), a, b));
+        CHECK_CALL(test_notification_is_duplicate_field((const char **) &(b->body), a, b));
 
         ASSERT(notification_is_duplicate(a, b));
 
-        char *tmp = b->icon;
+        const char *tmp = b->icon;
         enum icon_position_t icon_setting_tmp = settings.icon_position;
 
         b->icon = "Test1";
 
         settings.icon_position = icons_off;
         ASSERT(notification_is_duplicate(a, b));
+        ASSERT_EQ(notification_fingerprint(a), notification_fingerprint(b));
         //Setting pointer to a random value since we are checking for null
         b->raw_icon = (RawImage*)0xff;
         ASSERT(notification_is_duplicate(a, b));
@@ -97,6 +102,236 @@ TEST test_notification_replace_single_field(void)
         PASS();
 }
 
+TEST test_notification_format_message(void)
+{
+        notification *n = notification_create();
+        n->appname = string_intern("App");
+        n->summary = g_strdup("Sum & mary");
+        n->body = g_strdup("<b>Body</b>");
+        n->icon = string_intern("/path/to/icon.png");
+        n->markup = MARKUP_FULL;
+        n->progress = 42;
+
+        n->format = "%a: %s\\n%b %I %i %p %n 100%% %x";
+        notification_format_message(n);
+        ASSERT_STR_EQ("App: Sum &amp; mary\n<b>Body</b> icon.png /path/to/icon.png [ 42%] 42 100% %x", n->msg);
+
+        n->progress = -1;
+        n->format = "%p%s%%%p  ";
+        notification_format_message(n);
+        ASSERT_STR_EQ("Sum &amp; mary%", n->msg);
+
+        notification_free(n);
+        PASS();
+}
+
+TEST test_notification_compact(void)
+{
+        notification *n = notification_create();
+        n->appname = string_intern("App");
+        n->summary = g_strdup("Summary");
+        n->body = g_strdup("Visit https://dunst-project.org");
+        n->format = "%s %b";
+        notification_init(n);
+        ASSERT_STR_EQ("https://dunst-project.org", notification_get_urls(n));
+
+        char *msg = g_strdup(n->msg);
+        size_t size = notification_memory_size(n);
+
+        notification_compact(n);
+        ASSERT(n->msg == NULL);
+        ASSERT(n->urls == NULL);
+        ASSERT(notification_memory_size(n) < size);
+
+        notification_expand(n);
+        ASSERT_STR_EQ(msg, n->msg);
+        ASSERT(n->urls == NULL);
+        ASSERT_STR_EQ("https://dunst-project.org", notification_get_urls(n));
+        ASSERT_EQ(size, notification_memory_size(n));
+
+        g_free(msg);
+        notification_free(n);
+        PASS();
+}
+
+TEST test_notification_get_urls(void)
+{
+        notification *n = notification_create();
+        n->summary = g_strdup("See www.example.com/wiki/Dunst_(software).");
+        n->body = g_strdup("<a href=\"https://dunst-project.org\">Dunst</a> "
+                           "and mailto:nobody@example.org, but no xhttp://example.org");
+        notification_init(n);
+
+        ASSERT(n->urls == NULL);
+        ASSERT_STR_EQ("[Dunst] https://dunst-project.org\n"
+                      "www.example.com/wiki/Dunst_(software)\n"
+                      "mailto:nobody@example.org",
+                      notification_get_urls(n));
+
+        notification_free(n);
+
+        n = notification_create();
+        n->body = g_strdup("Nothing to see here.");
+        notification_init(n);
+        ASSERT(notification_get_urls(n) == NULL);
+
+        notification_free(n);
+        PASS();
+}
+
+TEST test_notification_update_text_to_render(void)
+{
+        gint64 old_threshold = settings.show_age_threshold;
+        bool old_hide = settings.hide_duplicate_count;
+        settings.hide_duplicate_count = false;
+
+        notification *n = notification_create();
+        n->summary = g_strdup("Summary");
+        n->body = g_strdup("Body");
+        notification_init(n);
+        g_free(n->msg);
+        n->msg = g_strdup("Message\n");
+        n->dup_count = 2;
+        n->timestamp = time_monotonic_now() - 5 * G_USEC_PER_SEC;
+
+        settings.show_age_threshold = -1;
+        notification_update_text_to_render(n);
+        ASSERT_STR_EQ("(2) Message", n->text_to_render);
+
+        settings.show_age_threshold = 0;
+        notification_update_text_to_render(n);
+        ASSERT_STR_EQ("(2) Message (5s old)", n->text_to_render);
+
+        /* text appended to the tail gets replaced again */
+        n->text_to_render = string_append(n->text_to_render, "(3 more)", " ");
+        n->timestamp -= 60 * G_USEC_PER_SEC;
+        notification_update_text_to_render(n);
+        ASSERT_STR_EQ("(2) Message (1m 5s old)", n->text_to_render);
+
+        /* a changed prefix rebuilds the whole text as well */
+        n->dup_count = 12;
+        notification_update_text_to_render(n);
+        ASSERT_STR_EQ("(12) Message (1m 5s old)", n->text_to_render);
+        n->dup_count = 2;
+
+        /* a changed message rebuilds the whole text, it clears the
+         * text like notification_format_message() does */
+        g_free(n->msg);
+        n->msg = g_strdup("Other");
+        g_clear_pointer(&n->text_to_render, g_free);
+        notification_update_text_to_render(n);
+        ASSERT_STR_EQ("(2) Other (1m 5s old)", n->text_to_render);
+
+        settings.show_age_threshold = old_threshold;
+        settings.hide_duplicate_count = old_hide;
+        notification_free(n);
+        PASS();
+}
+
+static notification *notification_update_new(const char *summary, enum urgency urgency)
+{
+        notification *update = notification_create();
+        notification_set_strings(update, ":1.42", "volume", summary, NULL, NULL);
+        update->urgency = urgency;
+        update->progress = 20;
+        notification_init(update);
+        return update;
+}
+
+TEST test_notification_is_update(void)
+{
+        notification *n = notification_create();
+        notification_set_strings(n, ":1.42", "volume", "Volume", "", NULL);
+        n->progress = 10;
+        notification_init(n);
+
+        notification *update = notification_update_new("Volume", n->origin.urgency);
+        ASSERT(notification_is_update(n, update));
+
+        string_intern_set(&update->origin.colors[ColFG], "#ff0000");
+        ASSERT_FALSE(notification_is_update(n, update));
+        notification_free(update);
+
+        update = notification_update_new("Volume", URG_CRIT);
+        ASSERT_FALSE(notification_is_update(n, update));
+        notification_free(update);
+
+        update = notification_update_new("Muted", n->origin.urgency);
+        ASSERT_FALSE(notification_is_update(n, update));
+        notification_free(update);
+
+        notification_free(n);
+        PASS();
+}
+
+TEST test_notification_reapply_rules(void)
+{
+        rule_t *r = g_malloc(sizeof(rule_t));
+        rule_init(r);
+        r->appname = "App";
+        r->urgency = URG_CRIT;
+        r->new_icon = "replaced";
+        rules = g_slist_append(rules, r);
+        rules_compile();
+
+        notification *n = notification_create();
+        n->appname = string_intern("App");
+        n->icon = string_intern("original");
+        n->urgency = URG_LOW;
+        notification_init(n);
+
+        ASSERT_EQ(URG_CRIT, n->urgency);
+        ASSERT_STR_EQ("replaced", n->icon);
+        ASSERT_EQ(settings.timeouts[URG_CRIT], n->timeout);
+
+        rules = g_slist_remove(rules, r);
+        rules_compile();
+        notification_reapply_rules(n);
+
+        ASSERT_EQ(URG_LOW, n->urgency);
+        ASSERT_STR_EQ("original", n->icon);
+        ASSERT_EQ(settings.timeouts[URG_LOW], n->timeout);
+        ASSERT_EQ(xctx.colors[ColBG][URG_LOW], n->colors[ColBG]);
+
+        g_free(r);
+        notification_free(n);
+        PASS();
+}
+
+TEST test_rule_apply_all_memoized(void)
+{
+        rule_t *r = g_malloc(sizeof(rule_t));
+        rule_init(r);
+        r->appname = "Sp?tify";
+        r->category = "media.*";
+        r->urgency = URG_CRIT;
+        rules = g_slist_append(rules, r);
+        rules_compile();
+
+        notification *n[3];
+        const char *categories[] = { "media.song", "media.song", "other" };
+        for (int i = 0; i < G_N_ELEMENTS(n); i++) {
+                n[i] = notification_create();
+                notification_set_strings(n[i], NULL, "Spotify", "Now playing", NULL, categories[i]);
+                n[i]->urgency = URG_LOW;
+                notification_init(n[i]);
+        }
+
+        ASSERT(n[0]->appname == n[1]->appname);
+        ASSERT(n[0]->category == n[1]->category);
+        ASSERT_EQ(URG_CRIT, n[0]->urgency);
+        /* the second one got its result from the memo */
+        ASSERT_EQ(URG_CRIT, n[1]->urgency);
+        ASSERT_EQ(URG_LOW, n[2]->urgency);
+
+        rules = g_slist_remove(rules, r);
+        rules_compile();
+        g_free(r);
+        for (int i = 0; i < G_N_ELEMENTS(n); i++)
+                notification_free(n[i]);
+        PASS();
+}
+
 SUITE(suite_notification)
 {
         cmdline_load(0, NULL);
@@ -120,6 +355,13 @@ SUITE(suite_notification)
         g_free(b);
 
         RUN_TEST(test_notification_replace_single_field);
+        RUN_TEST(test_notification_format_message);
+        RUN_TEST(test_notification_compact);
+        RUN_TEST(test_notification_get_urls);
+        RUN_TEST(test_notification_update_text_to_render);
+        RUN_TEST(test_notification_is_update);
+        RUN_TEST(test_notification_reapply_rules);
+        RUN_TEST(test_rule_apply_all_memoized);
 
         g_clear_pointer(&settings.icon_path, g_free);
 }
@@ -13,6 +13,7 @@ TEST test_next_section(void)
         ASSERT_STR_EQ("path", (section = next_section(section)));
         ASSERT_STR_EQ("int", (section = next_section(section)));
         ASSERT_STR_EQ("double", (section = next_section(section)));
+        ASSERT_EQ(NULL, next_section(section));
         PASS();
 }
 
@@ -53,6 +54,8 @@ TEST test_ini_get_string(void)
         free(ptr);
         ASSERT_STR_EQ("A string \"with quotes\"", (ptr = ini_get_string(string_section, "quoted_with_quotes", "")));
         free(ptr);
+        ASSERT_STR_EQ("first", (ptr = ini_get_string(string_section, "duplicate", "")));
+        free(ptr);
 
         ASSERT_STR_EQ("default value", (ptr = ini_get_string(string_section, "nonexistent", "default value")));
         free(ptr);
@@ -0,0 +1,358 @@
+#include "greatest.h"
+#include "src/notification.h"
+#include "src/option_parser.h"
+#include "src/rules.h"
+#include "src/settings.h"
+
+#include <fnmatch.h>
+#include <glib.h>
+#include <stdbool.h>
+
+static rule_t *rule_new(const char *appname)
+{
+        rule_t *r = g_malloc(sizeof(rule_t));
+        rule_init(r);
+        r->appname = (char *) appname;
+        return r;
+}
+
+static notification *notification_new(const char *appname, const char *category)
+{
+        notification *n = notification_create();
+        notification_set_strings(n, NULL, appname, "Summary", "Body", category);
+        notification_init(n);
+        return n;
+}
+
+static void rules_free_all(void)
+{
+        g_slist_free_full(rules, g_free);
+        rules = NULL;
+        rules_compile();
+}
+
+TEST test_rule_apply_all_appname_filters(void)
+{
+        /* every rule applies a different action, to tell them apart */
+        rule_t *literal = rule_new("Spotify");
+        literal->fg = "#000001";
+        rule_t *prefix = rule_new("Spot*");
+        prefix->bg = "#000002";
+        rule_t *glob = rule_new("*tify");
+        glob->fc = "#000003";
+        rule_t *bracket = rule_new("Sp[aeiou]tify");
+        bracket->format = "bracket";
+        rule_t *question = rule_new("Sp?t?fy");
+        question->timeout = 4242;
+        rule_t *escaped = rule_new("Spot\\*");
+        escaped->urgency = URG_CRIT;
+
+        rules = g_slist_append(rules, literal);
+        rules = g_slist_append(rules, prefix);
+        rules = g_slist_append(rules, glob);
+        rules = g_slist_append(rules, bracket);
+        rules = g_slist_append(rules, question);
+        rules = g_slist_append(rules, escaped);
+        rules_compile();
+
+        const char *appnames[] = {
+                "Spotify", "Spot", "Spot*", "Spotty", "Sputify",
+                "Spotifyy", "spotify", "Notify", "Sp", "",
+        };
+
+        /* the second round gets the glob results from the memo */
+        for (int round = 0; round < 2; round++) {
+                for (int i = 0; i < G_N_ELEMENTS(appnames); i++) {
+                        const char *appname = appnames[i];
+                        notification *n = notification_new(appname, NULL);
+
+                        ASSERT_EQ_FMT(!fnmatch(literal->appname, appname, 0),
+                                      g_strcmp0(n->colors[ColFG], literal->fg) == 0, "%d");
+                        ASSERT_EQ_FMT(!fnmatch(prefix->appname, appname, 0),
+                                      g_strcmp0(n->colors[ColBG], prefix->bg) == 0, "%d");
+                        ASSERT_EQ_FMT(!fnmatch(glob->appname, appname, 0),
+                                      g_strcmp0(n->colors[ColFrame], glob->fc) == 0, "%d");
+                        ASSERT_EQ_FMT(!fnmatch(bracket->appname, appname, 0),
+                                      g_strcmp0(n->format, bracket->format) == 0, "%d");
+                        ASSERT_EQ_FMT(!fnmatch(question->appname, appname, 0),
+                                      n->timeout == question->timeout, "%d");
+                        ASSERT_EQ_FMT(!fnmatch(escaped->appname, appname, 0),
+                                      n->urgency == URG_CRIT, "%d");
+
+                        /* the uncompiled check has to agree as well */
+                        ASSERT_EQ(!fnmatch(glob->appname, appname, 0),
+                                  rule_matches_notification(glob, n));
+
+                        notification_free(n);
+                }
+        }
+
+        rules_free_all();
+        PASS();
+}
+
+TEST test_rule_apply_all_keeps_order(void)
+{
+        rule_t *glob = rule_new("*");
+        glob->timeout = 1000;
+        rule_t *literal = rule_new("Spotify");
+        literal->timeout = 2000;
+        rule_t *prefix = rule_new("Spot*");
+        prefix->timeout = 3000;
+
+        rules = g_slist_append(rules, glob);
+        rules = g_slist_append(rules, literal);
+        rules = g_slist_append(rules, prefix);
+        rules_compile();
+
+        /* the last matching rule wins, regardless of its kind of filter */
+        notification *n = notification_new("Spotify", NULL);
+        ASSERT_EQ(3000, n->timeout);
+        notification_free(n);
+
+        n = notification_new("Notify", NULL);
+        ASSERT_EQ(1000, n->timeout);
+        notification_free(n);
+
+        rules_free_all();
+        PASS();
+}
+
+TEST test_rule_apply_all_memo_recompile(void)
+{
+        rule_t *r = rule_new("Spotify");
+        r->category = "media.*";
+        r->urgency = URG_CRIT;
+        rules = g_slist_append(rules, r);
+        rules_compile();
+
+        notification *n = notification_new("Spotify", "media.song");
+        ASSERT_EQ(URG_CRIT, n->urgency);
+        notification_free(n);
+
+        /* changing the rule must not reuse the old memoized results */
+        r->category = "other.*";
+        rules_compile();
+
+        n = notification_new("Spotify", "media.song");
+        ASSERT_FALSE(n->urgency == URG_CRIT);
+        notification_free(n);
+
+        n = notification_new("Spotify", "other.song");
+        ASSERT_EQ(URG_CRIT, n->urgency);
+        notification_free(n);
+
+        rules_free_all();
+        PASS();
+}
+
+TEST test_rule_apply_all_memo_overflow(void)
+{
+        rule_t *r = rule_new(NULL);
+        r->category = "*.song";
+        r->urgency = URG_CRIT;
+        rules = g_slist_append(rules, r);
+        rules_compile();
+
+        notification *kept = notification_new("Spotify", "media.song");
+        ASSERT_EQ(URG_CRIT, kept->urgency);
+
+        /* more distinct categories than the memo holds */
+        for (int i = 0; i < 4096; i++) {
+                char *category = g_strdup_printf("%s.%d", i % 2 ? "media" : "other", i);
+                notification *n = notification_new("Spotify", category);
+                ASSERT_FALSE(n->urgency == URG_CRIT);
+                notification_free(n);
+                g_free(category);
+        }
+
+        notification *n = notification_new("Spotify", "media.song");
+        ASSERT_EQ(URG_CRIT, n->urgency);
+        ASSERT(n->category == kept->category);
+        notification_free(n);
+        notification_free(kept);
+
+        rules_free_all();
+        PASS();
+}
+
+static rule_t *rule_named(const char *name, const char *appname)
+{
+        rule_t *r = g_malloc(sizeof(rule_t));
+        rule_init(r);
+        r->name = g_strdup(name);
+        r->appname = g_strdup(appname);
+        return r;
+}
+
+TEST test_rule_equal(void)
+{
+        rule_t *a = rule_named("spotify", "Spotify");
+        a->urgency = URG_LOW;
+        a->fg = g_strdup("#ffffff");
+
+        rule_t *b = rule_dup(a);
+        ASSERT(rule_equal(a, b));
+        ASSERT(a->fg != b->fg);
+
+        /* filters */
+        g_free(b->appname);
+        b->appname = g_strdup("Spot*");
+        ASSERT_FALSE(rule_equal(a, b));
+        g_free(b->appname);
+        b->appname = NULL;
+        ASSERT_FALSE(rule_equal(a, b));
+        b->appname = g_strdup(a->appname);
+        ASSERT(rule_equal(a, b));
+
+        /* actions */
+        b->urgency = URG_CRIT;
+        ASSERT_FALSE(rule_equal(a, b));
+        b->urgency = a->urgency;
+        g_free(b->fg);
+        b->fg = g_strdup("#000000");
+        ASSERT_FALSE(rule_equal(a, b));
+
+        rule_free(a);
+        rule_free(b);
+        PASS();
+}
+
+TEST test_rules_diff_unchanged(void)
+{
+        GSList *old = NULL, *new = NULL;
+        old = g_slist_append(old, rule_named("spotify", "Spotify"));
+        old = g_slist_append(old, rule_named("mail", "Thunderbird"));
+        new = g_slist_append(new, rule_dup(old->data));
+        new = g_slist_append(new, rule_dup(old->next->data));
+
+        ASSERT_EQ(NULL, rules_diff(old, new));
+
+        g_slist_free_full(old, (GDestroyNotify) rule_free);
+        g_slist_free_full(new, (GDestroyNotify) rule_free);
+        PASS();
+}
+
+TEST test_rules_diff_moved(void)
+{
+        rule_t *first = rule_named("spotify", "Spotify");
+        rule_t *second = rule_named("media", "*");
+        rule_t *kept = rule_named("mail", "Thunderbird");
+
+        GSList *old = NULL, *new = NULL;
+        old = g_slist_append(old, first);
+        old = g_slist_append(old, second);
+        old = g_slist_append(old, kept);
+        new = g_slist_append(new, rule_dup(second));
+        new = g_slist_append(new, rule_dup(first));
+        new = g_slist_append(new, rule_dup(kept));
+
+        /* swapping them changes which one wins */
+        GSList *changed = rules_diff(old, new);
+        ASSERT_EQ(4, g_slist_length(changed));
+        ASSERT(g_slist_find(changed, first));
+        ASSERT(g_slist_find(changed, second));
+        ASSERT(g_slist_find(changed, new->data));
+        ASSERT(g_slist_find(changed, new->next->data));
+        ASSERT_FALSE(g_slist_find(changed, kept));
+        g_slist_free(changed);
+
+        g_slist_free_full(old, (GDestroyNotify) rule_free);
+        g_slist_free_full(new, (GDestroyNotify) rule_free);
+        PASS();
+}
+
+TEST test_rules_diff_added_removed(void)
+{
+        rule_t *kept = rule_named("spotify", "Spotify");
+        rule_t *removed = rule_named("mail", "Thunderbird");
+        rule_t *added = rule_named("chat", "Signal");
+
+        GSList *old = NULL, *new = NULL;
+        old = g_slist_append(old, kept);
+        old = g_slist_append(old, removed);
+        new = g_slist_append(new, rule_dup(kept));
+        new = g_slist_append(new, added);
+
+        GSList *changed = rules_diff(old, new);
+        ASSERT_EQ(2, g_slist_length(changed));
+        ASSERT(g_slist_find(changed, removed));
+        ASSERT(g_slist_find(changed, added));
+        g_slist_free(changed);
+
+        g_slist_free_full(old, (GDestroyNotify) rule_free);
+        g_slist_free_full(new, (GDestroyNotify) rule_free);
+        PASS();
+}
+
+TEST test_rules_diff_changed(void)
+{
+        rule_t *before = rule_named("spotify", "Spotify");
+        rule_t *after = rule_dup(before);
+        after->timeout = 5000;
+        rule_t *kept = rule_named("mail", "Thunderbird");
+
+        GSList *old = NULL, *new = NULL;
+        old = g_slist_append(old, before);
+        old = g_slist_append(old, kept);
+        new = g_slist_append(new, after);
+        new = g_slist_append(new, rule_dup(kept));
+
+        /* both versions, so notifications matched by either get updated */
+        GSList *changed = rules_diff(old, new);
+        ASSERT_EQ(2, g_slist_length(changed));
+        ASSERT(g_slist_find(changed, before));
+        ASSERT(g_slist_find(changed, after));
+        g_slist_free(changed);
+
+        g_slist_free_full(old, (GDestroyNotify) rule_free);
+        g_slist_free_full(new, (GDestroyNotify) rule_free);
+        PASS();
+}
+
+TEST test_rules_diff_unnamed(void)
+{
+        rule_t *before = rule_named(NULL, "Spotify");
+        rule_t *after = rule_dup(before);
+
+        GSList *old = g_slist_append(NULL, before);
+        GSList *new = g_slist_append(NULL, after);
+
+        /* without a name, the rules can't be told apart */
+        GSList *changed = rules_diff(old, new);
+        ASSERT_EQ(2, g_slist_length(changed));
+        ASSERT(g_slist_find(changed, before));
+        ASSERT(g_slist_find(changed, after));
+        g_slist_free(changed);
+
+        g_slist_free_full(old, (GDestroyNotify) rule_free);
+        g_slist_free_full(new, (GDestroyNotify) rule_free);
+        PASS();
+}
+
+SUITE(suite_rules)
+{
+        cmdline_load(0, NULL);
+        load_settings("data/dunstrc.default");
+
+        GSList *configured = rules;
+        rules = NULL;
+        rules_compile();
+
+        RUN_TEST(test_rule_apply_all_appname_filters);
+        RUN_TEST(test_rule_apply_all_keeps_order);
+        RUN_TEST(test_rule_apply_all_memo_recompile);
+        RUN_TEST(test_rule_apply_all_memo_overflow);
+        RUN_TEST(test_rule_equal);
+        RUN_TEST(test_rules_diff_unchanged);
+        RUN_TEST(test_rules_diff_moved);
+        RUN_TEST(test_rules_diff_added_removed);
+        RUN_TEST(test_rules_diff_changed);
+        RUN_TEST(test_rules_diff_unnamed);
+
+        rules = configured;
+        rules_compile();
+
+        g_clear_pointer(&settings.icon_path, g_free);
+}
+/* vim: set tabstop=8 shiftwidth=8 expandtab textwidth=0: */
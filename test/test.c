@@ -9,6 +9,8 @@ SUITE_EXTERN(suite_option_parser);
 SUITE_EXTERN(suite_notification);
 SUITE_EXTERN(suite_markup);
 SUITE_EXTERN(suite_icon);
+SUITE_EXTERN(suite_history_log);
+SUITE_EXTERN(suite_rules);
 
 GREATEST_MAIN_DEFS();
 
@@ -22,6 +24,8 @@ int main(int argc, char *argv[]) {
         RUN_SUITE(suite_notification);
         RUN_SUITE(suite_markup);
         RUN_SUITE(suite_icon);
+        RUN_SUITE(suite_history_log);
+        RUN_SUITE(suite_rules);
         GREATEST_MAIN_END();
 }
 /* vim: set tabstop=8 shiftwidth=8 expandtab textwidth=0: */
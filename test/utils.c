@@ -172,6 +172,30 @@ TEST test_string_to_time(void)
         PASS();
 }
 
+TEST test_string_intern(void)
+{
+        char buf[] = "interned";
+        const char *a = string_intern("interned");
+        const char *b = string_intern(buf);
+
+        ASSERT(a == b);
+        ASSERT(a != buf);
+        ASSERT_STR_EQ("interned", a);
+        ASSERT(string_intern_ref(a) == a);
+        ASSERT(string_intern(NULL) == NULL);
+
+        string_intern_set(&b, "other");
+        ASSERT_STR_EQ("other", b);
+        ASSERT(a != b);
+
+        string_intern_unref(a);
+        string_intern_unref(a);
+        string_intern_unref(b);
+        string_intern_unref(NULL);
+
+        PASS();
+}
+
 SUITE(suite_utils)
 {
         RUN_TEST(test_string_replace_char);
@@ -181,5 +205,6 @@ SUITE(suite_utils)
         RUN_TEST(test_string_strip_delimited);
         RUN_TEST(test_string_to_path);
         RUN_TEST(test_string_to_time);
+        RUN_TEST(test_string_intern);
 }
 /* vim: set tabstop=8 shiftwidth=8 expandtab textwidth=0: */